@@ -1,3 +1,3 @@
 @echo off
 cbundl .\src\main.c .\bundle.c
-gcc -std=c2x -Wall -Wno-unknown-pragmas -O3 .\bundle.c -o craytracer.exe -lSDL2 -lSDL2main -lm
+gcc -std=c2x -Wall -Wno-unknown-pragmas -O3 -ffp-contract=off -D_GNU_SOURCE .\bundle.c -o craytracer.exe -lSDL2 -lSDL2main -lm
@@ -0,0 +1,84 @@
+#include "aabb.h"
+#include <float.h>
+
+AABB aabb_empty() {
+    return (AABB){
+        .min = vec3(FLT_MAX, FLT_MAX, FLT_MAX),
+        .max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX),
+    };
+}
+
+AABB aabb_union(AABB a, AABB b) {
+    return (AABB){
+        .min = vec3(minf(a.min.x, b.min.x), minf(a.min.y, b.min.y),
+            minf(a.min.z, b.min.z)),
+        .max = vec3(maxf(a.max.x, b.max.x), maxf(a.max.y, b.max.y),
+            maxf(a.max.z, b.max.z)),
+    };
+}
+
+AABB aabb_grow(AABB box, Vec3 point) {
+    return aabb_union(box, (AABB){.min = point, .max = point});
+}
+
+Vec3 aabb_centroid(AABB box) {
+    return smul(vadd(box.min, box.max), 0.5f);
+}
+
+f32 aabb_half_area(AABB box) {
+    Vec3 e = vsub(box.max, box.min);
+    if (e.x < 0.0f || e.y < 0.0f || e.z < 0.0f) {
+        return 0.0f;
+    }
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+bool aabb_hit(AABB *box, Vec3 origin, Vec3 inv_dir, f32 t_max, f32 *t_near) {
+    f32 tx1 = (box->min.x - origin.x) * inv_dir.x;
+    f32 tx2 = (box->max.x - origin.x) * inv_dir.x;
+    f32 t0 = minf(tx1, tx2);
+    f32 t1 = maxf(tx1, tx2);
+
+    f32 ty1 = (box->min.y - origin.y) * inv_dir.y;
+    f32 ty2 = (box->max.y - origin.y) * inv_dir.y;
+    t0 = maxf(minf(ty1, ty2), t0);
+    t1 = minf(maxf(ty1, ty2), t1);
+
+    f32 tz1 = (box->min.z - origin.z) * inv_dir.z;
+    f32 tz2 = (box->max.z - origin.z) * inv_dir.z;
+    t0 = maxf(minf(tz1, tz2), t0);
+    t1 = minf(maxf(tz1, tz2), t1);
+
+    if (t1 < t0 || t1 < 0.0f || t0 > t_max) {
+        return false;
+    }
+    *t_near = t0;
+    return true;
+}
+
+bool aabb_clip(AABB *box, Vec3 origin, Vec3 inv_dir, f32 *t_min, f32 *t_max) {
+    f32 t0 = *t_min;
+    f32 t1 = *t_max;
+    // Candidates go first, so a NaN from 0 * inf never replaces t0 or t1.
+    for (u8 axis = 0; axis < 3; axis++) {
+        f32 o = vaxis(origin, axis);
+        f32 inv = vaxis(inv_dir, axis);
+        f32 ta = (vaxis(box->min, axis) - o) * inv;
+        f32 tb = (vaxis(box->max, axis) - o) * inv;
+        t0 = maxf(minf(ta, tb), t0);
+        t1 = minf(maxf(ta, tb), t1);
+    }
+    if (t1 < t0) {
+        return false;
+    }
+    *t_min = t0;
+    *t_max = t1;
+    return true;
+}
+
+f32 aabb_distance2(AABB *box, Vec3 point) {
+    f32 dx = maxf(maxf(box->min.x - point.x, 0.0f), point.x - box->max.x);
+    f32 dy = maxf(maxf(box->min.y - point.y, 0.0f), point.y - box->max.y);
+    f32 dz = maxf(maxf(box->min.z - point.z, 0.0f), point.z - box->max.z);
+    return dx * dx + dy * dy + dz * dz;
+}
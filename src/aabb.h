@@ -0,0 +1,63 @@
+#ifndef AABB_H
+#define AABB_H
+/**
+ * @file aabb.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief Axis-aligned bounding boxes, for culling things that rays miss.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#include "defs.h"
+#include "vec3.h"
+
+typedef struct _AABB {
+    Vec3 min;
+    Vec3 max;
+} AABB;
+
+/**
+ * @brief An inverted box that any union or grow will replace.
+ */
+AABB aabb_empty();
+
+AABB aabb_union(AABB a, AABB b);
+
+AABB aabb_grow(AABB box, Vec3 point);
+
+Vec3 aabb_centroid(AABB box);
+
+/**
+ * @brief Half the surface area of the box, which is all the SAH cares about.
+ */
+f32 aabb_half_area(AABB box);
+
+/**
+ * @brief The slab test.
+ *
+ * @param box The box to test against.
+ * @param origin The ray origin.
+ * @param inv_dir The component-wise reciprocal of the ray direction.
+ * @param t_max Boxes entered beyond this distance are counted as misses.
+ * @param t_near Set to the entry distance when the box is hit.
+ * @return Whether the ray passes through the box within [0, t_max].
+ */
+bool aabb_hit(AABB *box, Vec3 origin, Vec3 inv_dir, f32 t_max, f32 *t_near);
+
+/**
+ * @brief Clip the ray interval [t_min, t_max] to the part inside the box.
+ *
+ * @return Whether anything is left of the interval.
+ */
+bool aabb_clip(AABB *box, Vec3 origin, Vec3 inv_dir, f32 *t_min, f32 *t_max);
+
+/**
+ * @brief The squared distance from a point to the box, 0 if it is inside.
+ */
+f32 aabb_distance2(AABB *box, Vec3 point);
+
+#endif
@@ -0,0 +1,65 @@
+#include "box.h"
+#include <float.h>
+#include <math.h>
+
+Box *new_box(Vec3 a, Vec3 b, Color color) {
+    Box *box = malloc(sizeof(Box));
+    box->min = vec3(minf(a.x, b.x), minf(a.y, b.y), minf(a.z, b.z));
+    box->max = vec3(maxf(a.x, b.x), maxf(a.y, b.y), maxf(a.z, b.z));
+    box->color = color;
+    return box;
+}
+
+HitOption box_intersect(Box *box, Ray *ray) {
+    f32 t_near = -FLT_MAX;
+    f32 t_far = FLT_MAX;
+    u8 near_axis = 0;
+    u8 far_axis = 0;
+    for (u8 axis = 0; axis < 3; axis++) {
+        f32 o = vaxis(ray->origin, axis);
+        f32 d = vaxis(ray->direction, axis);
+        f32 lo = vaxis(box->min, axis);
+        f32 hi = vaxis(box->max, axis);
+        if (fabsf(d) < eps) {
+            if (o < lo || o > hi) {
+                return no_Hit();
+            }
+            continue;
+        }
+        f32 ta = (lo - o) / d;
+        f32 tb = (hi - o) / d;
+        if (ta > tb) {
+            f32 tmp = ta;
+            ta = tb;
+            tb = tmp;
+        }
+        if (ta > t_near) {
+            t_near = ta;
+            near_axis = axis;
+        }
+        if (tb < t_far) {
+            t_far = tb;
+            far_axis = axis;
+        }
+    }
+    if (t_near > t_far || t_far < 0.0f) {
+        return no_Hit();
+    }
+    bool inside = t_near < 0.0f;
+    f32 t = inside ? t_far : t_near;
+    u8 axis = inside ? far_axis : near_axis;
+    // The face normal, turned towards where the ray came from.
+    f32 side = vaxis(ray->direction, axis) > 0.0f ? -1.0f : 1.0f;
+    Vec3 normal = vec3(axis == 0 ? side : 0.0f, axis == 1 ? side : 0.0f,
+        axis == 2 ? side : 0.0f);
+    return some_Hit((Hit){
+        .color = box->color,
+        .distance = t,
+        .position = vadd(ray->origin, smul(ray->direction, t)),
+        .norm = normal,
+    });
+}
+
+AABB box_bounds(Box *box) {
+    return (AABB){.min = box->min, .max = box->max};
+}
@@ -0,0 +1,40 @@
+#ifndef BOX_H
+#define BOX_H
+/**
+ * @file box.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief A module for axis-aligned boxes.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#include "aabb.h"
+#include "color.h"
+#include "hit.h"
+#include "ray.h"
+#include "vec3.h"
+
+typedef struct _Box {
+    Vec3 min;
+    Vec3 max;
+    Color color;
+} Box;
+
+/**
+ * @brief Make a box between two opposite corners, in any order.
+ */
+Box *new_box(Vec3 a, Vec3 b, Color color);
+
+/**
+ * @brief Compute the intersect between a box and a ray. Rays starting inside
+ * the box hit it on the way out.
+ */
+HitOption box_intersect(Box *box, Ray *ray);
+
+AABB box_bounds(Box *box);
+
+#endif
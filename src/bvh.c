@@ -0,0 +1,971 @@
+#include "bvh.h"
+#include "fail.h"
+#include "parallel.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+// Nodes with fewer spheres than this are never binned by more than one thread.
+#define BVH_PARALLEL_MIN_NODE 4096
+#define BVH_PARALLEL_CHUNK 8192
+
+typedef struct _BVHBuilder {
+    BVH *bvh;
+    u32 *indices;
+    u32 *scratch;
+    AABB *bounds;
+    Vec3 *centroids;
+    u32 threads;
+    SDL_atomic_t node_count;
+    SDL_atomic_t leaf_count;
+    SDL_atomic_t depth;
+} BVHBuilder;
+
+typedef struct _BVHBin {
+    AABB bounds;
+    u32 count;
+} BVHBin;
+
+typedef struct _BVHSplit {
+    f32 cost;
+    u8 axis;
+    u32 bin;
+    AABB centroid_bounds;
+    AABB left_bounds;
+    AABB right_bounds;
+} BVHSplit;
+
+static void bvh_update_bounds(BVHBuilder *b, BVHNode *node) {
+    AABB bounds = aabb_empty();
+    for (u32 i = node->left_first; i < node->left_first + node->count; i++) {
+        bounds = aabb_union(bounds, b->bounds[b->indices[i]]);
+    }
+    node->bounds = bounds;
+}
+
+static AABB bvh_centroid_bounds(BVHBuilder *b, u32 first, u32 count) {
+    AABB cb = aabb_empty();
+    for (u32 i = first; i < first + count; i++) {
+        cb = aabb_grow(cb, b->centroids[b->indices[i]]);
+    }
+    return cb;
+}
+
+static u32 bvh_bin_index(Vec3 centroid, AABB *cb, u8 axis) {
+    f32 lo = vaxis(cb->min, axis);
+    f32 scale = BVH_BINS / (vaxis(cb->max, axis) - lo);
+    u32 bin = (u32)((vaxis(centroid, axis) - lo) * scale);
+    return bin >= BVH_BINS ? BVH_BINS - 1 : bin;
+}
+
+static void bvh_clear_bins(BVHBin bins[3][BVH_BINS]) {
+    for (u8 axis = 0; axis < 3; axis++) {
+        for (u32 i = 0; i < BVH_BINS; i++) {
+            bins[axis][i] = (BVHBin){.bounds = aabb_empty(), .count = 0};
+        }
+    }
+}
+
+static void bvh_fill_bins(BVHBuilder *b, u32 first, u32 count, AABB *cb,
+    BVHBin bins[3][BVH_BINS]) {
+    f32 lo[3], scale[3];
+    for (u8 axis = 0; axis < 3; axis++) {
+        f32 extent = vaxis(cb->max, axis) - vaxis(cb->min, axis);
+        lo[axis] = vaxis(cb->min, axis);
+        // Flat axes all land in bin 0 and are never split along.
+        scale[axis] = extent > eps ? BVH_BINS / extent : 0.0f;
+    }
+    for (u32 i = first; i < first + count; i++) {
+        u32 idx = b->indices[i];
+        Vec3 c = b->centroids[idx];
+        AABB bounds = b->bounds[idx];
+        for (u8 axis = 0; axis < 3; axis++) {
+            u32 bin_idx = (u32)((vaxis(c, axis) - lo[axis]) * scale[axis]);
+            bin_idx = bin_idx < BVH_BINS ? bin_idx : BVH_BINS - 1;
+            BVHBin *bin = &bins[axis][bin_idx];
+            bin->count++;
+            bin->bounds = aabb_union(bin->bounds, bounds);
+        }
+    }
+}
+
+/**
+ * @brief Find the cheapest split plane between the bins.
+ *
+ * @return BVHSplit The best split, with a cost of FLT_MAX if the centroids
+ * cannot be told apart along any axis.
+ */
+static BVHSplit bvh_best_split(BVHBin bins[3][BVH_BINS], AABB cb) {
+    BVHSplit best = {.cost = FLT_MAX, .centroid_bounds = cb};
+    for (u8 axis = 0; axis < 3; axis++) {
+        if (vaxis(cb.max, axis) - vaxis(cb.min, axis) <= eps) {
+            continue;
+        }
+        // Sweep from both ends to get the cost of every split plane.
+        AABB left_boxes[BVH_BINS - 1], right_boxes[BVH_BINS - 1];
+        u32 left_count[BVH_BINS - 1], right_count[BVH_BINS - 1];
+        AABB left_box = aabb_empty(), right_box = aabb_empty();
+        u32 left_sum = 0, right_sum = 0;
+        for (u32 i = 0; i < BVH_BINS - 1; i++) {
+            BVHBin *l = &bins[axis][i];
+            BVHBin *r = &bins[axis][BVH_BINS - 1 - i];
+            left_sum += l->count;
+            left_box = aabb_union(left_box, l->bounds);
+            left_count[i] = left_sum;
+            left_boxes[i] = left_box;
+
+            right_sum += r->count;
+            right_box = aabb_union(right_box, r->bounds);
+            right_count[BVH_BINS - 2 - i] = right_sum;
+            right_boxes[BVH_BINS - 2 - i] = right_box;
+        }
+        for (u32 i = 0; i < BVH_BINS - 1; i++) {
+            if (left_count[i] == 0 || right_count[i] == 0) {
+                continue;
+            }
+            f32 cost = left_count[i] * aabb_half_area(left_boxes[i]) +
+                       right_count[i] * aabb_half_area(right_boxes[i]);
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.bin = i;
+                best.left_bounds = left_boxes[i];
+                best.right_bounds = right_boxes[i];
+            }
+        }
+    }
+    return best;
+}
+
+static BVHSplit bvh_find_split(BVHBuilder *b, BVHNode *node) {
+    AABB cb = bvh_centroid_bounds(b, node->left_first, node->count);
+    BVHBin bins[3][BVH_BINS];
+    bvh_clear_bins(bins);
+    bvh_fill_bins(b, node->left_first, node->count, &cb, bins);
+    return bvh_best_split(bins, cb);
+}
+
+static u32 bvh_partition(BVHBuilder *b, BVHNode *node, BVHSplit *split) {
+    u32 i = node->left_first;
+    u32 j = node->left_first + node->count - 1;
+    while (i <= j) {
+        Vec3 c = b->centroids[b->indices[i]];
+        if (bvh_bin_index(c, &split->centroid_bounds, split->axis) <=
+            split->bin) {
+            i++;
+        } else {
+            u32 tmp = b->indices[i];
+            b->indices[i] = b->indices[j];
+            b->indices[j] = tmp;
+            j--;
+        }
+    }
+    return i - node->left_first;
+}
+
+/**
+ * @brief Per-chunk state for splitting one large node with several threads.
+ * Chunk c covers [first + c * BVH_PARALLEL_CHUNK, ...) of the node.
+ */
+typedef struct _BVHParallelSplit {
+    BVHBuilder *b;
+    u32 first;
+    AABB cb;
+    BVHSplit split;
+    AABB *chunk_cb;
+    BVHBin (*chunk_bins)[3][BVH_BINS];
+    u32 *chunk_left;
+    u32 *chunk_left_offset;
+    u32 *chunk_right_offset;
+} BVHParallelSplit;
+
+static void bvh_parallel_centroid_bounds(u32 begin, u32 end, void *ctx) {
+    BVHParallelSplit *ps = (BVHParallelSplit *)ctx;
+    ps->chunk_cb[begin / BVH_PARALLEL_CHUNK] =
+        bvh_centroid_bounds(ps->b, ps->first + begin, end - begin);
+}
+
+static void bvh_parallel_bin(u32 begin, u32 end, void *ctx) {
+    BVHParallelSplit *ps = (BVHParallelSplit *)ctx;
+    BVHBin(*bins)[BVH_BINS] = ps->chunk_bins[begin / BVH_PARALLEL_CHUNK];
+    bvh_clear_bins(bins);
+    bvh_fill_bins(ps->b, ps->first + begin, end - begin, &ps->cb, bins);
+}
+
+static bool bvh_goes_left(BVHParallelSplit *ps, u32 idx) {
+    return bvh_bin_index(ps->b->centroids[idx], &ps->split.centroid_bounds,
+               ps->split.axis) <= ps->split.bin;
+}
+
+static void bvh_parallel_count(u32 begin, u32 end, void *ctx) {
+    BVHParallelSplit *ps = (BVHParallelSplit *)ctx;
+    u32 left = 0;
+    for (u32 i = ps->first + begin; i < ps->first + end; i++) {
+        left += bvh_goes_left(ps, ps->b->indices[i]);
+    }
+    ps->chunk_left[begin / BVH_PARALLEL_CHUNK] = left;
+}
+
+static void bvh_parallel_scatter(u32 begin, u32 end, void *ctx) {
+    BVHParallelSplit *ps = (BVHParallelSplit *)ctx;
+    u32 chunk = begin / BVH_PARALLEL_CHUNK;
+    u32 left = ps->first + ps->chunk_left_offset[chunk];
+    u32 right = ps->first + ps->chunk_right_offset[chunk];
+    for (u32 i = ps->first + begin; i < ps->first + end; i++) {
+        u32 idx = ps->b->indices[i];
+        if (bvh_goes_left(ps, idx)) {
+            ps->b->scratch[left++] = idx;
+        } else {
+            ps->b->scratch[right++] = idx;
+        }
+    }
+}
+
+static void bvh_parallel_copy_back(u32 begin, u32 end, void *ctx) {
+    BVHParallelSplit *ps = (BVHParallelSplit *)ctx;
+    u32 first = ps->first + begin;
+    memcpy(ps->b->indices + first, ps->b->scratch + first,
+        sizeof(u32) * (end - begin));
+}
+
+/**
+ * @brief Bin and partition a node with every thread helping out.
+ *
+ * @return u32 The number of spheres that went left, if the split was worth
+ * making. Otherwise 0 and nothing is moved.
+ */
+static u32 bvh_parallel_split(
+    BVHBuilder *b, BVHNode *node, BVHSplit *split) {
+    u32 chunks = (node->count + BVH_PARALLEL_CHUNK - 1) / BVH_PARALLEL_CHUNK;
+    BVHParallelSplit ps = {
+        .b = b,
+        .first = node->left_first,
+        .chunk_cb = malloc(sizeof(AABB) * chunks),
+        .chunk_bins = malloc(sizeof(BVHBin[3][BVH_BINS]) * chunks),
+        .chunk_left = malloc(sizeof(u32) * chunks),
+        .chunk_left_offset = malloc(sizeof(u32) * chunks),
+        .chunk_right_offset = malloc(sizeof(u32) * chunks),
+    };
+    if (ps.chunk_cb == NULL || ps.chunk_bins == NULL ||
+        ps.chunk_left == NULL || ps.chunk_left_offset == NULL ||
+        ps.chunk_right_offset == NULL) {
+        failwith("new_bvh: could not allocate parallel split memory!\n");
+    }
+
+    parallel_for(b->threads, node->count, BVH_PARALLEL_CHUNK,
+        bvh_parallel_centroid_bounds, &ps);
+    ps.cb = aabb_empty();
+    for (u32 c = 0; c < chunks; c++) {
+        ps.cb = aabb_union(ps.cb, ps.chunk_cb[c]);
+    }
+
+    parallel_for(
+        b->threads, node->count, BVH_PARALLEL_CHUNK, bvh_parallel_bin, &ps);
+    BVHBin bins[3][BVH_BINS];
+    bvh_clear_bins(bins);
+    for (u32 c = 0; c < chunks; c++) {
+        for (u8 axis = 0; axis < 3; axis++) {
+            for (u32 i = 0; i < BVH_BINS; i++) {
+                BVHBin *from = &ps.chunk_bins[c][axis][i];
+                bins[axis][i].count += from->count;
+                bins[axis][i].bounds =
+                    aabb_union(bins[axis][i].bounds, from->bounds);
+            }
+        }
+    }
+    ps.split = bvh_best_split(bins, ps.cb);
+
+    u32 left_count = 0;
+    f32 node_area = aabb_half_area(node->bounds);
+    if (ps.split.cost + node_area < node->count * node_area) {
+        parallel_for(b->threads, node->count, BVH_PARALLEL_CHUNK,
+            bvh_parallel_count, &ps);
+        for (u32 c = 0; c < chunks; c++) {
+            ps.chunk_left_offset[c] = left_count;
+            left_count += ps.chunk_left[c];
+        }
+        u32 right_offset = left_count;
+        for (u32 c = 0; c < chunks; c++) {
+            u32 chunk_size = c + 1 < chunks
+                                 ? BVH_PARALLEL_CHUNK
+                                 : node->count - c * BVH_PARALLEL_CHUNK;
+            ps.chunk_right_offset[c] = right_offset;
+            right_offset += chunk_size - ps.chunk_left[c];
+        }
+        parallel_for(b->threads, node->count, BVH_PARALLEL_CHUNK,
+            bvh_parallel_scatter, &ps);
+        parallel_for(b->threads, node->count, BVH_PARALLEL_CHUNK,
+            bvh_parallel_copy_back, &ps);
+    }
+
+    free(ps.chunk_cb);
+    free(ps.chunk_bins);
+    free(ps.chunk_left);
+    free(ps.chunk_left_offset);
+    free(ps.chunk_right_offset);
+    *split = ps.split;
+    return left_count == node->count ? 0 : left_count;
+}
+
+/**
+ * @brief Split a node in two, unless it is small enough or splitting it would
+ * not pay off, in which case it becomes a leaf.
+ *
+ * @return bool Whether the node got children.
+ */
+static bool bvh_split_node(
+    BVHBuilder *b, u32 node_idx, u32 depth, bool parallel) {
+    BVH *bvh = b->bvh;
+    BVHNode *node = &bvh->nodes[node_idx];
+    atomic_max(&b->depth, (int)depth + 1);
+    if (node->count <= bvh->leaf_size || depth + 1 >= BVH_MAX_DEPTH) {
+        SDL_AtomicAdd(&b->leaf_count, 1);
+        return false;
+    }
+
+    u32 left_count = 0;
+    BVHSplit split;
+    if (parallel) {
+        left_count = bvh_parallel_split(b, node, &split);
+    } else {
+        split = bvh_find_split(b, node);
+        // Splitting costs one extra box test on top of the children.
+        f32 node_area = aabb_half_area(node->bounds);
+        if (split.cost + node_area < node->count * node_area) {
+            left_count = bvh_partition(b, node, &split);
+        }
+    }
+    if (left_count == 0 || left_count == node->count) {
+        SDL_AtomicAdd(&b->leaf_count, 1);
+        return false;
+    }
+
+    u32 left_idx = (u32)SDL_AtomicAdd(&b->node_count, 2);
+    BVHNode *left = &bvh->nodes[left_idx];
+    BVHNode *right = &bvh->nodes[left_idx + 1];
+    left->left_first = node->left_first;
+    left->count = left_count;
+    right->left_first = node->left_first + left_count;
+    right->count = node->count - left_count;
+    node->left_first = left_idx;
+    node->count = 0;
+    // Partitioning follows the bins, so the children are exactly as big as
+    // the bins on either side of the split.
+    left->bounds = split.left_bounds;
+    right->bounds = split.right_bounds;
+    return true;
+}
+
+static void bvh_subdivide(BVHBuilder *b, u32 node_idx, u32 depth) {
+    if (!bvh_split_node(b, node_idx, depth, false)) {
+        return;
+    }
+    u32 left_idx = b->bvh->nodes[node_idx].left_first;
+    bvh_subdivide(b, left_idx, depth + 1);
+    bvh_subdivide(b, left_idx + 1, depth + 1);
+}
+
+typedef struct _BVHSubtree {
+    u32 node;
+    u32 depth;
+    u32 count;
+} BVHSubtree;
+
+typedef struct _BVHSubtreeTasks {
+    BVHBuilder *b;
+    BVHSubtree *subtrees;
+} BVHSubtreeTasks;
+
+static int bvh_subtree_compare(const void *a, const void *b) {
+    u32 ca = ((BVHSubtree *)a)->count;
+    u32 cb = ((BVHSubtree *)b)->count;
+    return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+// Append to a list of subtrees, doubling its room when it is full.
+static void bvh_subtree_push(BVHSubtree **list, u32 *count, u32 *capacity,
+    BVHSubtree subtree) {
+    if (*count == *capacity) {
+        *capacity *= 2;
+        *list = realloc(*list, sizeof(BVHSubtree) * *capacity);
+        if (*list == NULL) {
+            failwith("new_bvh: could not grow the subtree tasks!\n");
+        }
+    }
+    (*list)[(*count)++] = subtree;
+}
+
+static void bvh_subtree_task(u32 begin, u32 end, void *ctx) {
+    BVHSubtreeTasks *tasks = (BVHSubtreeTasks *)ctx;
+    for (u32 i = begin; i < end; i++) {
+        bvh_subdivide(tasks->b, tasks->subtrees[i].node,
+            tasks->subtrees[i].depth);
+    }
+}
+
+/**
+ * @brief Split the top of the tree with all threads binning each node, until
+ * there are enough independent subtrees to hand one to each thread at a time.
+ */
+static void bvh_subdivide_parallel(BVHBuilder *b) {
+    u32 count = b->bvh->sphere_count;
+    u32 task_size = count / (b->threads * 4);
+    if (task_size < BVH_PARALLEL_MIN_NODE) {
+        task_size = BVH_PARALLEL_MIN_NODE;
+    }
+    // Only nodes of more than task_size spheres are split, so both lists
+    // stay around count / task_size per level of the tree; they grow as
+    // needed from there.
+    u32 queue_capacity = 2 * (count / task_size + 1);
+    u32 subtree_capacity = queue_capacity;
+    BVHSubtree *queue = malloc(sizeof(BVHSubtree) * queue_capacity);
+    BVHSubtree *subtrees = malloc(sizeof(BVHSubtree) * subtree_capacity);
+    if (queue == NULL || subtrees == NULL) {
+        failwith("new_bvh: could not allocate subtree tasks!\n");
+    }
+    u32 queued = 0;
+    u32 subtree_count = 0;
+    queue[queued++] = (BVHSubtree){.node = 0, .depth = 0, .count = count};
+    while (queued > 0) {
+        BVHSubtree top = queue[--queued];
+        if (top.count <= task_size) {
+            bvh_subtree_push(&subtrees, &subtree_count, &subtree_capacity, top);
+            continue;
+        }
+        if (!bvh_split_node(b, top.node, top.depth, true)) {
+            continue;
+        }
+        u32 left_idx = b->bvh->nodes[top.node].left_first;
+        for (u32 i = left_idx; i < left_idx + 2; i++) {
+            bvh_subtree_push(&queue, &queued, &queue_capacity,
+                (BVHSubtree){
+                    .node = i,
+                    .depth = top.depth + 1,
+                    .count = b->bvh->nodes[i].count,
+                });
+        }
+    }
+    // Biggest first, so the last tasks to be picked up are the quick ones.
+    qsort(subtrees, subtree_count, sizeof(BVHSubtree), bvh_subtree_compare);
+    BVHSubtreeTasks tasks = {.b = b, .subtrees = subtrees};
+    parallel_for(b->threads, subtree_count, 1, bvh_subtree_task, &tasks);
+    free(queue);
+    free(subtrees);
+}
+
+// Build the nodes of bvh over primitives with the given boxes and centroids,
+// leaving their leaf order in indices.
+static void bvh_build(BVH *bvh, AABB *bounds, Vec3 *centroids, u32 *indices,
+    u32 threads) {
+    u32 count = bvh->sphere_count;
+    BVHBuilder b = {
+        .bvh = bvh,
+        .indices = indices,
+        .scratch = malloc(sizeof(u32) * count),
+        .bounds = bounds,
+        .centroids = centroids,
+        .threads = threads > 0 ? threads : 1,
+    };
+    if (b.scratch == NULL) {
+        failwithf("new_bvh: could not allocate build memory for %u items!\n",
+            count);
+    }
+    SDL_AtomicSet(&b.node_count, 1);
+    SDL_AtomicSet(&b.leaf_count, 0);
+    SDL_AtomicSet(&b.depth, 0);
+    for (u32 i = 0; i < count; i++) {
+        b.indices[i] = i;
+    }
+
+    BVHNode *root = &bvh->nodes[0];
+    root->left_first = 0;
+    root->count = count;
+    bvh_update_bounds(&b, root);
+    if (b.threads > 1 && count > BVH_PARALLEL_MIN_NODE) {
+        bvh_subdivide_parallel(&b);
+    } else {
+        bvh_subdivide(&b, 0, 0);
+    }
+    bvh->node_count = SDL_AtomicGet(&b.node_count);
+    bvh->leaf_count = SDL_AtomicGet(&b.leaf_count);
+    bvh->depth = SDL_AtomicGet(&b.depth);
+    free(b.scratch);
+}
+
+BVH *new_bvh(Sphere **spheres, u32 count, u32 leaf_size, u32 threads) {
+    BVH *bvh = malloc(sizeof(BVH));
+    if (bvh == NULL) {
+        failwith("new_bvh: could not allocate memory!\n");
+    }
+    bvh->leaf_size = leaf_size > 0 ? leaf_size : 1;
+    bvh->sphere_count = count;
+    bvh->node_count = 0;
+    bvh->leaf_count = 0;
+    bvh->depth = 0;
+    bvh->build_cost = 0.0f;
+    bvh->nodes = malloc(sizeof(BVHNode) * (count > 0 ? 2 * count : 1));
+    bvh->spheres = malloc(sizeof(Sphere *) * (count > 0 ? count : 1));
+    if (bvh->nodes == NULL || bvh->spheres == NULL) {
+        failwithf("new_bvh: could not allocate memory for %u spheres!\n",
+            count);
+    }
+    if (count == 0) {
+        bvh->store = new_sphere_store(bvh->spheres, NULL, 0);
+        return bvh;
+    }
+
+    u32 *indices = malloc(sizeof(u32) * count);
+    AABB *bounds = malloc(sizeof(AABB) * count);
+    Vec3 *centroids = malloc(sizeof(Vec3) * count);
+    if (indices == NULL || bounds == NULL || centroids == NULL) {
+        failwithf("new_bvh: could not allocate build memory for %u spheres!\n",
+            count);
+    }
+    for (u32 i = 0; i < count; i++) {
+        bounds[i] = sphere_bounds(spheres[i]);
+        centroids[i] = spheres[i]->center;
+    }
+    bvh_build(bvh, bounds, centroids, indices, threads);
+
+    // Store spheres in leaf order, so leaves read them contiguously.
+    for (u32 i = 0; i < count; i++) {
+        bvh->spheres[i] = spheres[indices[i]];
+    }
+    bvh->store = new_sphere_store(bvh->spheres, indices, count);
+    free(indices);
+    free(bounds);
+    free(centroids);
+    bvh->build_cost = bvh_sah_cost(bvh);
+    return bvh;
+}
+
+BVHNode *bvh_build_nodes(AABB *bounds, Vec3 *centroids, u32 count,
+    u32 leaf_size, u32 threads, u32 *order, u32 *node_count) {
+    BVH bvh = {
+        .nodes = malloc(sizeof(BVHNode) * (count > 0 ? 2 * count : 1)),
+        .leaf_size = leaf_size > 0 ? leaf_size : 1,
+        .sphere_count = count,
+    };
+    if (bvh.nodes == NULL) {
+        failwithf("bvh_build_nodes: could not allocate nodes for %u items!\n",
+            count);
+    }
+    if (count == 0) {
+        bvh.nodes[0] = (BVHNode){.bounds = aabb_empty()};
+        *node_count = 1;
+        return bvh.nodes;
+    }
+    bvh_build(&bvh, bounds, centroids, order, threads);
+    *node_count = bvh.node_count;
+    return realloc(bvh.nodes, sizeof(BVHNode) * bvh.node_count);
+}
+
+// Find the closest sphere below a node whose box the ray is known to hit,
+// lowering *closest_dist and setting *closest as hits are found.
+static void bvh_traverse(BVH *bvh, u32 root, Ray *ray, Vec3 inv_dir,
+    f32 *closest_dist, u32 *closest) {
+    u32 stack[BVH_MAX_DEPTH];
+    f32 stack_t[BVH_MAX_DEPTH];
+    u32 sp = 0;
+    BVHNode *node = &bvh->nodes[root];
+    while (true) {
+        if (node->count > 0) {
+            u32 hit = sphere_intersect_n(
+                bvh->store, node->left_first, node->count, ray, closest_dist);
+            if (hit != SPHERE_STORE_MISS) {
+                *closest = hit;
+            }
+        } else {
+            BVHNode *left = &bvh->nodes[node->left_first];
+            BVHNode *right = left + 1;
+            f32 t_left, t_right;
+            bool hit_left = aabb_hit(
+                &left->bounds, ray->origin, inv_dir, *closest_dist, &t_left);
+            bool hit_right = aabb_hit(
+                &right->bounds, ray->origin, inv_dir, *closest_dist, &t_right);
+            if (hit_left && hit_right) {
+                // Visit the nearer child first, the other one may be culled
+                // by the time it is popped.
+                if (t_right < t_left) {
+                    stack[sp] = node->left_first;
+                    stack_t[sp++] = t_left;
+                    node = right;
+                } else {
+                    stack[sp] = node->left_first + 1;
+                    stack_t[sp++] = t_right;
+                    node = left;
+                }
+                continue;
+            }
+            if (hit_left) {
+                node = left;
+                continue;
+            }
+            if (hit_right) {
+                node = right;
+                continue;
+            }
+        }
+        // Pop until a node that is still in front of the closest hit.
+        node = NULL;
+        while (sp > 0) {
+            sp--;
+            if (stack_t[sp] <= *closest_dist) {
+                node = &bvh->nodes[stack[sp]];
+                break;
+            }
+        }
+        if (node == NULL) {
+            break;
+        }
+    }
+}
+
+u32 bvh_closest(BVH *bvh, Ray *ray, f32 *t) {
+    u32 closest = SPHERE_STORE_MISS;
+    *t = FLT_MAX;
+    if (bvh->sphere_count == 0) {
+        return closest;
+    }
+    Vec3 inv_dir = safe_inverse(ray->direction);
+    f32 t_near;
+    if (!aabb_hit(&bvh->nodes[0].bounds, ray->origin, inv_dir, *t, &t_near)) {
+        return closest;
+    }
+    bvh_traverse(bvh, 0, ray, inv_dir, t, &closest);
+    return closest;
+}
+
+HitOption bvh_intersect(BVH *bvh, Ray *ray) {
+    f32 t;
+    u32 closest = bvh_closest(bvh, ray, &t);
+    if (closest == SPHERE_STORE_MISS) {
+        return no_Hit();
+    }
+    // Only the closest sphere needs its hit point and normal worked out.
+    return sphere_intersect(bvh->spheres[closest], ray);
+}
+
+bool bvh_occluded(BVH *bvh, Ray *ray, f32 t_max, u32 *occluder) {
+    if (bvh->sphere_count == 0) {
+        return false;
+    }
+    Vec3 inv_dir = safe_inverse(ray->direction);
+    // One sibling waits per level, plus the node to be popped next.
+    u32 stack[BVH_MAX_DEPTH + 1];
+    u32 sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        BVHNode *node = &bvh->nodes[stack[--sp]];
+        f32 t_near;
+        if (!aabb_hit(&node->bounds, ray->origin, inv_dir, t_max, &t_near)) {
+            continue;
+        }
+        if (node->count > 0) {
+            f32 t = t_max;
+            u32 hit = sphere_intersect_n(
+                bvh->store, node->left_first, node->count, ray, &t);
+            if (hit != SPHERE_STORE_MISS) {
+                *occluder = hit;
+                return true;
+            }
+            continue;
+        }
+        stack[sp++] = node->left_first + 1;
+        stack[sp++] = node->left_first;
+    }
+    return false;
+}
+
+/**
+ * The rays of a packet, with what the traversal needs of each kept side by
+ * side. The bounds on the reciprocal directions are used to cull boxes that
+ * no ray in the packet can hit, per axis, and only on axes where every ray
+ * points the same way; other axes are left out of the cull.
+ */
+typedef struct _BVHPacket {
+    Ray *rays;
+    u32 count;
+    Vec3 inv_dir[BVH_PACKET_MAX];
+    f32 t[BVH_PACKET_MAX];
+    u32 closest[BVH_PACKET_MAX];
+    f32 inv_lo[3];
+    f32 inv_hi[3];
+    bool coherent[3];
+    Vec3 mean_dir;
+} BVHPacket;
+
+static void bvh_packet_setup(BVHPacket *packet, Ray *rays, u32 count) {
+    packet->rays = rays;
+    packet->count = count;
+    packet->mean_dir = vec3(0.0f, 0.0f, 0.0f);
+    for (u8 axis = 0; axis < 3; axis++) {
+        packet->inv_lo[axis] = FLT_MAX;
+        packet->inv_hi[axis] = -FLT_MAX;
+        packet->coherent[axis] = true;
+    }
+    f32 first_sign[3] = {vaxis(rays[0].direction, 0),
+        vaxis(rays[0].direction, 1), vaxis(rays[0].direction, 2)};
+    for (u32 i = 0; i < count; i++) {
+        packet->inv_dir[i] = safe_inverse(rays[i].direction);
+        packet->t[i] = FLT_MAX;
+        packet->closest[i] = SPHERE_STORE_MISS;
+        packet->mean_dir = vadd(packet->mean_dir, rays[i].direction);
+        for (u8 axis = 0; axis < 3; axis++) {
+            f32 d = vaxis(rays[i].direction, axis);
+            f32 inv = vaxis(packet->inv_dir[i], axis);
+            if (d == 0.0f || !isfinite(inv) ||
+                (d < 0.0f) != (first_sign[axis] < 0.0f)) {
+                packet->coherent[axis] = false;
+            }
+            packet->inv_lo[axis] = minf(packet->inv_lo[axis], inv);
+            packet->inv_hi[axis] = maxf(packet->inv_hi[axis], inv);
+        }
+    }
+}
+
+// Whether no ray of the packet can hit the box nearer than the farthest of
+// their closest hits so far. As each ray's reciprocal direction lies within
+// the packet's bounds, and rounding is monotonic, each slab distance lies
+// within the bounds computed here.
+static bool bvh_packet_misses(BVHPacket *packet, AABB *box, f32 t_max) {
+    Vec3 origin = packet->rays[0].origin;
+    f32 entry = -FLT_MAX;
+    f32 exit = FLT_MAX;
+    for (u8 axis = 0; axis < 3; axis++) {
+        if (!packet->coherent[axis]) {
+            continue;
+        }
+        f32 o = vaxis(origin, axis);
+        f32 a = vaxis(box->min, axis) - o;
+        f32 b = vaxis(box->max, axis) - o;
+        f32 lo = packet->inv_lo[axis];
+        f32 hi = packet->inv_hi[axis];
+        entry = maxf(entry,
+            minf(minf(a * lo, a * hi), minf(b * lo, b * hi)));
+        exit = minf(exit, maxf(maxf(a * lo, a * hi), maxf(b * lo, b * hi)));
+    }
+    return entry > exit || exit < 0.0f || entry > t_max;
+}
+
+static u64 bvh_packet_mask(BVHPacket *packet, AABB *box, u64 active) {
+    u64 mask = 0;
+    f32 t_near;
+    while (active != 0) {
+        u32 i = __builtin_ctzll(active);
+        active &= active - 1;
+        if (aabb_hit(box, packet->rays[i].origin, packet->inv_dir[i],
+                packet->t[i], &t_near)) {
+            mask |= 1ull << i;
+        }
+    }
+    return mask;
+}
+
+static f32 bvh_packet_t_max(BVHPacket *packet, u64 active) {
+    f32 t_max = 0.0f;
+    while (active != 0) {
+        u32 i = __builtin_ctzll(active);
+        active &= active - 1;
+        t_max = maxf(t_max, packet->t[i]);
+    }
+    return t_max;
+}
+
+static void bvh_traverse_packet(BVH *bvh, BVHPacket *packet) {
+    // Far children wait one per level, plus the near one about to be popped.
+    u32 stack[BVH_MAX_DEPTH + 1];
+    u64 stack_mask[BVH_MAX_DEPTH + 1];
+    u32 sp = 0;
+    stack[sp] = 0;
+    stack_mask[sp++] =
+        packet->count == 64 ? ~0ull : (1ull << packet->count) - 1;
+    while (sp > 0) {
+        sp--;
+        BVHNode *node = &bvh->nodes[stack[sp]];
+        u64 active = stack_mask[sp];
+        if (bvh_packet_misses(
+                packet, &node->bounds, bvh_packet_t_max(packet, active))) {
+            continue;
+        }
+        active = bvh_packet_mask(packet, &node->bounds, active);
+        if (active == 0) {
+            continue;
+        }
+        if (__builtin_popcountll(active) < BVH_PACKET_MIN_ACTIVE) {
+            // Too few rays are left for sharing to pay off.
+            while (active != 0) {
+                u32 i = __builtin_ctzll(active);
+                active &= active - 1;
+                bvh_traverse(bvh, stack[sp], &packet->rays[i],
+                    packet->inv_dir[i], &packet->t[i], &packet->closest[i]);
+            }
+            continue;
+        }
+        if (node->count > 0) {
+            while (active != 0) {
+                u32 i = __builtin_ctzll(active);
+                active &= active - 1;
+                u32 hit = sphere_intersect_n(bvh->store, node->left_first,
+                    node->count, &packet->rays[i], &packet->t[i]);
+                if (hit != SPHERE_STORE_MISS) {
+                    packet->closest[i] = hit;
+                }
+            }
+            continue;
+        }
+        // Push the farther child first, judged along the packet's average
+        // direction, so the nearer one is visited first.
+        BVHNode *left = &bvh->nodes[node->left_first];
+        Vec3 origin = packet->rays[0].origin;
+        f32 d_left = dot(vsub(aabb_centroid(left->bounds), origin),
+            packet->mean_dir);
+        f32 d_right = dot(vsub(aabb_centroid(left[1].bounds), origin),
+            packet->mean_dir);
+        u32 near = d_left <= d_right ? node->left_first : node->left_first + 1;
+        u32 far = near == node->left_first ? near + 1 : node->left_first;
+        stack[sp] = far;
+        stack_mask[sp++] = active;
+        stack[sp] = near;
+        stack_mask[sp++] = active;
+    }
+}
+
+void bvh_closest_packet(
+    BVH *bvh, Ray *rays, u32 count, u32 *closest, f32 *t) {
+    bool shared_origin = count <= BVH_PACKET_MAX;
+    for (u32 i = 1; i < count && shared_origin; i++) {
+        Vec3 a = rays[i].origin;
+        Vec3 b = rays[0].origin;
+        shared_origin = a.x == b.x && a.y == b.y && a.z == b.z;
+    }
+    if (bvh->sphere_count == 0 || count == 0 || !shared_origin) {
+        for (u32 i = 0; i < count; i++) {
+            closest[i] = bvh_closest(bvh, &rays[i], &t[i]);
+        }
+        return;
+    }
+    BVHPacket packet;
+    bvh_packet_setup(&packet, rays, count);
+    bvh_traverse_packet(bvh, &packet);
+    memcpy(closest, packet.closest, sizeof(u32) * count);
+    memcpy(t, packet.t, sizeof(f32) * count);
+}
+
+// Refits aim for this many subtrees per thread, to even out their sizes.
+#define BVH_REFIT_TASKS_PER_THREAD 8
+
+typedef struct _BVHRefit {
+    BVH *bvh;
+    u32 *roots;
+} BVHRefit;
+
+static AABB bvh_refit_subtree(BVH *bvh, u32 index) {
+    BVHNode *node = &bvh->nodes[index];
+    if (node->count > 0) {
+        AABB bounds = aabb_empty();
+        for (u32 i = node->left_first; i < node->left_first + node->count;
+             i++) {
+            bounds = aabb_union(bounds, sphere_bounds(bvh->spheres[i]));
+        }
+        node->bounds = bounds;
+        sphere_store_update_range(bvh->store, node->left_first, node->count);
+    } else {
+        AABB left = bvh_refit_subtree(bvh, node->left_first);
+        AABB right = bvh_refit_subtree(bvh, node->left_first + 1);
+        node->bounds = aabb_union(left, right);
+    }
+    return node->bounds;
+}
+
+static void bvh_refit_chunk(u32 begin, u32 end, void *ctx) {
+    BVHRefit *refit = (BVHRefit *)ctx;
+    for (u32 i = begin; i < end; i++) {
+        bvh_refit_subtree(refit->bvh, refit->roots[i]);
+    }
+}
+
+void bvh_refit(BVH *bvh, u32 threads) {
+    if (bvh->sphere_count == 0) {
+        return;
+    }
+    threads = threads > 0 ? threads : 1;
+    u32 target = threads > 1 ? threads * BVH_REFIT_TASKS_PER_THREAD : 1;
+    // Each pass below at most doubles the subtrees, so none outgrow this.
+    u32 capacity = 2 * target;
+    u32 *roots = malloc(sizeof(u32) * capacity);
+    u32 *next = malloc(sizeof(u32) * capacity);
+    u32 *top = malloc(sizeof(u32) * capacity);
+    if (roots == NULL || next == NULL || top == NULL) {
+        failwith("bvh_refit: could not allocate memory!\n");
+    }
+    u32 root_count = 1;
+    u32 top_count = 0;
+    roots[0] = 0;
+    // Open the tree a level at a time until there are enough subtrees to
+    // share out, remembering the opened nodes in breadth-first order.
+    bool opened = true;
+    while (root_count < target && opened) {
+        opened = false;
+        u32 next_count = 0;
+        for (u32 i = 0; i < root_count; i++) {
+            BVHNode *node = &bvh->nodes[roots[i]];
+            if (node->count > 0) {
+                next[next_count++] = roots[i];
+                continue;
+            }
+            top[top_count++] = roots[i];
+            next[next_count++] = node->left_first;
+            next[next_count++] = node->left_first + 1;
+            opened = true;
+        }
+        u32 *swap = roots;
+        roots = next;
+        next = swap;
+        root_count = next_count;
+    }
+
+    BVHRefit refit = {.bvh = bvh, .roots = roots};
+    parallel_for(threads, root_count, 1, bvh_refit_chunk, &refit);
+    // Walking the opened nodes backwards finishes children before parents.
+    for (u32 i = top_count; i-- > 0;) {
+        BVHNode *node = &bvh->nodes[top[i]];
+        node->bounds = aabb_union(bvh->nodes[node->left_first].bounds,
+            bvh->nodes[node->left_first + 1].bounds);
+    }
+    free(roots);
+    free(next);
+    free(top);
+}
+
+f32 bvh_sah_cost(BVH *bvh) {
+    if (bvh->sphere_count == 0) {
+        return 0.0f;
+    }
+    f32 root_area = aabb_half_area(bvh->nodes[0].bounds);
+    if (root_area <= 0.0f) {
+        return 0.0f;
+    }
+    f64 cost = 0.0;
+    for (u32 i = 0; i < bvh->node_count; i++) {
+        BVHNode *node = &bvh->nodes[i];
+        f32 area = aabb_half_area(node->bounds);
+        cost += node->count > 0 ? area * node->count : area;
+    }
+    return cost / root_area;
+}
+
+void destroy_bvh(BVH *bvh) {
+    destroy_sphere_store(bvh->store);
+    free(bvh->nodes);
+    free(bvh->spheres);
+    free(bvh);
+}
+
+void bvh_debug_print(BVH *bvh) {
+    printf("BVH: %u nodes of %zu bytes (%.2f MiB), %u leaves, depth %u, "
+           "leaf size %u, %u spheres, SAH cost %.2f\n",
+        bvh->node_count, sizeof(BVHNode),
+        bvh->node_count * sizeof(BVHNode) / (1024.0 * 1024.0), bvh->leaf_count,
+        bvh->depth, bvh->leaf_size, bvh->sphere_count, bvh->build_cost);
+}
@@ -0,0 +1,137 @@
+#ifndef BVH_H
+#define BVH_H
+/**
+ * @file bvh.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief A bounding volume hierarchy over spheres, built with binned SAH.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#include "aabb.h"
+#include "defs.h"
+#include "hit.h"
+#include "ray.h"
+#include "sphere.h"
+#include "sphere_store.h"
+
+#define BVH_BINS 16
+#define BVH_MAX_DEPTH 64
+#define BVH_DEFAULT_LEAF_SIZE 4
+// Packets hold at most this many rays, one bit each in a 64-bit mask.
+#define BVH_PACKET_MAX 64
+// Packets down to fewer live rays than this go on one ray at a time.
+#define BVH_PACKET_MIN_ACTIVE 8
+// Refitted hierarchies whose SAH cost grew by more than this are rebuilt.
+#define BVH_REFIT_MAX_DEGRADATION 1.5f
+
+/**
+ * @brief A node is a leaf when count > 0, in which case left_first is the
+ * index of its first sphere, both in spheres and in store. Otherwise
+ * left_first is the index of the left child, and the right child sits right
+ * after it.
+ */
+typedef struct _BVHNode {
+    AABB bounds;
+    u32 left_first;
+    u32 count;
+} BVHNode;
+
+typedef struct _BVH {
+    BVHNode *nodes;
+    u32 node_count;
+    u32 leaf_count;
+    u32 depth;
+    u32 leaf_size;
+    Sphere **spheres;
+    SphereStore *store;
+    u32 sphere_count;
+    f32 build_cost;
+} BVH;
+
+/**
+ * @brief Build a hierarchy over the given spheres.
+ *
+ * @param spheres The spheres, which are not copied, only pointed to.
+ * @param count The number of spheres.
+ * @param leaf_size Nodes with this many spheres or fewer are never split.
+ * @param threads How many threads may help build it.
+ * @return BVH* A new hierarchy.
+ */
+BVH *new_bvh(Sphere **spheres, u32 count, u32 leaf_size, u32 threads);
+
+/**
+ * @brief Build just the nodes of a hierarchy, over primitives of any kind,
+ * the same way new_bvh does over spheres. Leaves refer to their primitives by
+ * position in order, which callers use to store them in leaf order.
+ *
+ * @param bounds The box of each primitive.
+ * @param centroids The point each primitive is binned by.
+ * @param order Set to the index of each primitive, in leaf order.
+ * @param node_count Set to the number of nodes.
+ * @return BVHNode* The nodes, with the root first.
+ */
+BVHNode *bvh_build_nodes(AABB *bounds, Vec3 *centroids, u32 count,
+    u32 leaf_size, u32 threads, u32 *order, u32 *node_count);
+
+/**
+ * @brief Find the closest sphere hit by a ray, visiting nodes front-to-back,
+ * without working out anything about the hit.
+ *
+ * @param t Set to the distance to the hit.
+ * @return u32 The index of the sphere in spheres, or SPHERE_STORE_MISS.
+ */
+u32 bvh_closest(BVH *bvh, Ray *ray, f32 *t);
+
+/**
+ * @brief Like bvh_closest, with the hit worked out.
+ */
+HitOption bvh_intersect(BVH *bvh, Ray *ray);
+
+/**
+ * @brief Whether a ray hits any sphere nearer than t_max. Stops at the first
+ * one found, in whatever order, and works out nothing about the hit.
+ *
+ * @param occluder Set to the index of the sphere found in spheres and store,
+ * if any.
+ */
+bool bvh_occluded(BVH *bvh, Ray *ray, f32 t_max, u32 *occluder);
+
+/**
+ * @brief Like bvh_closest for each ray of a packet, walking the tree once
+ * for all of them. Boxes that no ray in the packet can hit are
+ * culled with one interval test, and where only a few rays are left in a
+ * subtree they finish it one by one. The rays should be coherent, such as
+ * the primary rays of a block of pixels; packets whose rays do not share an
+ * origin are traced one ray at a time.
+ *
+ * @param rays At most BVH_PACKET_MAX rays.
+ * @param closest Set to what bvh_closest would return for each ray.
+ * @param t Set to the distance bvh_closest would give for each ray.
+ */
+void bvh_closest_packet(
+    BVH *bvh, Ray *rays, u32 count, u32 *closest, f32 *t);
+
+/**
+ * @brief Recompute every node's bounds bottom-up after spheres have moved or
+ * changed radius, keeping the tree's shape. Subtrees are refitted in parallel.
+ *
+ * @param threads How many threads may help.
+ */
+void bvh_refit(BVH *bvh, u32 threads);
+
+/**
+ * @brief The surface area heuristic cost of the hierarchy, relative to its
+ * root box, with a box test costing as much as a sphere test.
+ */
+f32 bvh_sah_cost(BVH *bvh);
+
+void destroy_bvh(BVH *bvh);
+
+void bvh_debug_print(BVH *bvh);
+
+#endif
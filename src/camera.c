@@ -1,13 +1,15 @@
 #include "camera.h"
 #include <math.h>
+#include "vec4.h"
 
 Camera *new_camera(Vec3 pos, Vec3 dir)
 {
     Camera *camera = malloc(sizeof(Camera));
     camera->position = pos;
     camera->direction = dir;
-    camera->right = norm(cross(camera->direction, vec3(0.0, 1.0, 0.0)));
-    camera->up = norm(cross(camera->right, camera->direction));
+    Vec3A right = norm3a(cross3a(vec3a_load(dir), vec3a(0.0f, 1.0f, 0.0f)));
+    camera->right = vec3a_store(right);
+    camera->up = vec3a_store(norm3a(cross3a(right, vec3a_load(dir))));
     return camera;
 }
 
@@ -16,6 +18,12 @@ Camera *new_camera(Vec3 pos, Vec3 dir)
 Ray *setup_perspective_rays(Camera *camera, u32 canvas_width, u32 canvas_height)
 {
     Ray *rays = calloc(canvas_width * canvas_height, sizeof(Ray));
+    setup_perspective_rays_into(camera, canvas_width, canvas_height, rays);
+    return rays;
+}
+
+void setup_perspective_rays_into(Camera *camera, u32 canvas_width, u32 canvas_height, Ray *rays)
+{
     f32 aspect_ratio = (f32)canvas_width / (f32)canvas_height;
     f32 fov = 90.0; // Field of view in degrees
 
@@ -31,6 +39,9 @@ Ray *setup_perspective_rays(Camera *camera, u32 canvas_width, u32 canvas_height)
     // Vec3 image_plane_top_left =
     //     vsub(camera->position, vadd(smul(camera->direction, 1.0), smul(camera->up, half_height)));
 
+    Vec3A direction = vec3a_load(camera->direction);
+    Vec3A right = vec3a_load(camera->right);
+    Vec3A up = vec3a_load(camera->up);
     for (u32 y = 0; y < canvas_height; y++)
     {
         for (u32 x = 0; x < canvas_width; x++)
@@ -38,12 +49,24 @@ Ray *setup_perspective_rays(Camera *camera, u32 canvas_width, u32 canvas_height)
             f32 sx = half_width - x * step_x;
             f32 sy = half_height - y * step_y;
 
-            Vec3 ray_direction = norm(vadd(vadd(camera->direction, smul(camera->right, sx)), smul(camera->up, sy)));
+            Vec3A ray_direction = norm3a(vadd4(vadd4(direction, smul4(right, sx)), smul4(up, sy)));
 
             u32 ray_index = y * canvas_width + x;
             rays[ray_index].origin = camera->position;
-            rays[ray_index].direction = ray_direction;
+            rays[ray_index].direction = vec3a_store(ray_direction);
         }
     }
-    return rays;
+}
+
+u32 camera_gather_block(Ray *rays, u32 canvas_width, u32 canvas_height, u32 x, u32 y, u32 block, Ray *packet)
+{
+    u32 n = 0;
+    for (u32 row = y; row < y + block && row < canvas_height; row++)
+    {
+        for (u32 col = x; col < x + block && col < canvas_width; col++)
+        {
+            packet[n++] = rays[row * canvas_width + col];
+        }
+    }
+    return n;
 }
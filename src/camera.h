@@ -28,4 +28,25 @@ Camera *new_camera(Vec3 pos, Vec3 dir);
 
 Ray *setup_perspective_rays(Camera *camera, u32 canvas_width, u32 canvas_height);
 
+/**
+ * @brief Like setup_perspective_rays, but into rays the caller already has,
+ * so a buffer can be reused from one frame to the next.
+ *
+ * @param rays Room for canvas_width * canvas_height rays.
+ */
+void setup_perspective_rays_into(Camera *camera, u32 canvas_width, u32 canvas_height, Ray *rays);
+
+/**
+ * @brief Copy the rays of a square block of pixels into a packet, row by row,
+ * leaving out the parts of the block that fall off the canvas.
+ *
+ * @param rays The rays from setup_perspective_rays.
+ * @param x The column of the block's top-left pixel.
+ * @param y The row of the block's top-left pixel.
+ * @param block The side of the block, at most 8.
+ * @param packet Room for block * block rays.
+ * @return u32 How many rays were copied.
+ */
+u32 camera_gather_block(Ray *rays, u32 canvas_width, u32 canvas_height, u32 x, u32 y, u32 block, Ray *packet);
+
 #endif
\ No newline at end of file
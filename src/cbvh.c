@@ -0,0 +1,281 @@
+#include "cbvh.h"
+#include "fail.h"
+#include "util.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// Every node visited pushes at most 3 more than it pops.
+#define CBVH_STACK_SIZE (BVH_MAX_DEPTH * 4)
+#define CBVH_MIN_EXPONENT -100
+
+/**
+ * @brief 2 to the power of exponent, built directly from its bits, since
+ * exponents never go below the normal range.
+ */
+static f32 cbvh_step(i8 exponent) {
+    union {
+        u32 bits;
+        f32 value;
+    } step = {.bits = (u32)(exponent + 127) << 23};
+    return step.value;
+}
+
+/**
+ * @brief The smallest power-of-two step that covers extent in levels steps.
+ */
+static i8 cbvh_exponent(f32 extent, f32 levels) {
+    if (!(extent > 0.0f)) {
+        return CBVH_MIN_EXPONENT;
+    }
+    int exponent;
+    frexpf(extent / levels, &exponent);
+    if (exponent < CBVH_MIN_EXPONENT) {
+        return CBVH_MIN_EXPONENT;
+    }
+    return exponent > 127 ? 127 : exponent;
+}
+
+/**
+ * @brief Encode min and max in steps from origin, rounding outwards.
+ */
+static void cbvh_quantize(f32 min, f32 max, f32 origin, i8 exponent,
+    u32 levels, u32 *q_min, u32 *q_max) {
+    f32 step = cbvh_step(exponent);
+    f32 lo = floorf((min - origin) / step);
+    f32 hi = ceilf((max - origin) / step);
+    i64 q_lo = lo < 0.0f ? 0 : lo > levels ? levels : (i64)lo;
+    i64 q_hi = hi < 0.0f ? 0 : hi > levels ? levels : (i64)hi;
+    while (q_lo > 0 && origin + q_lo * step > min) {
+        q_lo--;
+    }
+    while (q_hi < levels && origin + q_hi * step < max) {
+        q_hi++;
+    }
+    *q_min = q_lo;
+    *q_max = q_hi;
+}
+
+/**
+ * @brief Decode one row of four quantized bounds into out.
+ */
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+
+#define CBVH_DECODE_ROW(out, wide, origin, step)                                \
+    _mm_storeu_ps(out, _mm_add_ps(_mm_set1_ps(origin),                          \
+                           _mm_mul_ps(_mm_cvtepi32_ps(wide), _mm_set1_ps(step))))
+
+#define CBVH_DECODE_ROW_8(out, row, origin, step)                               \
+    do {                                                                        \
+        u32 packed;                                                             \
+        memcpy(&packed, row, sizeof(packed));                                   \
+        __m128i zero = _mm_setzero_si128();                                     \
+        __m128i bytes = _mm_cvtsi32_si128((int)packed);                         \
+        __m128i wide = _mm_unpacklo_epi16(                                      \
+            _mm_unpacklo_epi8(bytes, zero), zero);                              \
+        CBVH_DECODE_ROW(out, wide, origin, step);                               \
+    } while (0)
+
+#define CBVH_DECODE_ROW_16(out, row, origin, step)                              \
+    do {                                                                        \
+        __m128i halves = _mm_loadl_epi64((const __m128i *)(row));               \
+        __m128i wide = _mm_unpacklo_epi16(halves, _mm_setzero_si128());         \
+        CBVH_DECODE_ROW(out, wide, origin, step);                               \
+    } while (0)
+
+#else
+
+#define CBVH_DECODE_ROW_8(out, row, origin, step)                               \
+    do {                                                                        \
+        for (u32 slot = 0; slot < 4; slot++) {                                  \
+            (out)[slot] = (origin) + (row)[slot] * (step);                      \
+        }                                                                       \
+    } while (0)
+
+#define CBVH_DECODE_ROW_16 CBVH_DECODE_ROW_8
+
+#endif
+
+#define define_CBVH(B, Q)                                                       \
+    static void cbvh##B##_encode(CBVH##B##Node *out, WBVH4Node *in) {           \
+        const u32 levels = (1u << B) - 1;                                       \
+        out->used = 0;                                                          \
+        AABB parent = aabb_empty();                                             \
+        for (u32 slot = 0; slot < 4; slot++) {                                  \
+            out->child[slot] = in->child[slot];                                 \
+            if (in->count[slot] > 0xffff) {                                     \
+                failwithf("A leaf of %u spheres is too large to compress.\n",   \
+                    in->count[slot]);                                           \
+            }                                                                   \
+            out->count[slot] = in->count[slot];                                 \
+            if (in->child[slot] == WBVH_EMPTY) {                                \
+                continue;                                                       \
+            }                                                                   \
+            out->used |= 1 << slot;                                             \
+            AABB child = {                                                      \
+                vec3(in->bounds[0][slot], in->bounds[1][slot],                  \
+                    in->bounds[2][slot]),                                       \
+                vec3(in->bounds[3][slot], in->bounds[4][slot],                  \
+                    in->bounds[5][slot])};                                      \
+            parent = aabb_union(parent, child);                                 \
+        }                                                                       \
+        for (u8 axis = 0; axis < 3; axis++) {                                   \
+            f32 lo = vaxis(parent.min, axis);                                   \
+            f32 extent = vaxis(parent.max, axis) - lo;                          \
+            out->origin[axis] = out->used != 0 ? lo : 0.0f;                     \
+            out->exponent[axis] = cbvh_exponent(extent, levels);                \
+            for (u32 slot = 0; slot < 4; slot++) {                              \
+                u32 q_min = 0;                                                  \
+                u32 q_max = 0;                                                  \
+                if (out->used & (1 << slot)) {                                  \
+                    cbvh_quantize(in->bounds[axis][slot],                       \
+                        in->bounds[axis + 3][slot], out->origin[axis],          \
+                        out->exponent[axis], levels, &q_min, &q_max);           \
+                }                                                               \
+                out->bounds[axis][slot] = (Q)q_min;                             \
+                out->bounds[axis + 3][slot] = (Q)q_max;                         \
+            }                                                                   \
+        }                                                                       \
+    }                                                                           \
+                                                                                \
+    static void cbvh##B##_decode(CBVH##B##Node *node, f32 bounds[6][4]) {       \
+        for (u32 row = 0; row < 6; row++) {                                     \
+            CBVH_DECODE_ROW_##B(bounds[row], node->bounds[row],                 \
+                node->origin[row % 3], cbvh_step(node->exponent[row % 3]));     \
+        }                                                                       \
+    }                                                                           \
+                                                                                \
+    CBVH##B *new_cbvh##B(WBVH4 *wbvh) {                                         \
+        CBVH##B *cbvh = malloc(sizeof(CBVH##B));                                \
+        cbvh->node_count = wbvh->node_count;                                    \
+        cbvh->leaf_count = wbvh->leaf_count;                                    \
+        cbvh->depth = wbvh->depth;                                              \
+        cbvh->spheres = wbvh->spheres;                                          \
+        cbvh->store = wbvh->store;                                              \
+        cbvh->sphere_count = wbvh->sphere_count;                                \
+        cbvh->nodes = aligned_malloc(                                           \
+            _Alignof(CBVH##B##Node), sizeof(CBVH##B##Node) * cbvh->node_count); \
+        for (u32 i = 0; i < cbvh->node_count; i++) {                            \
+            cbvh##B##_encode(&cbvh->nodes[i], &wbvh->nodes[i]);                 \
+        }                                                                       \
+        aligned_free(wbvh->nodes);                                              \
+        free(wbvh);                                                             \
+        return cbvh;                                                            \
+    }                                                                           \
+                                                                                \
+    u32 cbvh##B##_closest(CBVH##B *cbvh, Ray *ray, f32 *t) {                    \
+        u32 closest = SPHERE_STORE_MISS;                                        \
+        f32 closest_dist = FLT_MAX;                                             \
+        Vec3 inv_dir = safe_inverse(ray->direction);                            \
+        u32 stack[CBVH_STACK_SIZE];                                             \
+        f32 stack_t[CBVH_STACK_SIZE];                                           \
+        u32 sp = 0;                                                             \
+        stack[sp] = 0;                                                          \
+        stack_t[sp++] = 0.0f;                                                   \
+        while (sp > 0) {                                                        \
+            sp--;                                                               \
+            if (stack_t[sp] > closest_dist) {                                   \
+                continue;                                                       \
+            }                                                                   \
+            CBVH##B##Node *node = &cbvh->nodes[stack[sp]];                      \
+            f32 bounds[6][4];                                                   \
+            cbvh##B##_decode(node, bounds);                                     \
+            f32 t_near[4];                                                      \
+            u32 mask = slabs4(&bounds[0][0], 4, ray->origin, inv_dir,           \
+                           closest_dist, t_near) &                              \
+                       node->used;                                              \
+            u32 inner[4];                                                       \
+            f32 inner_t[4];                                                     \
+            u32 inner_count = 0;                                                \
+            while (mask != 0) {                                                 \
+                u32 slot = __builtin_ctz(mask);                                 \
+                mask &= mask - 1;                                               \
+                if (node->count[slot] == 0) {                                   \
+                    u32 j = inner_count++;                                      \
+                    while (j > 0 && inner_t[j - 1] < t_near[slot]) {            \
+                        inner[j] = inner[j - 1];                                \
+                        inner_t[j] = inner_t[j - 1];                            \
+                        j--;                                                    \
+                    }                                                           \
+                    inner[j] = node->child[slot];                               \
+                    inner_t[j] = t_near[slot];                                  \
+                    continue;                                                   \
+                }                                                               \
+                u32 hit = sphere_intersect_n(cbvh->store, node->child[slot],    \
+                    node->count[slot], ray, &closest_dist);                     \
+                if (hit != SPHERE_STORE_MISS) {                                 \
+                    closest = hit;                                              \
+                }                                                               \
+            }                                                                   \
+            for (u32 i = 0; i < inner_count; i++) {                             \
+                if (inner_t[i] <= closest_dist) {                               \
+                    stack[sp] = inner[i];                                       \
+                    stack_t[sp++] = inner_t[i];                                 \
+                }                                                               \
+            }                                                                   \
+        }                                                                       \
+        *t = closest_dist;                                                      \
+        return closest;                                                         \
+    }                                                                           \
+                                                                                \
+    HitOption cbvh##B##_intersect(CBVH##B *cbvh, Ray *ray) {                    \
+        f32 t;                                                                  \
+        u32 closest = cbvh##B##_closest(cbvh, ray, &t);                         \
+        if (closest == SPHERE_STORE_MISS) {                                     \
+            return no_Hit();                                                    \
+        }                                                                       \
+        return sphere_intersect(cbvh->spheres[closest], ray);                   \
+    }                                                                           \
+                                                                                \
+    bool cbvh##B##_occluded(                                                    \
+        CBVH##B *cbvh, Ray *ray, f32 t_max, u32 *occluder) {                    \
+        Vec3 inv_dir = safe_inverse(ray->direction);                            \
+        u32 stack[CBVH_STACK_SIZE];                                             \
+        u32 sp = 0;                                                             \
+        stack[sp++] = 0;                                                        \
+        while (sp > 0) {                                                        \
+            CBVH##B##Node *node = &cbvh->nodes[stack[--sp]];                    \
+            f32 bounds[6][4];                                                   \
+            cbvh##B##_decode(node, bounds);                                     \
+            f32 t_near[4];                                                      \
+            u32 mask = slabs4(&bounds[0][0], 4, ray->origin, inv_dir, t_max,    \
+                           t_near) &                                            \
+                       node->used;                                              \
+            while (mask != 0) {                                                 \
+                u32 slot = __builtin_ctz(mask);                                 \
+                mask &= mask - 1;                                               \
+                if (node->count[slot] == 0) {                                   \
+                    stack[sp++] = node->child[slot];                            \
+                    continue;                                                   \
+                }                                                               \
+                f32 t = t_max;                                                  \
+                u32 hit = sphere_intersect_n(cbvh->store, node->child[slot],    \
+                    node->count[slot], ray, &t);                                \
+                if (hit != SPHERE_STORE_MISS) {                                 \
+                    *occluder = hit;                                            \
+                    return true;                                                \
+                }                                                               \
+            }                                                                   \
+        }                                                                       \
+        return false;                                                           \
+    }                                                                           \
+                                                                                \
+    void destroy_cbvh##B(CBVH##B *cbvh) {                                       \
+        aligned_free(cbvh->nodes);                                              \
+        destroy_sphere_store(cbvh->store);                                      \
+        free(cbvh->spheres);                                                    \
+        free(cbvh);                                                             \
+    }                                                                           \
+                                                                                \
+    void cbvh##B##_debug_print(CBVH##B *cbvh) {                                 \
+        printf("CBVH%u: %u nodes of %zu bytes (%.2f MiB), %u leaves, "          \
+               "depth %u, %u spheres\n",                                        \
+            B, cbvh->node_count, sizeof(CBVH##B##Node),                         \
+            cbvh->node_count * sizeof(CBVH##B##Node) / (1024.0 * 1024.0),       \
+            cbvh->leaf_count, cbvh->depth, cbvh->sphere_count);                 \
+    }
+
+define_CBVH(8, u8)
+define_CBVH(16, u16)
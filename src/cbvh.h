@@ -0,0 +1,77 @@
+#ifndef CBVH_H
+#define CBVH_H
+/**
+ * @file cbvh.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief Compressed four-wide bounding volume hierarchies, whose child boxes
+ * are quantized to 8 or 16 bits relative to their parent box.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#include "defs.h"
+#include "hit.h"
+#include "ray.h"
+#include "sphere.h"
+#include "sphere_store.h"
+#include "wbvh.h"
+
+/**
+ * @brief Define a compressed hierarchy with child bounds stored in B bits of
+ * type Q, and nodes aligned to ALIGN bytes.
+ *
+ * Each node stores the corner of the box around its children, and per axis a
+ * power-of-two step as an exponent. A child bound is then corner + q * step,
+ * rounded outwards when it is encoded so the decoded box always holds the
+ * child. Children are laid out as in WBVH4, with used marking the occupied
+ * slots.
+ *
+ * This defines:
+ * CBVH##B##Node, CBVH##B, new_cbvh##B, cbvh##B##_closest (which, like
+ * bvh_closest, returns a sphere index), cbvh##B##_intersect,
+ * cbvh##B##_occluded, destroy_cbvh##B and cbvh##B##_debug_print.
+ */
+#define define_CBVH_header(B, Q, ALIGN)                                         \
+    typedef struct __attribute__((aligned(ALIGN))) _CBVH##B##Node {             \
+        f32 origin[3];                                                          \
+        u32 child[4];                                                           \
+        u16 count[4];                                                           \
+        Q bounds[6][4];                                                         \
+        i8 exponent[3];                                                         \
+        u8 used;                                                                \
+    } CBVH##B##Node;                                                            \
+                                                                                \
+    typedef struct _CBVH##B {                                                   \
+        CBVH##B##Node *nodes;                                                   \
+        u32 node_count;                                                         \
+        u32 leaf_count;                                                         \
+        u32 depth;                                                              \
+        Sphere **spheres;                                                       \
+        SphereStore *store;                                                     \
+        u32 sphere_count;                                                       \
+    } CBVH##B;                                                                  \
+                                                                                \
+    CBVH##B *new_cbvh##B(WBVH4 *wbvh);                                          \
+    u32 cbvh##B##_closest(CBVH##B *cbvh, Ray *ray, f32 *t);                     \
+    HitOption cbvh##B##_intersect(CBVH##B *cbvh, Ray *ray);                     \
+    bool cbvh##B##_occluded(                                                    \
+        CBVH##B *cbvh, Ray *ray, f32 t_max, u32 *occluder);                     \
+    void destroy_cbvh##B(CBVH##B *cbvh);                                        \
+    void cbvh##B##_debug_print(CBVH##B *cbvh);
+
+/**
+ * @brief CBVH8 and friends, with 64 byte nodes. new_cbvh8 takes over the
+ * spheres of the WBVH4 and destroys the rest of it.
+ */
+define_CBVH_header(8, u8, 64)
+
+/**
+ * @brief CBVH16 and friends, with 96 byte nodes, like CBVH8.
+ */
+define_CBVH_header(16, u16, 32)
+
+#endif
@@ -0,0 +1,46 @@
+#include "disc.h"
+#include <math.h>
+
+Disc *new_disc(Vec3 center, Vec3 normal, f32 radius, Color color) {
+    Disc *disc = malloc(sizeof(Disc));
+    disc->center = center;
+    disc->normal = norm(normal);
+    disc->radius = radius;
+    disc->color = color;
+    return disc;
+}
+
+HitOption disc_intersect(Disc *disc, Ray *ray) {
+    f32 d = dot(disc->normal, ray->direction);
+    if (fabsf(d) < eps) {
+        return no_Hit();
+    }
+    f32 t = dot(vsub(disc->center, ray->origin), disc->normal) / d;
+    if (t < 0.0f) {
+        return no_Hit();
+    }
+    Vec3 hit_position = vadd(ray->origin, smul(ray->direction, t));
+    Vec3 offset = vsub(hit_position, disc->center);
+    if (dot(offset, offset) > disc->radius * disc->radius) {
+        return no_Hit();
+    }
+    return some_Hit((Hit){
+        .color = disc->color,
+        .distance = t,
+        .position = hit_position,
+        .norm = d > 0.0f ? smul(disc->normal, -1.0f) : disc->normal,
+    });
+}
+
+AABB disc_bounds(Disc *disc) {
+    // A disc reaches r * sin of the angle between its normal and an axis
+    // along that axis. The eps keeps the box from being perfectly flat.
+    Vec3 n = disc->normal;
+    Vec3 extent = vec3(disc->radius * sqrtf(maxf(1.0f - n.x * n.x, 0.0f)) + eps,
+        disc->radius * sqrtf(maxf(1.0f - n.y * n.y, 0.0f)) + eps,
+        disc->radius * sqrtf(maxf(1.0f - n.z * n.z, 0.0f)) + eps);
+    return (AABB){
+        .min = vsub(disc->center, extent),
+        .max = vadd(disc->center, extent),
+    };
+}
@@ -0,0 +1,38 @@
+#ifndef DISC_H
+#define DISC_H
+/**
+ * @file disc.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief A module for flat, round discs.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#include "aabb.h"
+#include "color.h"
+#include "hit.h"
+#include "ray.h"
+#include "vec3.h"
+
+typedef struct _Disc {
+    Vec3 center;
+    Vec3 normal;
+    f32 radius;
+    Color color;
+} Disc;
+
+Disc *new_disc(Vec3 center, Vec3 normal, f32 radius, Color color);
+
+/**
+ * @brief Compute the intersect between a disc and a ray. Discs are two-sided,
+ * the normal of a hit faces the ray.
+ */
+HitOption disc_intersect(Disc *disc, Ray *ray);
+
+AABB disc_bounds(Disc *disc);
+
+#endif
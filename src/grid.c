@@ -0,0 +1,331 @@
+#include "grid.h"
+#include "fail.h"
+#include "parallel.h"
+#include <float.h>
+#include <math.h>
+
+// Spheres tested recently, so that spheres spanning several cells are only
+// tested once per ray in the common case.
+#define GRID_MAILBOX_SIZE 8
+
+typedef struct _GridMailbox {
+    Sphere *tested[GRID_MAILBOX_SIZE];
+    u32 next;
+} GridMailbox;
+
+static u32 grid_cell_coord(GridLevel *level, f32 p, u8 axis) {
+    f32 c = (p - vaxis(level->bounds.min, axis)) *
+            vaxis(level->inv_cell_size, axis);
+    if (c < 0.0f) {
+        return 0;
+    }
+    if (c >= (f32)level->res[axis]) {
+        return level->res[axis] - 1;
+    }
+    return (u32)c;
+}
+
+static u32 grid_cell_index(GridLevel *level, u32 x, u32 y, u32 z) {
+    return (z * level->res[1] + y) * level->res[0] + x;
+}
+
+static u32 grid_level_cell_count(GridLevel *level) {
+    return level->res[0] * level->res[1] * level->res[2];
+}
+
+/**
+ * @brief Find the range of cells that a sphere's bounding box overlaps.
+ */
+static void grid_cell_range(
+    GridLevel *level, Sphere *sphere, u32 lo[3], u32 hi[3]) {
+    AABB b = sphere_bounds(sphere);
+    for (u8 axis = 0; axis < 3; axis++) {
+        lo[axis] = grid_cell_coord(level, vaxis(b.min, axis), axis);
+        hi[axis] = grid_cell_coord(level, vaxis(b.max, axis), axis);
+    }
+}
+
+static void grid_level_build(
+    GridLevel *level, Sphere **spheres, u32 count, AABB bounds) {
+    // Pad a little so that flat sets of spheres still have volume.
+    Vec3 pad = vec3(eps * 10, eps * 10, eps * 10);
+    bounds.min = vsub(bounds.min, pad);
+    bounds.max = vadd(bounds.max, pad);
+    Vec3 extent = vsub(bounds.max, bounds.min);
+    f32 volume = extent.x * extent.y * extent.z;
+    f32 cells_per_unit =
+        cbrtf(GRID_DENSITY * (count > 0 ? count : 1) / volume);
+    level->bounds = bounds;
+    level->children = NULL;
+    for (u8 axis = 0; axis < 3; axis++) {
+        f32 res = ceilf(vaxis(extent, axis) * cells_per_unit);
+        level->res[axis] = res < 1.0f            ? 1
+                           : res > GRID_MAX_RES ? GRID_MAX_RES
+                                                : (u32)res;
+    }
+    level->cell_size = vec3(extent.x / level->res[0],
+        extent.y / level->res[1], extent.z / level->res[2]);
+    level->inv_cell_size = vec3(1.0f / level->cell_size.x,
+        1.0f / level->cell_size.y, 1.0f / level->cell_size.z);
+
+    u32 cell_count = grid_level_cell_count(level);
+    level->cell_start = calloc(cell_count + 1, sizeof(u32));
+    if (level->cell_start == NULL) {
+        failwithf("new_grid: could not allocate %u cells!\n", cell_count);
+    }
+
+    // First count the references per cell, then lay them out back to back.
+    u32 lo[3], hi[3];
+    for (u32 i = 0; i < count; i++) {
+        grid_cell_range(level, spheres[i], lo, hi);
+        for (u32 z = lo[2]; z <= hi[2]; z++) {
+            for (u32 y = lo[1]; y <= hi[1]; y++) {
+                for (u32 x = lo[0]; x <= hi[0]; x++) {
+                    level->cell_start[grid_cell_index(level, x, y, z) + 1]++;
+                }
+            }
+        }
+    }
+    for (u32 i = 0; i < cell_count; i++) {
+        level->cell_start[i + 1] += level->cell_start[i];
+    }
+    u32 references = level->cell_start[cell_count];
+    level->items = malloc(sizeof(Sphere *) * (references > 0 ? references : 1));
+    u32 *fill = malloc(sizeof(u32) * cell_count);
+    if (level->items == NULL || fill == NULL) {
+        failwithf(
+            "new_grid: could not allocate %u cell references!\n", references);
+    }
+    memcpy(fill, level->cell_start, sizeof(u32) * cell_count);
+    for (u32 i = 0; i < count; i++) {
+        grid_cell_range(level, spheres[i], lo, hi);
+        for (u32 z = lo[2]; z <= hi[2]; z++) {
+            for (u32 y = lo[1]; y <= hi[1]; y++) {
+                for (u32 x = lo[0]; x <= hi[0]; x++) {
+                    u32 cell = grid_cell_index(level, x, y, z);
+                    level->items[fill[cell]++] = spheres[i];
+                }
+            }
+        }
+    }
+    free(fill);
+}
+
+static void grid_level_free(GridLevel *level) {
+    free(level->cell_start);
+    free(level->items);
+    free(level->children);
+}
+
+typedef struct _GridSubgridTasks {
+    Grid *grid;
+    u32 *cells;
+} GridSubgridTasks;
+
+static void grid_subgrid_task(u32 begin, u32 end, void *ctx) {
+    GridSubgridTasks *tasks = (GridSubgridTasks *)ctx;
+    GridLevel *top = &tasks->grid->top;
+    for (u32 i = begin; i < end; i++) {
+        u32 cell = tasks->cells[i];
+        u32 x = cell % top->res[0];
+        u32 y = (cell / top->res[0]) % top->res[1];
+        u32 z = cell / (top->res[0] * top->res[1]);
+        Vec3 cell_min =
+            vadd(top->bounds.min, vmul(vec3(x, y, z), top->cell_size));
+        AABB cell_bounds = {
+            .min = cell_min,
+            .max = vadd(cell_min, top->cell_size),
+        };
+        u32 first = top->cell_start[cell];
+        u32 n = top->cell_start[cell + 1] - first;
+        grid_level_build(&tasks->grid->subgrids[i], top->items + first, n,
+            cell_bounds);
+    }
+}
+
+static void grid_build_subgrids(Grid *grid, u32 threads) {
+    GridLevel *top = &grid->top;
+    u32 cell_count = grid_level_cell_count(top);
+    top->children = malloc(sizeof(i32) * cell_count);
+    if (top->children == NULL) {
+        failwith("new_grid: could not allocate subgrid table!\n");
+    }
+    u32 dense = 0;
+    for (u32 i = 0; i < cell_count; i++) {
+        u32 n = top->cell_start[i + 1] - top->cell_start[i];
+        top->children[i] = n > GRID_DENSE_CELL ? (i32)dense++ : -1;
+    }
+    grid->subgrids = malloc(sizeof(GridLevel) * (dense > 0 ? dense : 1));
+    u32 *cells = malloc(sizeof(u32) * (dense > 0 ? dense : 1));
+    if (grid->subgrids == NULL || cells == NULL) {
+        failwith("new_grid: could not allocate subgrids!\n");
+    }
+    grid->subgrid_count = dense;
+    for (u32 i = 0; i < cell_count; i++) {
+        if (top->children[i] >= 0) {
+            cells[top->children[i]] = i;
+        }
+    }
+    // Subgrids only read the top level, so each one can be built on its own.
+    GridSubgridTasks tasks = {.grid = grid, .cells = cells};
+    parallel_for(threads, dense, 16, grid_subgrid_task, &tasks);
+    for (u32 i = 0; i < dense; i++) {
+        GridLevel *sub = &grid->subgrids[i];
+        grid->references += sub->cell_start[grid_level_cell_count(sub)];
+    }
+    free(cells);
+}
+
+Grid *new_grid(Sphere **spheres, u32 count, bool two_level, u32 threads) {
+    Grid *grid = malloc(sizeof(Grid));
+    if (grid == NULL) {
+        failwith("new_grid: could not allocate memory!\n");
+    }
+    AABB bounds = aabb_empty();
+    for (u32 i = 0; i < count; i++) {
+        bounds = aabb_union(bounds, sphere_bounds(spheres[i]));
+    }
+    if (count == 0) {
+        bounds = (AABB){.min = vec3(0, 0, 0), .max = vec3(0, 0, 0)};
+    }
+    grid->sphere_count = count;
+    grid->subgrids = NULL;
+    grid->subgrid_count = 0;
+    grid_level_build(&grid->top, spheres, count, bounds);
+    grid->references = grid->top.cell_start[grid_level_cell_count(&grid->top)];
+    if (two_level) {
+        grid_build_subgrids(grid, threads);
+    }
+    return grid;
+}
+
+/**
+ * @brief Walk the cells of a level from t_enter to t_leave with 3D-DDA,
+ * descending into subgrids where there are any.
+ */
+static void grid_level_intersect(Grid *grid, GridLevel *level, Ray *ray,
+    Vec3 inv_dir, f32 t_enter, f32 t_leave, Sphere **closest,
+    f32 *closest_dist, GridMailbox *mailbox) {
+    Vec3 entry = vadd(ray->origin, smul(ray->direction, t_enter));
+    i32 cell[3];
+    i32 step[3];
+    f32 t_next[3];
+    f32 t_delta[3];
+    for (u8 axis = 0; axis < 3; axis++) {
+        f32 d = vaxis(ray->direction, axis);
+        f32 inv = vaxis(inv_dir, axis);
+        f32 cs = vaxis(level->cell_size, axis);
+        cell[axis] = grid_cell_coord(level, vaxis(entry, axis), axis);
+        f32 lo = vaxis(level->bounds.min, axis) + cell[axis] * cs;
+        if (d > 0.0f) {
+            step[axis] = 1;
+            t_next[axis] = (lo + cs - vaxis(ray->origin, axis)) * inv;
+            t_delta[axis] = cs * inv;
+        } else if (d < 0.0f) {
+            step[axis] = -1;
+            t_next[axis] = (lo - vaxis(ray->origin, axis)) * inv;
+            t_delta[axis] = -cs * inv;
+        } else {
+            step[axis] = 0;
+            t_next[axis] = FLT_MAX;
+            t_delta[axis] = FLT_MAX;
+        }
+    }
+
+    f32 t_cell = t_enter;
+    while (true) {
+        u8 axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2)
+                                        : (t_next[1] < t_next[2] ? 1 : 2);
+        f32 t_exit = minf(t_next[axis], t_leave);
+        u32 c = grid_cell_index(level, cell[0], cell[1], cell[2]);
+        if (level->children != NULL && level->children[c] >= 0) {
+            grid_level_intersect(grid, &grid->subgrids[level->children[c]],
+                ray, inv_dir, t_cell, t_exit, closest, closest_dist, mailbox);
+        } else {
+            for (u32 i = level->cell_start[c]; i < level->cell_start[c + 1];
+                 i++) {
+                Sphere *s = level->items[i];
+                bool tested = false;
+                for (u32 m = 0; m < GRID_MAILBOX_SIZE; m++) {
+                    if (mailbox->tested[m] == s) {
+                        tested = true;
+                        break;
+                    }
+                }
+                if (tested) {
+                    continue;
+                }
+                mailbox->tested[mailbox->next++ % GRID_MAILBOX_SIZE] = s;
+                f32 t = sphere_distance(s, ray);
+                if (t <= *closest_dist) {
+                    *closest_dist = t;
+                    *closest = s;
+                }
+            }
+        }
+        // Anything first hit in a later cell would be further away.
+        if (*closest_dist <= t_exit || t_next[axis] >= t_leave) {
+            return;
+        }
+        cell[axis] += step[axis];
+        if (cell[axis] < 0 || cell[axis] >= (i32)level->res[axis]) {
+            return;
+        }
+        t_cell = t_next[axis];
+        t_next[axis] += t_delta[axis];
+    }
+}
+
+// Walk the grid from where the ray enters it up to t_max.
+static Sphere *grid_walk(Grid *grid, Ray *ray, f32 t_max, f32 *t) {
+    Sphere *closest = NULL;
+    *t = t_max;
+    if (grid->sphere_count == 0) {
+        return closest;
+    }
+    Vec3 inv_dir = safe_inverse(ray->direction);
+    f32 t_enter = 0.0f;
+    f32 t_leave = t_max;
+    if (!aabb_clip(
+            &grid->top.bounds, ray->origin, inv_dir, &t_enter, &t_leave)) {
+        return closest;
+    }
+    GridMailbox mailbox = {.next = 0};
+    memset(mailbox.tested, 0, sizeof(mailbox.tested));
+    grid_level_intersect(grid, &grid->top, ray, inv_dir, t_enter, t_leave,
+        &closest, t, &mailbox);
+    return closest;
+}
+
+Sphere *grid_closest(Grid *grid, Ray *ray, f32 *t) {
+    return grid_walk(grid, ray, FLT_MAX, t);
+}
+
+HitOption grid_intersect(Grid *grid, Ray *ray) {
+    f32 t;
+    Sphere *closest = grid_closest(grid, ray, &t);
+    return closest == NULL ? no_Hit() : sphere_intersect(closest, ray);
+}
+
+bool grid_occluded(Grid *grid, Ray *ray, f32 t_max, Sphere **occluder) {
+    f32 t;
+    *occluder = grid_walk(grid, ray, t_max, &t);
+    return *occluder != NULL;
+}
+
+void destroy_grid(Grid *grid) {
+    grid_level_free(&grid->top);
+    for (u32 i = 0; i < grid->subgrid_count; i++) {
+        grid_level_free(&grid->subgrids[i]);
+    }
+    free(grid->subgrids);
+    free(grid);
+}
+
+void grid_debug_print(Grid *grid) {
+    printf("Grid: %u x %u x %u cells, %u subgrids, %llu references, %u "
+           "spheres\n",
+        grid->top.res[0], grid->top.res[1], grid->top.res[2],
+        grid->subgrid_count, (unsigned long long)grid->references,
+        grid->sphere_count);
+}
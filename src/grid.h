@@ -0,0 +1,91 @@
+#ifndef GRID_H
+#define GRID_H
+/**
+ * @file grid.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief A uniform grid over spheres, walked with 3D-DDA. Optionally, cells
+ * that end up crowded get a grid of their own.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#include "aabb.h"
+#include "defs.h"
+#include "hit.h"
+#include "ray.h"
+#include "sphere.h"
+
+// Roughly how many cells to make per sphere.
+#define GRID_DENSITY 2.0f
+#define GRID_MAX_RES 1024
+// Cells holding more spheres than this get a second level.
+#define GRID_DENSE_CELL 16
+
+typedef struct _GridLevel {
+    AABB bounds;
+    u32 res[3];
+    Vec3 cell_size;
+    Vec3 inv_cell_size;
+    /**
+     * @brief The spheres of cell i are items[cell_start[i]] up to
+     * items[cell_start[i + 1]].
+     */
+    u32 *cell_start;
+    Sphere **items;
+    /**
+     * @brief Index into the subgrids of each cell, -1 for cells without one.
+     * NULL on levels that have no subgrids.
+     */
+    i32 *children;
+} GridLevel;
+
+typedef struct _Grid {
+    GridLevel top;
+    GridLevel *subgrids;
+    u32 subgrid_count;
+    u32 sphere_count;
+    u64 references;
+} Grid;
+
+/**
+ * @brief Build a grid over the given spheres.
+ *
+ * @param spheres The spheres, which are not copied, only pointed to.
+ * @param count The number of spheres.
+ * @param two_level Whether crowded cells should get a grid of their own.
+ * @param threads How many threads may help build the second level.
+ * @return Grid* A new grid.
+ */
+Grid *new_grid(Sphere **spheres, u32 count, bool two_level, u32 threads);
+
+/**
+ * @brief Find the closest sphere hit by a ray, walking cells in ray order,
+ * without working out anything about the hit.
+ *
+ * @param t Set to the distance to the hit.
+ * @return Sphere* The sphere, or NULL if the ray hits none.
+ */
+Sphere *grid_closest(Grid *grid, Ray *ray, f32 *t);
+
+/**
+ * @brief Like grid_closest, with the hit worked out.
+ */
+HitOption grid_intersect(Grid *grid, Ray *ray);
+
+/**
+ * @brief Whether a ray hits any sphere nearer than t_max. The walk ends at
+ * t_max, and after the first cell holding a hit.
+ *
+ * @param occluder Set to the sphere found, or NULL.
+ */
+bool grid_occluded(Grid *grid, Ray *ray, f32 t_max, Sphere **occluder);
+
+void destroy_grid(Grid *grid);
+
+void grid_debug_print(Grid *grid);
+
+#endif
@@ -16,7 +16,7 @@
 #include "color.h"
 #include "option.h"
 
-typedef struct __attribute__((packed)) _Hit
+typedef struct _Hit
 {
     Color color;
     f32 distance;
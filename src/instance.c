@@ -0,0 +1,120 @@
+#include "instance.h"
+#include <math.h>
+#include <string.h>
+
+Group *new_group(const char *name) {
+    Group *group = malloc(sizeof(Group));
+    if (group == NULL) {
+        failwith("new_group: could not allocate memory!\n");
+    }
+    group->name = strdup(name);
+    group->spheres = new_SpherePtrList(8);
+    group->bvh = NULL;
+    group->bounds = aabb_empty();
+    return group;
+}
+
+void group_add_sphere(Group *group, Sphere *sphere) {
+    SpherePtrList_add(group->spheres, sphere);
+}
+
+void group_build(Group *group, u32 leaf_size, u32 threads) {
+    if (group->bvh != NULL) {
+        destroy_bvh(group->bvh);
+    }
+    group->bvh = new_bvh(group->spheres->elements, group->spheres->size,
+        leaf_size, threads);
+    group->bounds = group->spheres->size > 0 ? group->bvh->nodes[0].bounds
+                                             : aabb_empty();
+}
+
+void destroy_group(Group *group) {
+    if (group->bvh != NULL) {
+        destroy_bvh(group->bvh);
+    }
+    for (u32 i = 0; i < group->spheres->size; i++) {
+        free(group->spheres->elements[i]);
+    }
+    destroy_SpherePtrList(group->spheres);
+    free(group->name);
+    free(group);
+}
+
+Instance *new_instance(Group *group, Vec3 translation, f32 scale) {
+    if (!(scale > 0.0f)) {
+        failwithf("Instance of group '%s' has scale %f, it must be positive.\n",
+            group->name, scale);
+    }
+    Instance *instance = malloc(sizeof(Instance));
+    if (instance == NULL) {
+        failwith("new_instance: could not allocate memory!\n");
+    }
+    instance->group = group;
+    instance->translation = translation;
+    instance->scale = scale;
+    instance->inv_scale = 1.0f / scale;
+    return instance;
+}
+
+AABB instance_bounds(Instance *instance) {
+    AABB bounds = instance->group->bounds;
+    return (AABB){
+        .min = vadd(smul(bounds.min, instance->scale), instance->translation),
+        .max = vadd(smul(bounds.max, instance->scale), instance->translation),
+    };
+}
+
+Vec3 instance_position(Instance *instance) {
+    AABB bounds = instance_bounds(instance);
+    return aabb_centroid(bounds);
+}
+
+HitOption instance_intersect(Instance *instance, Ray *ray) {
+    if (instance->group->spheres->size == 0) {
+        return no_Hit();
+    }
+    // The scale is uniform, so the direction stays a unit vector and only
+    // distances need scaling on the way back.
+    Ray local = {
+        .origin = smul(
+            vsub(ray->origin, instance->translation), instance->inv_scale),
+        .direction = ray->direction,
+    };
+    HitOption hit_ = bvh_intersect(instance->group->bvh, &local);
+    if (is_some(hit_)) {
+        hit_.value.distance *= instance->scale;
+        hit_.value.position = vadd(
+            smul(hit_.value.position, instance->scale), instance->translation);
+    }
+    return hit_;
+}
+
+f32 instance_distance(Instance *instance, Ray *ray) {
+    if (instance->group->spheres->size == 0) {
+        return INFINITY;
+    }
+    Ray local = {
+        .origin = smul(
+            vsub(ray->origin, instance->translation), instance->inv_scale),
+        .direction = ray->direction,
+    };
+    f32 t;
+    if (bvh_closest(instance->group->bvh, &local, &t) == SPHERE_STORE_MISS) {
+        return INFINITY;
+    }
+    return t * instance->scale;
+}
+
+bool instance_occluded(Instance *instance, Ray *ray, f32 t_max) {
+    if (instance->group->spheres->size == 0) {
+        return false;
+    }
+    Ray local = {
+        .origin = smul(
+            vsub(ray->origin, instance->translation), instance->inv_scale),
+        .direction = ray->direction,
+    };
+    u32 occluder;
+    return bvh_occluded(instance->group->bvh, &local,
+        t_max * instance->inv_scale, &occluder);
+}
@@ -0,0 +1,95 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+/**
+ * @file instance.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief Named groups of spheres, and instances that place a group in the
+ * scene with a translation and a uniform scale. Every instance of a group
+ * shares the group's spheres and hierarchy.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#include "aabb.h"
+#include "bvh.h"
+#include "defs.h"
+#include "fail.h"
+#include "hit.h"
+#include "list.h"
+#include "ray.h"
+#include "sphere.h"
+#include "vec3.h"
+
+#ifndef SpherePtrList_T
+#define SpherePtrList_T
+
+typedef Sphere *SpherePtr;
+list_type(SpherePtr);
+
+#endif
+
+typedef struct _Group {
+    char *name;
+    SpherePtrList *spheres;
+    BVH *bvh;
+    AABB bounds;
+} Group;
+
+typedef struct _Instance {
+    Group *group;
+    Vec3 translation;
+    f32 scale;
+    f32 inv_scale;
+} Instance;
+
+Group *new_group(const char *name);
+
+void group_add_sphere(Group *group, Sphere *sphere);
+
+/**
+ * @brief (Re)build the hierarchy over the group's spheres, in the group's own
+ * coordinates. Instances of the group can only be cast against after this.
+ */
+void group_build(Group *group, u32 leaf_size, u32 threads);
+
+/**
+ * @brief Free the group, its spheres and its hierarchy.
+ */
+void destroy_group(Group *group);
+
+/**
+ * @brief Place a group in the scene.
+ *
+ * @param translation Where the group's origin ends up.
+ * @param scale A uniform scale, which must be positive.
+ */
+Instance *new_instance(Group *group, Vec3 translation, f32 scale);
+
+/**
+ * @brief The bounds of the instance in the scene. Its group must be built.
+ */
+AABB instance_bounds(Instance *instance);
+
+Vec3 instance_position(Instance *instance);
+
+/**
+ * @brief Cast a ray against the instance, by moving the ray into the group's
+ * coordinates and moving the hit back out.
+ */
+HitOption instance_intersect(Instance *instance, Ray *ray);
+
+/**
+ * @brief How far along a ray it hits the instance, or INFINITY if it misses.
+ */
+f32 instance_distance(Instance *instance, Ray *ray);
+
+/**
+ * @brief Whether a ray hits any sphere of the instance nearer than t_max.
+ */
+bool instance_occluded(Instance *instance, Ray *ray, f32 t_max);
+
+#endif
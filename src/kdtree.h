@@ -5,29 +5,305 @@
  * @author Jon Voigt Tøttrup (jvoi@itu.dk)
  *
  * @brief A macro for making KDTrees lmao
- * @version 0.1
+ * @version 0.2
  * @date 2023-09-06
  *
  * @copyright WingCorp (c) 2023
  *
  */
-#include "vec3.h"
+#include <float.h>
+#include <math.h>
+#include "aabb.h"
 #include "defs.h"
+#include "fail.h"
+#include "hit.h"
+#include "ray.h"
+#include "vec3.h"
 
-#define define_V3Tree(T, vec3Expr)         \
-    typedef struct _##T##V3Node T##V3Node; \
-                                           \
-    typedef struct _##T##V3Node {          \
-        u8 axis;                           \
-        Vec3 max;                          \
-        Vec3 min;                          \
-        T##V3Node *left;                   \
-        T##V3Node *right;                  \
-    } T##V3Node;                           \
-                                           \
-    typedef struct _##T##V3Tree {          \
-        T##V3Node *root;                   \
-        
-    } T##V3Tree;
+/**
+ * @brief A macro that defines a balanced kd-tree over T's.
+ * Every node holds one element, split at the median along the axis where the
+ * elements are spread out the most. Each node also keeps the bounds of
+ * everything below it, so queries can skip whole subtrees.
+ *
+ * @param T The element type.
+ * @param vec3Expr A macro or function that takes a T and returns its position.
+ * @param boundsExpr A macro or function that takes a T and returns its AABB.
+ */
+#define define_V3Tree(T, vec3Expr, boundsExpr)                                  \
+    typedef struct _##T##V3Node T##V3Node;                                      \
+                                                                                \
+    typedef struct _##T##V3Node {                                               \
+        u8 axis;                                                                \
+        Vec3 max;                                                               \
+        Vec3 min;                                                               \
+        T value;                                                                \
+        T##V3Node *left;                                                        \
+        T##V3Node *right;                                                       \
+    } T##V3Node;                                                                \
+                                                                                \
+    typedef struct _##T##V3Tree {                                               \
+        T##V3Node *root;                                                        \
+        T##V3Node *nodes;                                                       \
+        u32 size;                                                               \
+        u32 depth;                                                              \
+    } T##V3Tree;                                                                \
+                                                                                \
+    static void _##T##V3Tree_select(T *items, u32 lo, u32 hi, u32 k, u8 axis) { \
+        while (hi - lo > 1) {                                                   \
+            f32 pivot = vaxis(vec3Expr(items[(lo + hi) / 2]), axis);            \
+            u32 i = lo;                                                         \
+            u32 j = hi - 1;                                                     \
+            while (i <= j) {                                                    \
+                while (vaxis(vec3Expr(items[i]), axis) < pivot) {               \
+                    i++;                                                        \
+                }                                                               \
+                while (vaxis(vec3Expr(items[j]), axis) > pivot) {               \
+                    j--;                                                        \
+                }                                                               \
+                if (i <= j) {                                                   \
+                    T tmp = items[i];                                           \
+                    items[i] = items[j];                                        \
+                    items[j] = tmp;                                             \
+                    i++;                                                        \
+                    if (j == 0) {                                               \
+                        break;                                                  \
+                    }                                                           \
+                    j--;                                                        \
+                }                                                               \
+            }                                                                   \
+            if (k <= j) {                                                       \
+                hi = j + 1;                                                     \
+            } else if (k >= i) {                                                \
+                lo = i;                                                         \
+            } else {                                                            \
+                return;                                                         \
+            }                                                                   \
+        }                                                                       \
+    }                                                                           \
+                                                                                \
+    static T##V3Node *_##T##V3Tree_build(T##V3Tree *tree, T *items, u32 lo,     \
+        u32 hi, u32 depth) {                                                    \
+        if (lo >= hi) {                                                         \
+            return NULL;                                                        \
+        }                                                                       \
+        if (depth + 1 > tree->depth) {                                          \
+            tree->depth = depth + 1;                                            \
+        }                                                                       \
+        AABB spread = aabb_empty();                                             \
+        for (u32 i = lo; i < hi; i++) {                                         \
+            spread = aabb_grow(spread, vec3Expr(items[i]));                     \
+        }                                                                       \
+        Vec3 extent = vsub(spread.max, spread.min);                             \
+        u8 axis = extent.x >= extent.y && extent.x >= extent.z ? 0              \
+                  : extent.y >= extent.z                       ? 1              \
+                                                               : 2;             \
+        u32 mid = lo + (hi - lo) / 2;                                           \
+        _##T##V3Tree_select(items, lo, hi, mid, axis);                          \
+                                                                                \
+        T##V3Node *node = &tree->nodes[mid];                                    \
+        node->axis = axis;                                                      \
+        node->value = items[mid];                                               \
+        node->left = _##T##V3Tree_build(tree, items, lo, mid, depth + 1);       \
+        node->right = _##T##V3Tree_build(tree, items, mid + 1, hi, depth + 1);  \
+        AABB bounds = boundsExpr(items[mid]);                                   \
+        if (node->left != NULL) {                                               \
+            bounds = aabb_union(bounds,                                         \
+                (AABB){.min = node->left->min, .max = node->left->max});        \
+        }                                                                       \
+        if (node->right != NULL) {                                              \
+            bounds = aabb_union(bounds,                                         \
+                (AABB){.min = node->right->min, .max = node->right->max});      \
+        }                                                                       \
+        node->min = bounds.min;                                                 \
+        node->max = bounds.max;                                                 \
+        return node;                                                            \
+    }                                                                           \
+                                                                                \
+    T##V3Tree *new_##T##V3Tree(T *items, u32 count) {                           \
+        T##V3Tree *tree = malloc(sizeof(T##V3Tree));                            \
+        if (tree == NULL) {                                                     \
+            failwithf("%sV3Tree_new: could not allocate more memory!\n", #T);   \
+        }                                                                       \
+        tree->nodes = malloc(sizeof(T##V3Node) * (count > 0 ? count : 1));      \
+        T *scratch = malloc(sizeof(T) * (count > 0 ? count : 1));               \
+        if (tree->nodes == NULL || scratch == NULL) {                           \
+            failwithf("%sV3Tree_new: could not allocate memory for %u "         \
+                      "elements!\n",                                            \
+                #T, count);                                                     \
+        }                                                                       \
+        memcpy(scratch, items, sizeof(T) * count);                              \
+        tree->size = count;                                                     \
+        tree->depth = 0;                                                        \
+        tree->root = _##T##V3Tree_build(tree, scratch, 0, count, 0);            \
+        free(scratch);                                                          \
+        return tree;                                                            \
+    }                                                                           \
+                                                                                \
+    void destroy_##T##V3Tree(T##V3Tree *tree) {                                 \
+        free(tree->nodes);                                                      \
+        free(tree);                                                             \
+    }                                                                           \
+                                                                                \
+    static void _##T##V3Tree_nearest(T##V3Node *node, Vec3 point,               \
+        f32 *best_dist2, T##V3Node **best) {                                    \
+        if (node == NULL) {                                                     \
+            return;                                                             \
+        }                                                                       \
+        AABB bounds = {.min = node->min, .max = node->max};                     \
+        if (aabb_distance2(&bounds, point) >= *best_dist2) {                    \
+            return;                                                             \
+        }                                                                       \
+        Vec3 d = vsub(vec3Expr(node->value), point);                            \
+        f32 dist2 = dot(d, d);                                                  \
+        if (dist2 < *best_dist2) {                                              \
+            *best_dist2 = dist2;                                                \
+            *best = node;                                                       \
+        }                                                                       \
+        bool go_left = vaxis(point, node->axis) <                               \
+                       vaxis(vec3Expr(node->value), node->axis);                \
+        _##T##V3Tree_nearest(                                                   \
+            go_left ? node->left : node->right, point, best_dist2, best);       \
+        _##T##V3Tree_nearest(                                                   \
+            go_left ? node->right : node->left, point, best_dist2, best);       \
+    }                                                                           \
+                                                                                \
+    /**                                                                         \
+     * @brief Find the element closest to a point.                              \
+     * @return Whether the tree had any elements, out is only set if so.        \
+     */                                                                         \
+    bool T##V3Tree_nearest(T##V3Tree *tree, Vec3 point, T *out) {               \
+        f32 best_dist2 = FLT_MAX;                                               \
+        T##V3Node *best = NULL;                                                 \
+        _##T##V3Tree_nearest(tree->root, point, &best_dist2, &best);            \
+        if (best == NULL) {                                                     \
+            return false;                                                       \
+        }                                                                       \
+        *out = best->value;                                                     \
+        return true;                                                            \
+    }                                                                           \
+                                                                                \
+    static u32 _##T##V3Tree_radius(T##V3Node *node, Vec3 point, f32 radius2,    \
+        void (*visit)(T item, void *ctx), void *ctx) {                          \
+        if (node == NULL) {                                                     \
+            return 0;                                                           \
+        }                                                                       \
+        AABB bounds = {.min = node->min, .max = node->max};                     \
+        if (aabb_distance2(&bounds, point) > radius2) {                         \
+            return 0;                                                           \
+        }                                                                       \
+        u32 found = 0;                                                          \
+        Vec3 d = vsub(vec3Expr(node->value), point);                            \
+        if (dot(d, d) <= radius2) {                                             \
+            visit(node->value, ctx);                                            \
+            found++;                                                            \
+        }                                                                       \
+        found += _##T##V3Tree_radius(node->left, point, radius2, visit, ctx);   \
+        found += _##T##V3Tree_radius(node->right, point, radius2, visit, ctx);  \
+        return found;                                                           \
+    }                                                                           \
+                                                                                \
+    /**                                                                         \
+     * @brief Call visit for every element within radius of a point.            \
+     * @return The number of elements visited.                                  \
+     */                                                                         \
+    u32 T##V3Tree_radius(T##V3Tree *tree, Vec3 point, f32 radius,               \
+        void (*visit)(T item, void *ctx), void *ctx) {                          \
+        return _##T##V3Tree_radius(                                             \
+            tree->root, point, radius * radius, visit, ctx);                    \
+    }
+
+/**
+ * @brief A macro that defines ray casting through a V3Tree. Nodes are visited
+ * front-to-back, and the ray interval is clipped to every node's bounds on the
+ * way down, so subtrees behind the closest hit so far are never entered.
+ * Candidates are only asked for their distance; working out the hit is left
+ * to the caller, for the closest one alone.
+ *
+ * @param T The element type, which must already have a V3Tree.
+ * @param distanceFun A function that takes a T and a Ray* and returns how far
+ * along the ray it hits the element, or INFINITY if it misses.
+ */
+#define define_V3Tree_raycast(T, distanceFun)                                   \
+    static void _##T##V3Tree_closest(T##V3Node *node, Ray *ray, Vec3 inv_dir,   \
+        f32 t_min, f32 *t_max, T *closest, bool *found) {                       \
+        while (node != NULL) {                                                  \
+            AABB bounds = {.min = node->min, .max = node->max};                 \
+            f32 t0 = t_min;                                                     \
+            f32 t1 = *t_max;                                                    \
+            if (!aabb_clip(&bounds, ray->origin, inv_dir, &t0, &t1)) {          \
+                return;                                                         \
+            }                                                                   \
+            f32 t = distanceFun(node->value, ray);                              \
+            if (t <= *t_max) {                                                  \
+                *t_max = t;                                                     \
+                *closest = node->value;                                         \
+                *found = true;                                                  \
+            }                                                                   \
+            bool left_first = vaxis(ray->direction, node->axis) >= 0.0f;        \
+            T##V3Node *first = left_first ? node->left : node->right;           \
+            T##V3Node *second = left_first ? node->right : node->left;          \
+            _##T##V3Tree_closest(                                               \
+                first, ray, inv_dir, t0, t_max, closest, found);                \
+            node = second;                                                      \
+            t_min = t0;                                                         \
+        }                                                                       \
+    }                                                                           \
+                                                                                \
+    /**                                                                         \
+     * @brief Find the closest element hit by a ray nearer than *t_max.         \
+     * @return Whether there is one, in which case it is put in closest and     \
+     * its distance in *t_max.                                                  \
+     */                                                                         \
+    bool T##V3Tree_closest(                                                     \
+        T##V3Tree *tree, Ray *ray, f32 *t_max, T *closest) {                    \
+        bool found = false;                                                     \
+        Vec3 inv_dir = safe_inverse(ray->direction);                            \
+        _##T##V3Tree_closest(                                                   \
+            tree->root, ray, inv_dir, 0.0f, t_max, closest, &found);            \
+        return found;                                                           \
+    }
+
+/**
+ * @brief A macro that defines occlusion queries through a V3Tree, which stop
+ * at the first element hit nearer than t_max, in any order, and report it.
+ *
+ * @param T The element type, which must already have a V3Tree.
+ * @param occludedFun A function that takes a T, a Ray* and an f32 t_max and
+ * returns whether the ray hits the element nearer than t_max.
+ */
+#define define_V3Tree_occlusion(T, occludedFun)                                 \
+    static bool _##T##V3Tree_occluded(T##V3Node *node, Ray *ray,                \
+        Vec3 inv_dir, f32 t_max, T *occluder) {                                 \
+        while (node != NULL) {                                                  \
+            AABB bounds = {.min = node->min, .max = node->max};                 \
+            f32 t0 = 0.0f;                                                      \
+            f32 t1 = t_max;                                                     \
+            if (!aabb_clip(&bounds, ray->origin, inv_dir, &t0, &t1)) {          \
+                return false;                                                   \
+            }                                                                   \
+            if (occludedFun(node->value, ray, t_max)) {                         \
+                *occluder = node->value;                                        \
+                return true;                                                    \
+            }                                                                   \
+            if (_##T##V3Tree_occluded(                                          \
+                    node->left, ray, inv_dir, t_max, occluder)) {               \
+                return true;                                                    \
+            }                                                                   \
+            node = node->right;                                                 \
+        }                                                                       \
+        return false;                                                           \
+    }                                                                           \
+                                                                                \
+    /**                                                                         \
+     * @brief Whether a ray hits any element nearer than t_max, setting         \
+     * *occluder to the one found.                                              \
+     */                                                                         \
+    bool T##V3Tree_occluded(                                                    \
+        T##V3Tree *tree, Ray *ray, f32 t_max, T *occluder) {                    \
+        Vec3 inv_dir = safe_inverse(ray->direction);                            \
+        return _##T##V3Tree_occluded(                                           \
+            tree->root, ray, inv_dir, t_max, occluder);                         \
+    }
 
-#endif
\ No newline at end of file
+#endif
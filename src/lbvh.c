@@ -0,0 +1,321 @@
+#include "lbvh.h"
+#include "fail.h"
+#include "parallel.h"
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_CHUNK 65536
+#define LBVH_CHUNK 16384
+// Marks a child index as a sphere rather than an internal node.
+#define LBVH_LEAF 0x80000000u
+
+typedef struct _RadixSort {
+    u64 *keys_in;
+    u32 *values_in;
+    u64 *keys_out;
+    u32 *values_out;
+    u32 shift;
+    u32 (*histograms)[RADIX_BUCKETS];
+} RadixSort;
+
+static void radix_histogram(u32 begin, u32 end, void *ctx) {
+    RadixSort *rs = (RadixSort *)ctx;
+    u32 *histogram = rs->histograms[begin / RADIX_CHUNK];
+    memset(histogram, 0, sizeof(u32) * RADIX_BUCKETS);
+    for (u32 i = begin; i < end; i++) {
+        histogram[(rs->keys_in[i] >> rs->shift) & (RADIX_BUCKETS - 1)]++;
+    }
+}
+
+static void radix_scatter(u32 begin, u32 end, void *ctx) {
+    RadixSort *rs = (RadixSort *)ctx;
+    // The histogram has been turned into this chunk's offsets by now.
+    u32 *offsets = rs->histograms[begin / RADIX_CHUNK];
+    for (u32 i = begin; i < end; i++) {
+        u32 digit = (rs->keys_in[i] >> rs->shift) & (RADIX_BUCKETS - 1);
+        u32 to = offsets[digit]++;
+        rs->keys_out[to] = rs->keys_in[i];
+        rs->values_out[to] = rs->values_in[i];
+    }
+}
+
+void radix_sort_u64(u64 *keys, u32 *values, u32 count, u32 bits, u32 threads) {
+    u32 chunks = (count + RADIX_CHUNK - 1) / RADIX_CHUNK;
+    RadixSort rs = {
+        .keys_in = keys,
+        .values_in = values,
+        .keys_out = malloc(sizeof(u64) * (count > 0 ? count : 1)),
+        .values_out = malloc(sizeof(u32) * (count > 0 ? count : 1)),
+        .histograms = malloc(sizeof(u32[RADIX_BUCKETS]) * (chunks + 1)),
+    };
+    if (rs.keys_out == NULL || rs.values_out == NULL ||
+        rs.histograms == NULL) {
+        failwithf("radix_sort: could not allocate memory for %u keys!\n",
+            count);
+    }
+    for (rs.shift = 0; rs.shift < bits; rs.shift += RADIX_BITS) {
+        parallel_for(threads, count, RADIX_CHUNK, radix_histogram, &rs);
+        // Each chunk writes a digit after every smaller digit, and after the
+        // same digit from earlier chunks, which keeps the sort stable.
+        u32 offset = 0;
+        for (u32 digit = 0; digit < RADIX_BUCKETS; digit++) {
+            for (u32 c = 0; c < chunks; c++) {
+                u32 n = rs.histograms[c][digit];
+                rs.histograms[c][digit] = offset;
+                offset += n;
+            }
+        }
+        parallel_for(threads, count, RADIX_CHUNK, radix_scatter, &rs);
+        u64 *keys_tmp = rs.keys_in;
+        u32 *values_tmp = rs.values_in;
+        rs.keys_in = rs.keys_out;
+        rs.values_in = rs.values_out;
+        rs.keys_out = keys_tmp;
+        rs.values_out = values_tmp;
+    }
+    // After an odd number of passes the result is in the scratch buffers.
+    if (rs.keys_in != keys) {
+        memcpy(keys, rs.keys_in, sizeof(u64) * count);
+        memcpy(values, rs.values_in, sizeof(u32) * count);
+        free(rs.keys_in);
+        free(rs.values_in);
+    } else {
+        free(rs.keys_out);
+        free(rs.values_out);
+    }
+    free(rs.histograms);
+}
+
+u64 morton_spread(u64 v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8) & 0x100f00f00f00f00full;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
+
+typedef struct _LBVHBuilder {
+    Sphere **spheres;
+    u32 count;
+    u32 leaf_size;
+    u32 threads;
+    u32 morton_bits;
+    AABB centroid_bounds;
+    u64 *keys;
+    u32 *order;
+    // Internal node i covers sorted spheres [first[i], last[i]].
+    u32 *first;
+    u32 *last;
+    u32 *left;
+    u32 *right;
+    BVH *bvh;
+} LBVHBuilder;
+
+static void lbvh_morton_codes(u32 begin, u32 end, void *ctx) {
+    LBVHBuilder *lb = (LBVHBuilder *)ctx;
+    u32 bits_per_axis = lb->morton_bits / 3;
+    f32 cells = (f32)((1u << bits_per_axis) - 1);
+    Vec3 lo = lb->centroid_bounds.min;
+    Vec3 extent = vsub(lb->centroid_bounds.max, lo);
+    Vec3 scale = vec3(extent.x > eps ? cells / extent.x : 0.0f,
+        extent.y > eps ? cells / extent.y : 0.0f,
+        extent.z > eps ? cells / extent.z : 0.0f);
+    for (u32 i = begin; i < end; i++) {
+        Vec3 q = vmul(vsub(lb->spheres[i]->center, lo), scale);
+        lb->keys[i] = morton_spread((u64)q.x) << 2 |
+                      morton_spread((u64)q.y) << 1 | morton_spread((u64)q.z);
+        lb->order[i] = i;
+    }
+}
+
+/**
+ * @brief The length of the common prefix of the keys at i and j, with ties
+ * between equal keys broken by their indices. -1 if j is out of range.
+ */
+static i32 lbvh_delta(LBVHBuilder *lb, u32 i, i64 j) {
+    if (j < 0 || j >= lb->count) {
+        return -1;
+    }
+    u64 a = lb->keys[i];
+    u64 b = lb->keys[j];
+    if (a == b) {
+        return 64 + __builtin_clz(i ^ (u32)j);
+    }
+    return __builtin_clzll(a ^ b);
+}
+
+/**
+ * @brief Find the range and split of internal nodes independently of each
+ * other, as in Karras' "Maximizing Parallelism in the Construction of BVHs,
+ * Octrees, and k-d Trees".
+ */
+static void lbvh_internal_nodes(u32 begin, u32 end, void *ctx) {
+    LBVHBuilder *lb = (LBVHBuilder *)ctx;
+    for (u32 i = begin; i < end; i++) {
+        // Grow towards the neighbour that shares the longer prefix.
+        i32 d = lbvh_delta(lb, i, (i64)i + 1) > lbvh_delta(lb, i, (i64)i - 1)
+                    ? 1
+                    : -1;
+        i32 delta_min = lbvh_delta(lb, i, (i64)i - d);
+        i64 l_max = 2;
+        while (lbvh_delta(lb, i, (i64)i + l_max * d) > delta_min) {
+            l_max *= 2;
+        }
+        i64 l = 0;
+        for (i64 t = l_max / 2; t >= 1; t /= 2) {
+            if (lbvh_delta(lb, i, (i64)i + (l + t) * d) > delta_min) {
+                l += t;
+            }
+        }
+        i64 j = (i64)i + l * d;
+        i32 delta_node = lbvh_delta(lb, i, j);
+        i64 s = 0;
+        i64 t = l;
+        do {
+            t = (t + 1) / 2;
+            if (lbvh_delta(lb, i, (i64)i + (s + t) * d) > delta_node) {
+                s += t;
+            }
+        } while (t > 1);
+        u32 split = (u32)((i64)i + s * d + (d < 0 ? -1 : 0));
+        u32 lo = d > 0 ? i : (u32)j;
+        u32 hi = d > 0 ? (u32)j : i;
+        lb->first[i] = lo;
+        lb->last[i] = hi;
+        lb->left[i] = lo == split ? split | LBVH_LEAF : split;
+        lb->right[i] = hi == split + 1 ? (split + 1) | LBVH_LEAF : split + 1;
+    }
+}
+
+static void lbvh_child_range(LBVHBuilder *lb, u32 child, u32 *lo, u32 *hi) {
+    if (child & LBVH_LEAF) {
+        *lo = *hi = child & ~LBVH_LEAF;
+    } else {
+        *lo = lb->first[child];
+        *hi = lb->last[child];
+    }
+}
+
+/**
+ * @brief Lay the internal nodes out depth-first as BVH nodes, turning every
+ * subtree small enough into a single leaf.
+ */
+static void lbvh_emit(LBVHBuilder *lb) {
+    BVH *bvh = lb->bvh;
+    // Entries are (BVH node slot, child index in the Karras tree). Every pop
+    // pushes at most two, so the stack never holds more than depth + 1.
+    u32 stack[BVH_MAX_DEPTH + 1];
+    u32 stack_child[BVH_MAX_DEPTH + 1];
+    u32 stack_depth[BVH_MAX_DEPTH + 1];
+    u32 sp = 0;
+    stack[sp] = 0;
+    stack_child[sp] = lb->count > 1 ? 0 : LBVH_LEAF;
+    stack_depth[sp++] = 1;
+    bvh->node_count = 1;
+    while (sp > 0) {
+        sp--;
+        u32 slot = stack[sp];
+        u32 child = stack_child[sp];
+        u32 depth = stack_depth[sp];
+        if (depth > bvh->depth) {
+            bvh->depth = depth;
+        }
+        u32 lo, hi;
+        lbvh_child_range(lb, child, &lo, &hi);
+        BVHNode *node = &bvh->nodes[slot];
+        if (hi - lo + 1 <= bvh->leaf_size || (child & LBVH_LEAF) ||
+            depth >= BVH_MAX_DEPTH - 1) {
+            node->left_first = lo;
+            node->count = hi - lo + 1;
+            bvh->leaf_count++;
+            continue;
+        }
+        u32 pair = bvh->node_count;
+        bvh->node_count += 2;
+        node->left_first = pair;
+        node->count = 0;
+        stack[sp] = pair + 1;
+        stack_child[sp] = lb->right[child];
+        stack_depth[sp++] = depth + 1;
+        stack[sp] = pair;
+        stack_child[sp] = lb->left[child];
+        stack_depth[sp++] = depth + 1;
+    }
+}
+
+static void lbvh_gather_spheres(u32 begin, u32 end, void *ctx) {
+    LBVHBuilder *lb = (LBVHBuilder *)ctx;
+    for (u32 i = begin; i < end; i++) {
+        lb->bvh->spheres[i] = lb->spheres[lb->order[i]];
+    }
+}
+
+BVH *new_lbvh(Sphere **spheres, u32 count, u32 leaf_size, u32 threads) {
+    BVH *bvh = malloc(sizeof(BVH));
+    if (bvh == NULL) {
+        failwith("new_lbvh: could not allocate memory!\n");
+    }
+    bvh->leaf_size = leaf_size > 0 ? leaf_size : 1;
+    bvh->sphere_count = count;
+    bvh->node_count = 0;
+    bvh->leaf_count = 0;
+    bvh->depth = 0;
+    bvh->build_cost = 0.0f;
+    bvh->nodes = malloc(sizeof(BVHNode) * (count > 0 ? 2 * count : 1));
+    bvh->spheres = malloc(sizeof(Sphere *) * (count > 0 ? count : 1));
+    if (bvh->nodes == NULL || bvh->spheres == NULL) {
+        failwithf("new_lbvh: could not allocate memory for %u spheres!\n",
+            count);
+    }
+    if (count == 0) {
+        bvh->store = new_sphere_store(bvh->spheres, NULL, 0);
+        return bvh;
+    }
+
+    LBVHBuilder lb = {
+        .spheres = spheres,
+        .count = count,
+        .leaf_size = bvh->leaf_size,
+        .threads = threads > 0 ? threads : 1,
+        .morton_bits = count > LBVH_WIDE_MORTON_THRESHOLD ? 63 : 30,
+        .keys = malloc(sizeof(u64) * count),
+        .order = malloc(sizeof(u32) * count),
+        .first = malloc(sizeof(u32) * count),
+        .last = malloc(sizeof(u32) * count),
+        .left = malloc(sizeof(u32) * count),
+        .right = malloc(sizeof(u32) * count),
+        .bvh = bvh,
+    };
+    if (lb.keys == NULL || lb.order == NULL || lb.first == NULL ||
+        lb.last == NULL || lb.left == NULL || lb.right == NULL) {
+        failwithf("new_lbvh: could not allocate build memory for %u "
+                  "spheres!\n",
+            count);
+    }
+    lb.centroid_bounds = aabb_empty();
+    for (u32 i = 0; i < count; i++) {
+        lb.centroid_bounds = aabb_grow(lb.centroid_bounds, spheres[i]->center);
+    }
+
+    parallel_for(lb.threads, count, LBVH_CHUNK, lbvh_morton_codes, &lb);
+    radix_sort_u64(lb.keys, lb.order, count, lb.morton_bits, lb.threads);
+    parallel_for(lb.threads, count, LBVH_CHUNK, lbvh_gather_spheres, &lb);
+    parallel_for(lb.threads, count - 1, LBVH_CHUNK, lbvh_internal_nodes, &lb);
+    lbvh_emit(&lb);
+
+    // The emitted tree has its shape but no bounds yet, which is exactly
+    // what a refit fills in.
+    bvh->store = new_sphere_store(bvh->spheres, lb.order, count);
+    bvh_refit(bvh, lb.threads);
+    bvh->build_cost = bvh_sah_cost(bvh);
+
+    free(lb.keys);
+    free(lb.order);
+    free(lb.first);
+    free(lb.last);
+    free(lb.left);
+    free(lb.right);
+    return bvh;
+}
@@ -0,0 +1,50 @@
+#ifndef LBVH_H
+#define LBVH_H
+/**
+ * @file lbvh.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief A linear BVH builder: spheres are sorted along a Morton curve and
+ * the hierarchy falls out of the sorted keys. Much faster to build than the
+ * binned SAH builder, at some cost in traversal speed.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#include "bvh.h"
+#include "defs.h"
+#include "sphere.h"
+
+// Above this many spheres, 21 bits per axis are used instead of 10.
+#define LBVH_WIDE_MORTON_THRESHOLD (1 << 18)
+
+/**
+ * @brief Build a hierarchy over the given spheres from their Morton codes.
+ * The result is an ordinary BVH, and is traversed the same way.
+ *
+ * @param spheres The spheres, which are not copied, only pointed to.
+ * @param count The number of spheres.
+ * @param leaf_size Subtrees with this many spheres or fewer become leaves.
+ * @param threads How many threads may help build it.
+ * @return BVH* A new hierarchy.
+ */
+BVH *new_lbvh(Sphere **spheres, u32 count, u32 leaf_size, u32 threads);
+
+/**
+ * @brief Sort keys and their values in place with a parallel LSD radix sort.
+ *
+ * @param bits How many of the low bits of the keys to sort by.
+ */
+void radix_sort_u64(u64 *keys, u32 *values, u32 count, u32 bits, u32 threads);
+
+/**
+ * @brief Spread the low 21 bits of v out so there are two zeros between
+ * every bit, so that three spread values can be interleaved into a Morton
+ * code.
+ */
+u64 morton_spread(u64 v);
+
+#endif
@@ -15,7 +15,7 @@
 #include "vec3.h"
 #include "color.h"
 
-typedef struct __attribute__((packed)) _Light
+typedef struct _Light
 {
     Vec3 position;
     Color color;
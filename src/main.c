@@ -1,15 +1,22 @@
 #define SDL_MAIN_HANDLED
 #include <SDL2/SDL.h>
 #include <math.h>
+#include <string.h>
 #include <time.h>
 #include "camera.h"
 #include "color.h"
 #include "defs.h"
 #include "fail.h"
+#include "parallel.h"
 #include "parser.h"
 #include "scene.h"
+#include "simd.h"
 #include "sphere.h"
+#include "sphere_store.h"
+#include "tiles.h"
+#include "util.h"
 #include "vec3.h"
+#include "wavefront.h"
 #ifdef __linux__
 #include <unistd.h>
 #else
@@ -18,64 +25,492 @@
 
 static bool debug = false;
 static clock_t start;
-static u8 cpu_count = 12;
+// Worker threads, 0 for one per online CPU.
+static u32 cpu_count = 0;
+// Whether to pin each worker thread to a CPU of its own.
+static bool pin_workers = false;
 static u8 batch_size = 3;
+static u32 leaf_size = BVH_DEFAULT_LEAF_SIZE;
+static Accelerator accelerator = ACCEL_BVH;
+// The side of the pixel blocks traced as packets, 0 to trace single rays.
+static u32 packet_block = 0;
+// Pixels whose shadow rays are sorted and traced together, 0 to shade each
+// pixel as it is hit.
+static u32 sort_batch = 0;
+// Rays per wave in wavefront mode, 0 to take each pixel through every stage.
+static u32 wave_size = 0;
+// The side of the square tiles the canvas is cut into for the workers.
+static u32 tile_size = TILE_DEFAULT_SIZE;
+// The order tiles are dealt out in and their pixels traced in.
+static TileOrder tile_order = TILE_ORDER_HILBERT;
+// Whether to render coarse to fine, in passes over every 8th, 4th, 2nd and
+// then every pixel, each splatted over the pixels it stands for until the
+// next pass fills them in.
+static bool progressive = false;
+#define PROGRESSIVE_STEP 8
+// The memory the workers share is split between them for first touch in
+// whole pages of this size.
+#define TOUCH_PAGE 4096
 
 typedef struct _RayWorkerArgs {
-    u16 id;
+    u32 id;
     SDL_Surface *canvas;
-    u64 offset;
-    u64 amount;
+    TileScheduler *tiles;
     Ray *rays;
     Scene *scene;
+    ShadowCache *shadow_cache;
     SDL_atomic_t *done;
+    // The pixels of the tile at hand, and room to trace them in.
+    u32 *pixels;
+    Ray *tile_rays;
+    HitOption *tile_hits;
+    Wavefront *wavefront;
+    // In wavefront mode, the pixels of the tiles gathered for the next wave,
+    // and the tiles themselves, to be splatted once it is rendered.
+    u32 *wave_pixels;
+    u32 wave_capacity;
+    u32 wave_count;
+    Tile *wave_tiles;
+    u32 wave_tile_capacity;
+    u32 wave_tile_count;
+    // Performance counter ticks spent on tiles, and when the worker started
+    // and ran out of them.
+    u64 busy;
+    u64 started;
+    u64 finished;
 } RayWorkerArgs;
 
-int fire_rays(void *args) {
-    RayWorkerArgs *wargs = (RayWorkerArgs *)args;
+typedef void (*TileFunction)(RayWorkerArgs *wargs, Tile *tile);
 
-    SDL_Surface *canvas = wargs->canvas;
-    SDL_atomic_t *done = wargs->done;
+// Clear the pixels of a tile's pass, so that those that miss everything do
+// not keep the color a coarser pass splatted over them.
+void clear_pass(RayWorkerArgs *wargs, Tile *tile) {
+    u32 *raster = wargs->canvas->pixels;
+    u32 count = tile_pixels(wargs->tiles, tile, wargs->pixels);
+    for (u32 i = 0; i < count; i++) {
+        raster[wargs->pixels[i]] = 0;
+    }
+}
+
+// Copy each pixel of a tile's pass over the block of step x step pixels it
+// stands for, until finer passes fill the rest of the block in.
+void splat_pass(RayWorkerArgs *wargs, Tile *tile) {
+    u32 *raster = wargs->canvas->pixels;
+    u32 width = wargs->canvas->w;
+    u32 count = tile_pixels(wargs->tiles, tile, wargs->pixels);
+    for (u32 i = 0; i < count; i++) {
+        u32 x = wargs->pixels[i] % width;
+        u32 y = wargs->pixels[i] / width;
+        u32 color = raster[wargs->pixels[i]];
+        for (u32 row = y; row < y + tile->step && row < tile->y + tile->h;
+             row++) {
+            for (u32 col = x;
+                 col < x + tile->step && col < tile->x + tile->w; col++) {
+                raster[row * width + col] = color;
+            }
+        }
+    }
+}
 
+void fire_rays(RayWorkerArgs *wargs, Tile *tile) {
     Ray *rays = wargs->rays;
     Scene *scene = wargs->scene;
-
-    u64 offset = wargs->offset;
-    u64 amount = wargs->amount;
-
-    u32 *raster = canvas->pixels;
+    u32 *raster = wargs->canvas->pixels;
+    u32 *pixels = wargs->pixels;
+    u32 count = tile_pixels(wargs->tiles, tile, pixels);
 
     HitOption hit_;
-    if (debug) {
-        printf("rw[%hu]: Firing %llu rays.\n", wargs->id, amount);
-    }
-    u32 hit_queue[batch_size][3];
+    u32 hit_queue[batch_size][2];
     u32 hits = 0;
-    for (u32 i = offset; i < offset + amount; i += batch_size) {
-        for (u32 j = 0; j < batch_size; j++) {
-            hit_ = trace_ray(scene, rays + i + j);
+    for (u32 i = 0; i < count; i += batch_size) {
+        for (u32 j = i; j < i + batch_size && j < count; j++) {
+            hit_ = trace_ray(scene, rays + pixels[j], wargs->shadow_cache);
             if (is_some(hit_)) {
-                hit_queue[hits][0] = i;
-                hit_queue[hits][1] = j;
-                hit_queue[hits++][2] = color_to_pixel(hit_.value.color);
-
+                hit_queue[hits][0] = pixels[j];
+                hit_queue[hits++][1] = color_to_pixel(hit_.value.color);
             }
         }
         for (u32 h = 0; h < hits; h++) {
-            u32 *hit_data = hit_queue[h];
-            raster[hit_data[0] + hit_data[1]] = hit_data[2];
+            raster[hit_queue[h][0]] = hit_queue[h][1];
         }
         hits = 0;
     }
-    SDL_AtomicAdd(done, 1);
+}
+
+void fire_sorted(RayWorkerArgs *wargs, Tile *tile) {
+    u32 *raster = wargs->canvas->pixels;
+    u32 *pixels = wargs->pixels;
+    u32 count = tile_pixels(wargs->tiles, tile, pixels);
+    for (u32 k = 0; k < count; k++) {
+        wargs->tile_rays[k] = wargs->rays[pixels[k]];
+    }
+    for (u32 i = 0; i < count; i += sort_batch) {
+        u32 n = count - i < sort_batch ? count - i : sort_batch;
+        trace_batch(wargs->scene, wargs->tile_rays + i, n, wargs->tile_hits,
+            wargs->shadow_cache);
+        for (u32 k = 0; k < n; k++) {
+            if (is_some(wargs->tile_hits[k])) {
+                raster[pixels[i + k]] =
+                    color_to_pixel(wargs->tile_hits[k].value.color);
+            }
+        }
+    }
+}
+
+// Render the wave gathered so far, then splat its tiles if the pass is
+// coarse.
+void flush_wave(RayWorkerArgs *wargs) {
+    wavefront_render(wargs->wavefront, wargs->scene, wargs->rays,
+        wargs->wave_pixels, wargs->wave_count, wargs->canvas->pixels,
+        wargs->shadow_cache);
+    for (u32 t = 0; t < wargs->wave_tile_count; t++) {
+        if (wargs->wave_tiles[t].step > 1) {
+            splat_pass(wargs, &wargs->wave_tiles[t]);
+        }
+    }
+    wargs->wave_count = 0;
+    wargs->wave_tile_count = 0;
+}
+
+// Waves may be longer than a tile, so the pixels of tiles are gathered until
+// the next one might not fit, and then rendered as one wave.
+void fire_wavefront(RayWorkerArgs *wargs, Tile *tile) {
+    u32 tile_area = wargs->tiles->tile_size * wargs->tiles->tile_size;
+    if (wargs->wave_count + tile_area > wargs->wave_capacity) {
+        flush_wave(wargs);
+    }
+    if (wargs->wave_tile_count == wargs->wave_tile_capacity) {
+        Tile *tiles =
+            malloc(sizeof(Tile) * wargs->wave_tile_capacity * 2);
+        if (tiles == NULL) {
+            failwith("fire_wavefront: could not grow the tile list!\n");
+        }
+        memcpy(tiles, wargs->wave_tiles,
+            sizeof(Tile) * wargs->wave_tile_count);
+        free(wargs->wave_tiles);
+        wargs->wave_tiles = tiles;
+        wargs->wave_tile_capacity *= 2;
+    }
+    wargs->wave_tiles[wargs->wave_tile_count++] = *tile;
+    wargs->wave_count += tile_pixels(
+        wargs->tiles, tile, wargs->wave_pixels + wargs->wave_count);
+}
+
+void fire_packets(RayWorkerArgs *wargs, Tile *tile) {
+    SDL_Surface *canvas = wargs->canvas;
+    u32 *raster = canvas->pixels;
+
+    // Tiles are a whole number of blocks, bar the ones cut off by the canvas.
+    Ray packet[BVH_PACKET_MAX];
+    HitOption hits[BVH_PACKET_MAX];
+    for (u32 y = tile->y; y < tile->y + tile->h; y += packet_block) {
+        for (u32 x = tile->x; x < tile->x + tile->w; x += packet_block) {
+            u32 n = camera_gather_block(wargs->rays, canvas->w, canvas->h, x,
+                y, packet_block, packet);
+            trace_packet(wargs->scene, packet, n, hits, wargs->shadow_cache);
+            // Hits come back in the order camera_gather_block laid them out.
+            u32 k = 0;
+            for (u32 row = y; row < y + packet_block && row < (u32)canvas->h;
+                 row++) {
+                for (u32 col = x;
+                     col < x + packet_block && col < (u32)canvas->w;
+                     col++, k++) {
+                    if (is_some(hits[k])) {
+                        raster[row * canvas->w + col] =
+                            color_to_pixel(hits[k].value.color);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Packets of the pixels of a tile's pass, in the order tile_pixels lists them,
+// for passes that do not cover whole blocks.
+void fire_packet_list(RayWorkerArgs *wargs, Tile *tile) {
+    u32 *raster = wargs->canvas->pixels;
+    u32 *pixels = wargs->pixels;
+    u32 count = tile_pixels(wargs->tiles, tile, pixels);
+    for (u32 i = 0; i < count; i += BVH_PACKET_MAX) {
+        u32 n = count - i < BVH_PACKET_MAX ? count - i : BVH_PACKET_MAX;
+        for (u32 k = 0; k < n; k++) {
+            wargs->tile_rays[k] = wargs->rays[pixels[i + k]];
+        }
+        trace_packet(wargs->scene, wargs->tile_rays, n, wargs->tile_hits,
+            wargs->shadow_cache);
+        for (u32 k = 0; k < n; k++) {
+            if (is_some(wargs->tile_hits[k])) {
+                raster[pixels[i + k]] =
+                    color_to_pixel(wargs->tile_hits[k].value.color);
+            }
+        }
+    }
+}
+
+// The tile function for the chosen mode, the per-pixel one by default.
+TileFunction pick_worker() {
+    if (packet_block > 0) {
+        return progressive ? fire_packet_list : fire_packets;
+    }
+    if (wave_size > 0) {
+        return fire_wavefront;
+    }
+    if (sort_batch > 0) {
+        return fire_sorted;
+    }
+    return fire_rays;
+}
+
+void ray_worker(void *args) {
+    RayWorkerArgs *wargs = (RayWorkerArgs *)args;
+    TileFunction fire = pick_worker();
     if (debug) {
-        printf("rw[%hu]: Done!\n", wargs->id);
+        printf("rw[%u]: Firing rays.\n", wargs->id);
     }
-    return 0;
+    wargs->busy = 0;
+    wargs->started = SDL_GetPerformanceCounter();
+    Tile tile;
+    while (tile_scheduler_next(wargs->tiles, wargs->id, &tile)) {
+        u64 tile_start = SDL_GetPerformanceCounter();
+        if (progressive) {
+            clear_pass(wargs, &tile);
+        }
+        fire(wargs, &tile);
+        // Tiles in waves are splatted when their wave is rendered.
+        if (tile.step > 1 && wargs->wavefront == NULL) {
+            splat_pass(wargs, &tile);
+        }
+        wargs->busy += SDL_GetPerformanceCounter() - tile_start;
+    }
+    if (wargs->wavefront != NULL && wargs->wave_count > 0) {
+        u64 wave_start = SDL_GetPerformanceCounter();
+        flush_wave(wargs);
+        wargs->busy += SDL_GetPerformanceCounter() - wave_start;
+    }
+    wargs->finished = SDL_GetPerformanceCounter();
+    if (debug) {
+        printf("rw[%u]: Done!\n", wargs->id);
+    }
+    SDL_AtomicAdd(wargs->done, 1);
+}
+
+void print_shadow_cache_stats(RayWorkerArgs **wargs) {
+    u64 rays = 0, blocked = 0, hits = 0;
+    for (u32 i = 0; i < cpu_count; i++) {
+        rays += wargs[i]->shadow_cache->rays;
+        blocked += wargs[i]->shadow_cache->blocked;
+        hits += wargs[i]->shadow_cache->hits;
+    }
+    printf("Shadow cache: %llu shadow rays, %llu blocked, %llu of them by "
+           "the cached occluder (%.1f%% hit rate)\n",
+        (unsigned long long)rays, (unsigned long long)blocked,
+        (unsigned long long)hits,
+        blocked > 0 ? 100.0 * hits / blocked : 0.0);
+}
+
+// How long each worker spent on tiles, and how long it sat idle while the
+// frame was being rendered, from the first worker starting to the last one
+// running out of tiles.
+void print_worker_stats(RayWorkerArgs **wargs, TileScheduler *tiles) {
+    u64 first = wargs[0]->started, last = wargs[0]->finished, busy = 0;
+    for (u32 i = 0; i < cpu_count; i++) {
+        first = wargs[i]->started < first ? wargs[i]->started : first;
+        last = wargs[i]->finished > last ? wargs[i]->finished : last;
+        busy += wargs[i]->busy;
+    }
+    f64 to_msec = 1000.0 / SDL_GetPerformanceFrequency();
+    for (u32 i = 0; i < cpu_count; i++) {
+        TileDeque *deque = &tiles->deques[i];
+        printf("Worker %u: %u tiles (%u steals), busy %.2f ms, idle %.2f "
+               "ms\n",
+            i, deque->taken, deque->steals, wargs[i]->busy * to_msec,
+            ((last - first) - wargs[i]->busy) * to_msec);
+    }
+    printf("Utilization: %.1f%% of %u threads over %.2f ms\n",
+        last > first ? 100.0 * busy / ((f64)(last - first) * cpu_count) : 0.0,
+        cpu_count, (last - first) * to_msec);
+}
+
+// What the workers of a frame share, and what each keeps for the next frame:
+// the camera rays, the tiles, and every worker's shadow cache and scratch
+// memory. Worker i of a frame always gets the i-th set.
+typedef struct _Frame {
+    Scene *scene;
+    SDL_Surface *canvas;
+    Ray *rays;
+    TileScheduler *tiles;
+    RayWorkerArgs **wargs;
+    SDL_atomic_t done;
+    // The step of the pass being rendered, and when the frame was started.
+    u32 step;
+    u64 started;
+} Frame;
+
+// The bytes of a page-aligned array of size bytes that worker id of n is to
+// touch first: a run of whole pages, so that no page is touched by two.
+void first_touch_span(u64 size, u32 id, u32 n, u64 *begin, u64 *end) {
+    u64 pages = (size + TOUCH_PAGE - 1) / TOUCH_PAGE;
+    *begin = pages * id / n * TOUCH_PAGE;
+    *end = pages * (id + 1) / n * TOUCH_PAGE;
+    *begin = *begin < size ? *begin : size;
+    *end = *end < size ? *end : size;
+}
+
+// Allocate a worker's scratch memory and clear its share of the framebuffer
+// and camera rays. This runs on the pool worker the scratch belongs to, so
+// the scratch is first touched there and lands on that thread's NUMA node.
+// The framebuffer and rays are cut into one run of rows per worker, ending at
+// page boundaries, which spreads their pages evenly over the workers' nodes.
+// The tiles a worker renders need not lie in its own run, as they are dealt
+// out along a curve and stolen.
+void ray_worker_setup(void *args) {
+    RayWorkerArgs *wargs = (RayWorkerArgs *)args;
+    TileScheduler *tiles = wargs->tiles;
+    u32 tile_area = tiles->tile_size * tiles->tile_size;
+    wargs->shadow_cache = new_shadow_cache(wargs->scene);
+    wargs->pixels = malloc(sizeof(u32) * tile_area);
+    wargs->tile_rays = malloc(sizeof(Ray) * tile_area);
+    wargs->tile_hits = malloc(sizeof(HitOption) * tile_area);
+    if (wargs->pixels == NULL || wargs->tile_rays == NULL ||
+        wargs->tile_hits == NULL) {
+        failwith("ray_worker_setup: could not allocate memory for the "
+                 "tiles!\n");
+    }
+    memset(wargs->tile_rays, 0, sizeof(Ray) * tile_area);
+    memset(wargs->tile_hits, 0, sizeof(HitOption) * tile_area);
+    wargs->wavefront = NULL;
+    wargs->wave_pixels = NULL;
+    wargs->wave_tiles = NULL;
+    if (wave_size > 0) {
+        // Room for a wave of whole tiles, or one tile if waves are smaller.
+        wargs->wavefront = new_wavefront(wave_size);
+        wargs->wave_capacity = wave_size > tile_area ? wave_size : tile_area;
+        wargs->wave_count = 0;
+        wargs->wave_tile_capacity = wargs->wave_capacity / tile_area + 1;
+        wargs->wave_tile_count = 0;
+        wargs->wave_pixels = malloc(sizeof(u32) * wargs->wave_capacity);
+        wargs->wave_tiles = malloc(sizeof(Tile) * wargs->wave_tile_capacity);
+        if (wargs->wave_pixels == NULL || wargs->wave_tiles == NULL) {
+            failwith("ray_worker_setup: could not allocate memory for the "
+                     "waves!\n");
+        }
+    }
+    u64 pixels = (u64)wargs->canvas->w * wargs->canvas->h;
+    u64 begin, end;
+    first_touch_span(sizeof(u32) * pixels, wargs->id, cpu_count, &begin, &end);
+    memset((u8 *)wargs->canvas->pixels + begin, 0, end - begin);
+    first_touch_span(sizeof(Ray) * pixels, wargs->id, cpu_count, &begin, &end);
+    memset((u8 *)wargs->rays + begin, 0, end - begin);
+}
+
+Frame *new_frame(Scene *scene, SDL_Surface *canvas, ThreadPool *pool) {
+    Frame *frame = malloc(sizeof(Frame));
+    if (frame == NULL) {
+        failwith("new_frame: could not allocate memory!\n");
+    }
+    frame->scene = scene;
+    frame->canvas = canvas;
+    // Left untouched here; the workers touch their own pages first.
+    frame->rays =
+        aligned_malloc(TOUCH_PAGE, sizeof(Ray) * canvas->w * canvas->h);
+    frame->wargs = calloc(cpu_count, sizeof(RayWorkerArgs *));
+    if (frame->wargs == NULL) {
+        failwith("new_frame: could not allocate memory!\n");
+    }
+    // Packets need tiles that are a whole number of blocks, and passes tiles
+    // that line up with the coarsest one.
+    u32 side = tile_size;
+    u32 multiple = progressive ? PROGRESSIVE_STEP : packet_block;
+    if (multiple > 0) {
+        side = (side + multiple - 1) / multiple * multiple;
+    }
+    frame->tiles = new_tile_scheduler(
+        canvas->w, canvas->h, side, cpu_count, tile_order);
+    if (debug) {
+        printf("Tiles: %u of %ux%u pixels in %s order, dealt out to %u "
+               "threads.\n",
+            frame->tiles->tile_count, frame->tiles->tile_size,
+            frame->tiles->tile_size, tile_order_name(tile_order), cpu_count);
+    }
+    SDL_AtomicSet(&frame->done, cpu_count);
+    for (u32 i = 0; i < cpu_count; i++) {
+        RayWorkerArgs *rwargs = malloc(sizeof(RayWorkerArgs));
+        if (rwargs == NULL) {
+            failwith("new_frame: could not allocate memory!\n");
+        }
+        rwargs->id = i;
+        rwargs->canvas = canvas;
+        rwargs->tiles = frame->tiles;
+        rwargs->rays = frame->rays;
+        rwargs->scene = scene;
+        rwargs->done = &frame->done;
+        frame->wargs[i] = rwargs;
+        thread_pool_submit_to(pool, i, ray_worker_setup, rwargs);
+    }
+    thread_pool_wait(pool);
+    return frame;
+}
+
+// Queue a job per worker on the pool for the tiles' current pass. The pass is
+// done once frame->done counts every worker.
+void frame_submit(Frame *frame, ThreadPool *pool) {
+    SDL_AtomicSet(&frame->done, 0);
+    for (u32 i = 0; i < cpu_count; i++) {
+        thread_pool_submit_to(pool, i, ray_worker, frame->wargs[i]);
+    }
+}
+
+// Set up the camera rays and start on the first pass, which covers the whole
+// frame unless it is progressive.
+void frame_start(Frame *frame, ThreadPool *pool) {
+    frame->started = SDL_GetPerformanceCounter();
+    setup_perspective_rays_into(scene_get_camera(frame->scene),
+        frame->canvas->w, frame->canvas->h, frame->rays);
+    frame->step = progressive ? PROGRESSIVE_STEP : 1;
+    tile_scheduler_pass(frame->tiles, frame->step, 0);
+    frame_submit(frame, pool);
+}
+
+// Start on the next, finer pass once a pass is done. Returns false when the
+// last pass is done.
+bool frame_refine(Frame *frame, ThreadPool *pool) {
+    if (frame->step == 1) {
+        return false;
+    }
+    u32 coarser = frame->step;
+    frame->step /= 2;
+    tile_scheduler_pass(frame->tiles, frame->step, coarser);
+    frame_submit(frame, pool);
+    return true;
+}
+
+bool frame_done(Frame *frame) {
+    return SDL_AtomicGet(&frame->done) == (int)cpu_count;
+}
+
+void destroy_frame(Frame *frame) {
+    for (u32 i = 0; i < cpu_count; i++) {
+        RayWorkerArgs *rwargs = frame->wargs[i];
+        destroy_shadow_cache(rwargs->shadow_cache);
+        if (rwargs->wavefront != NULL) {
+            destroy_wavefront(rwargs->wavefront);
+        }
+        free(rwargs->wave_pixels);
+        free(rwargs->wave_tiles);
+        free(rwargs->pixels);
+        free(rwargs->tile_rays);
+        free(rwargs->tile_hits);
+        free(rwargs);
+    }
+    free(frame->wargs);
+    destroy_tile_scheduler(frame->tiles);
+    aligned_free(frame->rays);
+    free(frame);
 }
 
 typedef struct _RenderArgs {
     Scene *scene;
+    ThreadPool *pool;
     SDL_atomic_t *running;
     SDL_atomic_t *buffer_switched;
     SDL_Surface *canvas;
@@ -103,61 +538,43 @@ int render(void *args) {
         SDL_UpdateWindowSurface(window);                        \
     } while (0);
 
-    Scene *scene = rargs->scene;
-    Camera *camera = scene_get_camera(
-        scene);  // new_camera(vec3(0.0, 0.0, 0.0), vec3(0.0, 0.0, 1.0));
-    Ray *rays = setup_perspective_rays(camera, canvas->w, canvas->h);
-
-    SDL_Thread **workers = calloc(cpu_count, sizeof(SDL_Thread *));
-    RayWorkerArgs **wargs = calloc(cpu_count, sizeof(RayWorkerArgs *));
-    u64 canvas_size = canvas->w * canvas->h;
-    u64 parallelism = canvas_size / ((u64)cpu_count);
-    if (debug) {
-        printf("Parallelism: %llu rays per thread, %llu rays in total.\n",
-            parallelism, canvas_size);
-    }
-    SDL_atomic_t *done = malloc(sizeof(SDL_atomic_t));
-    SDL_AtomicSet(done, 0);
-    for (u32 i = 0; i < cpu_count; i++) {
-        RayWorkerArgs *rwargs = malloc(sizeof(RayWorkerArgs));
-        rwargs->id = i;
-        rwargs->offset = i * parallelism;
-        rwargs->amount =
-            i < (cpu_count - 1) ? parallelism : canvas_size - (parallelism * i);
-        rwargs->canvas = canvas;
-        rwargs->rays = rays;
-        rwargs->scene = scene;
-        rwargs->done = done;
-        wargs[i] = rwargs;
-        workers[i] = SDL_CreateThread(fire_rays, NULL, rwargs);
-        render_surface();
-    }
+    Frame *frame = new_frame(rargs->scene, canvas, rargs->pool);
+    frame_start(frame, rargs->pool);
+    render_surface();
 
+    bool reported = false;
     while (SDL_AtomicGet(running)) {
         render_surface();
-        if (SDL_AtomicGet(done) == cpu_count) {
+        if (!reported && frame_done(frame)) {
+            if (debug && progressive) {
+                printf("Pass over every %u pixels done after %.2f ms\n",
+                    frame->step,
+                    (SDL_GetPerformanceCounter() - frame->started) * 1000.0 /
+                        SDL_GetPerformanceFrequency());
+            }
+            if (frame_refine(frame, rargs->pool)) {
+                continue;
+            }
             clock_t elapsed = clock() - start;
             i64 msec = elapsed * 1000 / CLOCKS_PER_SEC;
             printf("Render completed: %lld seconds, %lld milliseconds\n",
                 msec / 1000, msec % 1000);
-            SDL_AtomicSet(done, -1);
+            if (debug) {
+                print_shadow_cache_stats(frame->wargs);
+                print_worker_stats(frame->wargs, frame->tiles);
+            }
+            reported = true;
         }
     }
     render_surface();
     render_surface();
 
-    for (u32 i = 0; i < cpu_count; i++) {
+    // The workers may still be on the frame, and need its memory until done.
+    while (!frame_done(frame)) {
         render_surface();
-        SDL_WaitThread(workers[i], NULL);
+        SDL_Delay(1);
     }
-
-    free(done);
-    free(rays);
-    free(workers);
-    for (u32 i = 0; i < cpu_count; i++) {
-        free(wargs[i]);
-    }
-    free(wargs);
+    destroy_frame(frame);
     render_surface();
 #undef render_surface
     return 0;
@@ -168,8 +585,9 @@ int main(int argc, char *argv[]) {
     u32 window_w = 1792, w = 1792, window_h = 768, h = 768;
     char *input_file = NULL;
     bool fullscreen = false;
+    SimdLevel simd = simd_detect();
 
-    while ((opt = getopt(argc, argv, "w:h:c:b:i:df")) != -1) {
+    while ((opt = getopt(argc, argv, "w:h:c:b:l:a:s:p:r:v:t:o:i:dfPg")) != -1) {
         switch (opt) {
             case 'w':
                 w = atoi(optarg);
@@ -178,11 +596,71 @@ int main(int argc, char *argv[]) {
                 h = atoi(optarg);
                 break;
             case 'c':
-                cpu_count = atoi(optarg);
+                cpu_count = (u32)atoi(optarg);
+                break;
+            case 'P':
+                pin_workers = true;
+                break;
+            case 'g':
+                progressive = true;
+                break;
+            case 'o':
+                if (!tile_order_parse(optarg, &tile_order)) {
+                    fprintf(stderr,
+                        "Unknown tile order '%s', expected scanline, morton "
+                        "or hilbert.\n",
+                        optarg);
+                    exit(EXIT_FAILURE);
+                }
                 break;
             case 'b':
                 batch_size = atoi(optarg);
                 break;
+            case 'l':
+                leaf_size = atoi(optarg);
+                break;
+            case 'a':
+                if (!accelerator_parse(optarg, &accelerator)) {
+                    fprintf(stderr,
+                        "Unknown accelerator '%s', expected bvh, lbvh, "
+                        "qbvh, obvh, cbvh8, cbvh16, kdtree, grid, grid2 or "
+                        "none.\n",
+                        optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 's':
+                if (!simd_level_parse(optarg, &simd)) {
+                    fprintf(stderr,
+                        "Unknown SIMD level '%s', expected scalar, sse4.2, "
+                        "avx2 or avx512.\n",
+                        optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'p':
+                packet_block = atoi(optarg);
+                if (packet_block != 0 && packet_block != 4 &&
+                    packet_block != 8) {
+                    fprintf(stderr,
+                        "Unknown packet size '%s', expected 0, 4 or 8.\n",
+                        optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r':
+                sort_batch = atoi(optarg);
+                break;
+            case 'v':
+                wave_size = atoi(optarg);
+                break;
+            case 't':
+                tile_size = atoi(optarg);
+                if (tile_size == 0) {
+                    fprintf(stderr, "The tile size must be at least 1.\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
             case 'd':
                 debug = true;
                 break;
@@ -195,7 +673,10 @@ int main(int argc, char *argv[]) {
             default:
                 fprintf(stderr,
                     "Usage: %s [-w width] [-h height] [-c cpu_count] [-b "
-                    "batch_size] [-d] [-f] -i <input_scene.json>\n",
+                    "batch_size] [-l leaf_size] [-a accelerator] [-s "
+                    "simd_level] [-p packet_size] [-r sort_batch] [-v "
+                    "wave_size] [-t tile_size] [-o tile_order] [-d] [-f] "
+                    "[-P] [-g] -i <input_scene.json>\n",
                     argv[0]);
                 exit(EXIT_FAILURE);
         }
@@ -205,15 +686,48 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "An input file path is required.\n");
         fprintf(stderr,
             "Usage: %s [-w width] [-h height] [-c cpu_count] [-b batch_size] "
-            "[-d] [-f] -i <input_scene.json>\n",
+            "[-l leaf_size] [-a accelerator] [-s simd_level] [-p packet_size] "
+            "[-r sort_batch] [-v wave_size] [-t tile_size] [-o tile_order] "
+            "[-d] [-f] [-P] [-g] -i <input_scene.json>\n",
             argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    Scene *scene = parse_scene(input_file);
+    if (cpu_count == 0) {
+        cpu_count = online_cpu_count();
+    }
+    simd_select(simd);
+    ray_select_kernels(simd);
+    sphere_store_select_kernel(simd);
+    mesh_select_kernel(simd);
+    // Loading meshes and building the acceleration structures borrow the
+    // render workers too, rather than start threads of their own.
+    ThreadPool *pool = new_thread_pool(cpu_count, pin_workers);
+    parallel_use_pool(pool);
+    Scene *scene = parse_scene(input_file, cpu_count);
     if (debug) {
+        printf("SIMD kernels: %s (detected %s)\n", simd_level_name(simd),
+            simd_level_name(simd_detect()));
+        if (pin_workers) {
+            printf("Threads: %u, %u pinned, on %u online CPUs\n", cpu_count,
+                pool->pinned, online_cpu_count());
+        } else {
+            printf("Threads: %u, not pinned, on %u online CPUs\n", cpu_count,
+                online_cpu_count());
+        }
         scene_debug_print(scene);
     }
+    u64 build_start = SDL_GetPerformanceCounter();
+    scene_build_acceleration(scene, accelerator, leaf_size, cpu_count);
+    if (debug) {
+        u64 build_ticks = SDL_GetPerformanceCounter() - build_start;
+        f64 build_msec = build_ticks * 1000.0 / SDL_GetPerformanceFrequency();
+        printf("Acceleration structure built in %.2f milliseconds\n",
+            build_msec);
+        scene_debug_print_acceleration(scene);
+        printf("Closest-hit throughput: %.2f Mrays/s\n",
+            scene_measure_throughput(scene, w, h, packet_block));
+    }
     start = clock();
     SDL_atomic_t *running = malloc(sizeof(SDL_atomic_t));
     running->value = true;
@@ -237,8 +751,11 @@ int main(int argc, char *argv[]) {
     if (window_surface == NULL) {
         failwith("Failed to retrieve window surface!\n");
     }
-    SDL_Surface *canvas =
-        SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_RGB888);
+    // The pixels are left for the render workers to touch first, each its own
+    // pages, rather than cleared here.
+    u32 *framebuffer = aligned_malloc(TOUCH_PAGE, sizeof(u32) * w * h);
+    SDL_Surface *canvas = SDL_CreateRGBSurfaceWithFormatFrom(
+        framebuffer, w, h, 32, w * sizeof(u32), SDL_PIXELFORMAT_RGB888);
     SDL_PixelFormat *fmt = canvas->format;
     // Awful casting, but silences the warnings.
     color_register_format(fmt, (u32(*)(void *, u8, u8, u8)) & SDL_MapRGB);
@@ -249,6 +766,7 @@ int main(int argc, char *argv[]) {
     rargs->window_surface = window_surface;
     rargs->window = window;
     rargs->scene = scene;
+    rargs->pool = pool;
 
     SDL_Thread *render_thread = SDL_CreateThread(render, "RENDER", rargs);
     SDL_Event e;
@@ -262,6 +780,11 @@ int main(int argc, char *argv[]) {
         }
     }
     SDL_WaitThread(render_thread, NULL);
+    parallel_use_pool(NULL);
+    destroy_thread_pool(pool);
+    // SDL leaves pixels it was handed to whoever allocated them.
+    SDL_FreeSurface(canvas);
+    aligned_free(framebuffer);
     free(rargs);
     scene_free(scene);
     return 0;
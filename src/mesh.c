@@ -0,0 +1,716 @@
+#include "mesh.h"
+#include "fail.h"
+#include "parallel.h"
+#include "util.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+// OBJ files are parsed in chunks of about this many bytes, one per task.
+#define MESH_CHUNK_BYTES (1u << 20)
+#define MESH_BOUNDS_CHUNK 16384
+
+/**
+ * A ray set up for the watertight triangle test of Woop, Benthin and Wald:
+ * kz is the axis the ray mostly points along, and the shear sx, sy, sz maps
+ * the ray onto the positive kz axis, where the test happens in two
+ * dimensions. kx and ky are swapped for rays going down kz, so that triangles
+ * keep their winding.
+ */
+typedef struct _MeshRay {
+    Vec3 origin;
+    Vec3 inv_dir;
+    f32 org[3];
+    u8 kx, ky, kz;
+    f32 sx, sy, sz;
+} MeshRay;
+
+typedef u32 (*MeshKernelFn)(
+    Mesh *mesh, u32 first, u32 count, MeshRay *ray, f32 *t_max);
+
+static void mesh_ray_setup(MeshRay *r, Ray *ray) {
+    Vec3 d = ray->direction;
+    r->origin = ray->origin;
+    r->inv_dir = safe_inverse(d);
+    for (u8 axis = 0; axis < 3; axis++) {
+        r->org[axis] = vaxis(ray->origin, axis);
+    }
+    u8 kz = 0;
+    if (fabsf(d.y) > fabsf(vaxis(d, kz))) {
+        kz = 1;
+    }
+    if (fabsf(d.z) > fabsf(vaxis(d, kz))) {
+        kz = 2;
+    }
+    u8 kx = (kz + 1) % 3;
+    u8 ky = (kx + 1) % 3;
+    if (vaxis(d, kz) < 0.0f) {
+        u8 tmp = kx;
+        kx = ky;
+        ky = tmp;
+    }
+    r->kx = kx;
+    r->ky = ky;
+    r->kz = kz;
+    r->sx = vaxis(d, kx) / vaxis(d, kz);
+    r->sy = vaxis(d, ky) / vaxis(d, kz);
+    r->sz = 1.0f / vaxis(d, kz);
+}
+
+/**
+ * @brief The watertight test of one triangle, hit from either side. Rays
+ * through an edge or a vertex get the edge functions in double precision, so
+ * the triangles sharing it agree on which of them is hit.
+ */
+static bool mesh_triangle_hit(
+    Mesh *mesh, u32 tri, MeshRay *r, f32 t_max, f32 *t) {
+    const u32 *corner = &mesh->indices[3 * tri];
+    const f32 *a = &mesh->positions[3 * corner[0]];
+    const f32 *b = &mesh->positions[3 * corner[1]];
+    const f32 *c = &mesh->positions[3 * corner[2]];
+    u8 kx = r->kx, ky = r->ky, kz = r->kz;
+    f32 az = a[kz] - r->org[kz];
+    f32 bz = b[kz] - r->org[kz];
+    f32 cz = c[kz] - r->org[kz];
+    f32 ax = (a[kx] - r->org[kx]) - r->sx * az;
+    f32 ay = (a[ky] - r->org[ky]) - r->sy * az;
+    f32 bx = (b[kx] - r->org[kx]) - r->sx * bz;
+    f32 by = (b[ky] - r->org[ky]) - r->sy * bz;
+    f32 cx = (c[kx] - r->org[kx]) - r->sx * cz;
+    f32 cy = (c[ky] - r->org[ky]) - r->sy * cz;
+    f32 u = cx * by - cy * bx;
+    f32 v = ax * cy - ay * cx;
+    f32 w = bx * ay - by * ax;
+    if (u == 0.0f || v == 0.0f || w == 0.0f) {
+        // The products of two floats are exact in double precision.
+        u = (f32)((f64)cx * by - (f64)cy * bx);
+        v = (f32)((f64)ax * cy - (f64)ay * cx);
+        w = (f32)((f64)bx * ay - (f64)by * ax);
+    }
+    if ((u < 0.0f || v < 0.0f || w < 0.0f) &&
+        (u > 0.0f || v > 0.0f || w > 0.0f)) {
+        return false;
+    }
+    f32 det = u + v + w;
+    if (det == 0.0f) {
+        return false;
+    }
+    f32 hit_t =
+        (u * (r->sz * az) + v * (r->sz * bz) + w * (r->sz * cz)) / det;
+    if (!(hit_t > 0.0f && hit_t < t_max)) {
+        return false;
+    }
+    *t = hit_t;
+    return true;
+}
+
+static u32 mesh_intersect_n_scalar(
+    Mesh *mesh, u32 first, u32 count, MeshRay *r, f32 *t_max) {
+    u32 best = MESH_MISS;
+    for (u32 i = first; i < first + count; i++) {
+        f32 t;
+        if (mesh_triangle_hit(mesh, i, r, *t_max, &t)) {
+            *t_max = t;
+            best = i;
+        }
+    }
+    return best;
+}
+
+#ifdef SIMD_X86
+
+/**
+ * @brief The watertight test of four triangles at a time, with the corners
+ * gathered through the index array. Lanes whose ray passes through an edge
+ * are left to the scalar test, which settles them in double precision, so
+ * hits are the same as with the scalar kernel.
+ */
+SIMD_TARGET("sse4.2")
+static u32 mesh_intersect_n_sse42(
+    Mesh *mesh, u32 first, u32 count, MeshRay *r, f32 *t_max) {
+    u32 best = MESH_MISS;
+    const u8 axes[3] = {r->kx, r->ky, r->kz};
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 sx = _mm_set1_ps(r->sx);
+    const __m128 sy = _mm_set1_ps(r->sy);
+    const __m128 sz = _mm_set1_ps(r->sz);
+    const __m128 ox = _mm_set1_ps(r->org[r->kx]);
+    const __m128 oy = _mm_set1_ps(r->org[r->ky]);
+    const __m128 oz = _mm_set1_ps(r->org[r->kz]);
+    u32 end = first + count;
+    for (u32 i = first; i < end; i += 4) {
+        u32 n = end - i < 4 ? end - i : 4;
+        // Corner, then sheared axis, then lane. Missing lanes repeat the
+        // first triangle and are masked off.
+        f32 lanes[3][3][4];
+        for (u32 j = 0; j < 4; j++) {
+            const u32 *corner = &mesh->indices[3 * (i + (j < n ? j : 0))];
+            for (u32 k = 0; k < 3; k++) {
+                const f32 *p = &mesh->positions[3 * corner[k]];
+                for (u32 axis = 0; axis < 3; axis++) {
+                    lanes[k][axis][j] = p[axes[axis]];
+                }
+            }
+        }
+        __m128 az = _mm_sub_ps(_mm_loadu_ps(lanes[0][2]), oz);
+        __m128 bz = _mm_sub_ps(_mm_loadu_ps(lanes[1][2]), oz);
+        __m128 cz = _mm_sub_ps(_mm_loadu_ps(lanes[2][2]), oz);
+        __m128 ax = _mm_sub_ps(
+            _mm_sub_ps(_mm_loadu_ps(lanes[0][0]), ox), _mm_mul_ps(sx, az));
+        __m128 ay = _mm_sub_ps(
+            _mm_sub_ps(_mm_loadu_ps(lanes[0][1]), oy), _mm_mul_ps(sy, az));
+        __m128 bx = _mm_sub_ps(
+            _mm_sub_ps(_mm_loadu_ps(lanes[1][0]), ox), _mm_mul_ps(sx, bz));
+        __m128 by = _mm_sub_ps(
+            _mm_sub_ps(_mm_loadu_ps(lanes[1][1]), oy), _mm_mul_ps(sy, bz));
+        __m128 cx = _mm_sub_ps(
+            _mm_sub_ps(_mm_loadu_ps(lanes[2][0]), ox), _mm_mul_ps(sx, cz));
+        __m128 cy = _mm_sub_ps(
+            _mm_sub_ps(_mm_loadu_ps(lanes[2][1]), oy), _mm_mul_ps(sy, cz));
+        __m128 u = _mm_sub_ps(_mm_mul_ps(cx, by), _mm_mul_ps(cy, bx));
+        __m128 v = _mm_sub_ps(_mm_mul_ps(ax, cy), _mm_mul_ps(ay, cx));
+        __m128 w = _mm_sub_ps(_mm_mul_ps(bx, ay), _mm_mul_ps(by, ax));
+        __m128 on_edge = _mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(u, zero),
+            _mm_cmpeq_ps(v, zero)), _mm_cmpeq_ps(w, zero));
+        __m128 negative = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(u, zero),
+            _mm_cmplt_ps(v, zero)), _mm_cmplt_ps(w, zero));
+        __m128 positive = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(u, zero),
+            _mm_cmpgt_ps(v, zero)), _mm_cmpgt_ps(w, zero));
+        __m128 det = _mm_add_ps(_mm_add_ps(u, v), w);
+        __m128 t = _mm_div_ps(
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(u, _mm_mul_ps(sz, az)),
+                           _mm_mul_ps(v, _mm_mul_ps(sz, bz))),
+                _mm_mul_ps(w, _mm_mul_ps(sz, cz))),
+            det);
+        __m128 hit = _mm_andnot_ps(
+            _mm_and_ps(negative, positive), _mm_cmpneq_ps(det, zero));
+        hit = _mm_and_ps(hit, _mm_cmpgt_ps(t, zero));
+        hit = _mm_and_ps(hit, _mm_cmplt_ps(t, _mm_set1_ps(*t_max)));
+        hit = _mm_andnot_ps(on_edge, hit);
+        int live = (1 << n) - 1;
+        int hit_mask = _mm_movemask_ps(hit) & live;
+        int edge_mask = _mm_movemask_ps(on_edge) & live;
+        if ((hit_mask | edge_mask) == 0) {
+            continue;
+        }
+        f32 ts[4];
+        _mm_storeu_ps(ts, t);
+        for (u32 j = 0; j < n; j++) {
+            if (hit_mask & (1 << j)) {
+                if (ts[j] < *t_max) {
+                    *t_max = ts[j];
+                    best = i + j;
+                }
+                continue;
+            }
+            f32 edge_t;
+            if ((edge_mask & (1 << j)) &&
+                mesh_triangle_hit(mesh, i + j, r, *t_max, &edge_t)) {
+                *t_max = edge_t;
+                best = i + j;
+            }
+        }
+    }
+    return best;
+}
+
+#endif
+
+static MeshKernelFn mesh_intersect_n = mesh_intersect_n_scalar;
+
+void mesh_select_kernel(SimdLevel level) {
+    mesh_intersect_n = mesh_intersect_n_scalar;
+#ifdef SIMD_X86
+    // Leaves hold four triangles, so wider vectors would mostly idle.
+    if (level >= SIMD_SSE42) {
+        mesh_intersect_n = mesh_intersect_n_sse42;
+    }
+#endif
+}
+
+typedef struct _MeshBoundsTask {
+    Mesh *mesh;
+    AABB *bounds;
+    Vec3 *centroids;
+} MeshBoundsTask;
+
+static void mesh_bounds_task(u32 begin, u32 end, void *ctx) {
+    MeshBoundsTask *task = (MeshBoundsTask *)ctx;
+    Mesh *mesh = task->mesh;
+    for (u32 i = begin; i < end; i++) {
+        AABB box = aabb_empty();
+        for (u32 k = 0; k < 3; k++) {
+            const f32 *p = &mesh->positions[3 * mesh->indices[3 * i + k]];
+            box = aabb_grow(box, vec3(p[0], p[1], p[2]));
+        }
+        task->bounds[i] = box;
+        task->centroids[i] = aabb_centroid(box);
+    }
+}
+
+Mesh *new_mesh(f32 *positions, u32 vertex_count, u32 *indices,
+    u32 triangle_count, Color color, u32 threads) {
+    Mesh *mesh = malloc(sizeof(Mesh));
+    if (mesh == NULL) {
+        failwith("new_mesh: could not allocate memory!\n");
+    }
+    mesh->positions = positions;
+    mesh->indices = indices;
+    mesh->vertex_count = vertex_count;
+    mesh->triangle_count = triangle_count;
+    mesh->color = color;
+
+    AABB *bounds = malloc(sizeof(AABB) * (triangle_count + 1));
+    Vec3 *centroids = malloc(sizeof(Vec3) * (triangle_count + 1));
+    u32 *order = malloc(sizeof(u32) * (triangle_count + 1));
+    if (bounds == NULL || centroids == NULL || order == NULL) {
+        failwithf("new_mesh: could not allocate build memory for %u "
+                  "triangles!\n",
+            triangle_count);
+    }
+    MeshBoundsTask task = {
+        .mesh = mesh, .bounds = bounds, .centroids = centroids};
+    parallel_for(threads, triangle_count, MESH_BOUNDS_CHUNK, mesh_bounds_task,
+        &task);
+    mesh->nodes = bvh_build_nodes(bounds, centroids, triangle_count,
+        MESH_LEAF_SIZE, threads, order, &mesh->node_count);
+
+    // Store triangles in leaf order, so leaves read them contiguously.
+    u32 *sorted = malloc(sizeof(u32) * 3 * (triangle_count + 1));
+    if (sorted == NULL) {
+        failwithf("new_mesh: could not allocate memory for %u triangles!\n",
+            triangle_count);
+    }
+    for (u32 i = 0; i < triangle_count; i++) {
+        memcpy(&sorted[3 * i], &indices[3 * order[i]], sizeof(u32) * 3);
+    }
+    free(indices);
+    mesh->indices = sorted;
+    free(bounds);
+    free(centroids);
+    free(order);
+    return mesh;
+}
+
+/**
+ * @brief Find the closest triangle hit by a ray, visiting nodes
+ * front-to-back, the same way as bvh_closest.
+ *
+ * @return u32 The triangle, in leaf order, or MESH_MISS.
+ */
+static u32 mesh_closest(Mesh *mesh, Ray *ray, f32 *t) {
+    u32 closest = MESH_MISS;
+    *t = FLT_MAX;
+    MeshRay r;
+    mesh_ray_setup(&r, ray);
+    f32 t_near;
+    if (mesh->triangle_count == 0 ||
+        !aabb_hit(&mesh->nodes[0].bounds, r.origin, r.inv_dir, *t, &t_near)) {
+        return closest;
+    }
+    u32 stack[BVH_MAX_DEPTH];
+    f32 stack_t[BVH_MAX_DEPTH];
+    u32 sp = 0;
+    BVHNode *node = &mesh->nodes[0];
+    while (true) {
+        if (node->count > 0) {
+            u32 hit = mesh_intersect_n(
+                mesh, node->left_first, node->count, &r, t);
+            if (hit != MESH_MISS) {
+                closest = hit;
+            }
+        } else {
+            BVHNode *left = &mesh->nodes[node->left_first];
+            BVHNode *right = left + 1;
+            f32 t_left, t_right;
+            bool hit_left =
+                aabb_hit(&left->bounds, r.origin, r.inv_dir, *t, &t_left);
+            bool hit_right =
+                aabb_hit(&right->bounds, r.origin, r.inv_dir, *t, &t_right);
+            if (hit_left && hit_right) {
+                if (t_right < t_left) {
+                    stack[sp] = node->left_first;
+                    stack_t[sp++] = t_left;
+                    node = right;
+                } else {
+                    stack[sp] = node->left_first + 1;
+                    stack_t[sp++] = t_right;
+                    node = left;
+                }
+                continue;
+            }
+            if (hit_left) {
+                node = left;
+                continue;
+            }
+            if (hit_right) {
+                node = right;
+                continue;
+            }
+        }
+        node = NULL;
+        while (sp > 0) {
+            sp--;
+            if (stack_t[sp] <= *t) {
+                node = &mesh->nodes[stack[sp]];
+                break;
+            }
+        }
+        if (node == NULL) {
+            break;
+        }
+    }
+    return closest;
+}
+
+f32 mesh_distance(Mesh *mesh, Ray *ray) {
+    f32 t;
+    return mesh_closest(mesh, ray, &t) != MESH_MISS ? t : INFINITY;
+}
+
+HitOption mesh_intersect(Mesh *mesh, Ray *ray) {
+    f32 t;
+    u32 tri = mesh_closest(mesh, ray, &t);
+    if (tri == MESH_MISS) {
+        return no_Hit();
+    }
+    Vec3 corners[3];
+    for (u32 k = 0; k < 3; k++) {
+        const f32 *p = &mesh->positions[3 * mesh->indices[3 * tri + k]];
+        corners[k] = vec3(p[0], p[1], p[2]);
+    }
+    Vec3 normal = norm(cross(
+        vsub(corners[1], corners[0]), vsub(corners[2], corners[0])));
+    if (dot(normal, ray->direction) > 0.0f) {
+        normal = smul(normal, -1.0f);
+    }
+    return some_Hit((Hit){
+        .color = mesh->color,
+        .distance = t,
+        .position = vadd(ray->origin, smul(ray->direction, t)),
+        .norm = normal,
+    });
+}
+
+bool mesh_occluded(Mesh *mesh, Ray *ray, f32 t_max) {
+    if (mesh->triangle_count == 0) {
+        return false;
+    }
+    MeshRay r;
+    mesh_ray_setup(&r, ray);
+    u32 stack[BVH_MAX_DEPTH + 1];
+    u32 sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0) {
+        BVHNode *node = &mesh->nodes[stack[--sp]];
+        f32 t_near;
+        if (!aabb_hit(&node->bounds, r.origin, r.inv_dir, t_max, &t_near)) {
+            continue;
+        }
+        if (node->count > 0) {
+            f32 t = t_max;
+            if (mesh_intersect_n(mesh, node->left_first, node->count, &r, &t) !=
+                MESH_MISS) {
+                return true;
+            }
+            continue;
+        }
+        stack[sp++] = node->left_first + 1;
+        stack[sp++] = node->left_first;
+    }
+    return false;
+}
+
+AABB mesh_bounds(Mesh *mesh) {
+    return mesh->nodes[0].bounds;
+}
+
+void destroy_mesh(Mesh *mesh) {
+    free(mesh->positions);
+    free(mesh->indices);
+    free(mesh->nodes);
+    free(mesh);
+}
+
+/**
+ * A run of whole lines of an OBJ file. The first pass counts what each chunk
+ * holds, so that the second can write it straight to its place.
+ */
+typedef struct _MeshChunk {
+    const char *begin;
+    const char *end;
+    u32 vertex_count;
+    u32 triangle_count;
+    u32 first_vertex;
+    u32 first_triangle;
+    bool bad_index;
+} MeshChunk;
+
+typedef struct _MeshLoader {
+    MeshChunk *chunks;
+    f32 *positions;
+    u32 *indices;
+    u32 vertex_count;
+    Vec3 translation;
+    f32 scale;
+} MeshLoader;
+
+static const f64 mesh_powers_of_ten[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6,
+    1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+    1e20, 1e21, 1e22};
+
+static bool mesh_is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char *mesh_skip_blanks(const char *p, const char *end) {
+    while (p < end && mesh_is_blank(*p)) {
+        p++;
+    }
+    return p;
+}
+
+static const char *mesh_skip_token(const char *p, const char *end) {
+    while (p < end && !mesh_is_blank(*p) && *p != '\n') {
+        p++;
+    }
+    return p;
+}
+
+static const char *mesh_next_line(const char *p, const char *end) {
+    const char *newline = memchr(p, '\n', end - p);
+    return newline != NULL ? newline + 1 : end;
+}
+
+// Whether p starts a line of the given one letter kind, such as "v 1 2 3".
+static bool mesh_line_is(const char *p, const char *end, char kind) {
+    return end - p >= 2 && p[0] == kind && mesh_is_blank(p[1]);
+}
+
+static const char *mesh_parse_f32(const char *p, const char *end, f32 *out) {
+    p = mesh_skip_blanks(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    // Digits past what a u64 holds exactly only move the exponent.
+    u64 mantissa = 0;
+    i32 exponent = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (mantissa < 100000000000000000ull) {
+            mantissa = mantissa * 10 + (u64)(*p - '0');
+        } else {
+            exponent++;
+        }
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (mantissa < 100000000000000000ull) {
+                mantissa = mantissa * 10 + (u64)(*p - '0');
+                exponent--;
+            }
+            p++;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool negative_exponent = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative_exponent = *p == '-';
+            p++;
+        }
+        i32 e = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (e < 10000) {
+                e = e * 10 + (*p - '0');
+            }
+            p++;
+        }
+        exponent += negative_exponent ? -e : e;
+    }
+    f64 value = (f64)mantissa;
+    u32 magnitude = (u32)(exponent < 0 ? -exponent : exponent);
+    f64 power = magnitude <= 22 ? mesh_powers_of_ten[magnitude]
+                                : pow(10.0, (f64)magnitude);
+    value = exponent < 0 ? value / power : value * power;
+    *out = (f32)(negative ? -value : value);
+    return mesh_skip_token(p, end);
+}
+
+// Parse one corner of a face, such as "3", "-1", "3/7" or "3//2", keeping
+// only the vertex index.
+static const char *mesh_parse_corner(const char *p, const char *end, i64 *out) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    i64 index = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (index < 0xFFFFFFFFll) {
+            index = index * 10 + (*p - '0');
+        }
+        p++;
+    }
+    *out = negative ? -index : index;
+    return mesh_skip_token(p, end);
+}
+
+static bool mesh_at_line_end(const char *p, const char *end) {
+    return p >= end || *p == '\n' || *p == '#';
+}
+
+static void mesh_count_task(u32 begin, u32 end, void *ctx) {
+    MeshLoader *loader = (MeshLoader *)ctx;
+    for (u32 i = begin; i < end; i++) {
+        MeshChunk *chunk = &loader->chunks[i];
+        const char *p = chunk->begin;
+        while (p < chunk->end) {
+            p = mesh_skip_blanks(p, chunk->end);
+            if (mesh_line_is(p, chunk->end, 'v')) {
+                chunk->vertex_count++;
+            } else if (mesh_line_is(p, chunk->end, 'f')) {
+                u32 corners = 0;
+                p++;
+                while (true) {
+                    p = mesh_skip_blanks(p, chunk->end);
+                    if (mesh_at_line_end(p, chunk->end)) {
+                        break;
+                    }
+                    corners++;
+                    p = mesh_skip_token(p, chunk->end);
+                }
+                chunk->triangle_count += corners >= 3 ? corners - 2 : 0;
+            }
+            p = mesh_next_line(p, chunk->end);
+        }
+    }
+}
+
+static void mesh_parse_task(u32 begin, u32 end, void *ctx) {
+    MeshLoader *loader = (MeshLoader *)ctx;
+    for (u32 i = begin; i < end; i++) {
+        MeshChunk *chunk = &loader->chunks[i];
+        f32 *position = &loader->positions[3 * (u64)chunk->first_vertex];
+        u32 *index = &loader->indices[3 * (u64)chunk->first_triangle];
+        // Negative indices count back from the last vertex so far.
+        i64 seen = chunk->first_vertex;
+        const char *p = chunk->begin;
+        while (p < chunk->end) {
+            p = mesh_skip_blanks(p, chunk->end);
+            if (mesh_line_is(p, chunk->end, 'v')) {
+                f32 xyz[3];
+                p++;
+                for (u32 axis = 0; axis < 3; axis++) {
+                    p = mesh_parse_f32(p, chunk->end, &xyz[axis]);
+                }
+                *position++ = xyz[0] * loader->scale + loader->translation.x;
+                *position++ = xyz[1] * loader->scale + loader->translation.y;
+                *position++ = xyz[2] * loader->scale + loader->translation.z;
+                seen++;
+            } else if (mesh_line_is(p, chunk->end, 'f')) {
+                u32 corners = 0;
+                u32 fan_first = 0;
+                u32 fan_last = 0;
+                p++;
+                while (true) {
+                    p = mesh_skip_blanks(p, chunk->end);
+                    if (mesh_at_line_end(p, chunk->end)) {
+                        break;
+                    }
+                    i64 corner;
+                    p = mesh_parse_corner(p, chunk->end, &corner);
+                    // Indices start at 1, so 0 refers to no vertex at all.
+                    bool valid = corner != 0;
+                    corner = corner > 0 ? corner - 1 : seen + corner;
+                    if (!valid || corner < 0 ||
+                        corner >= loader->vertex_count) {
+                        chunk->bad_index = true;
+                        corner = 0;
+                    }
+                    if (corners == 0) {
+                        fan_first = (u32)corner;
+                    } else if (corners >= 2) {
+                        *index++ = fan_first;
+                        *index++ = fan_last;
+                        *index++ = (u32)corner;
+                    }
+                    fan_last = (u32)corner;
+                    corners++;
+                }
+            }
+            p = mesh_next_line(p, chunk->end);
+        }
+    }
+}
+
+Mesh *load_mesh(const char *path, Vec3 translation, f32 scale, Color color,
+    u32 threads) {
+    size_t size;
+    char *data = map_file(path, &size);
+    const char *end = data + size;
+
+    // Chunks end after a newline, so no line is split between two of them.
+    u32 chunk_count = (u32)(size / MESH_CHUNK_BYTES) + 1;
+    MeshChunk *chunks = calloc(chunk_count, sizeof(MeshChunk));
+    if (chunks == NULL) {
+        failwithf("load_mesh: could not allocate %u chunks!\n", chunk_count);
+    }
+    const char *p = data;
+    for (u32 i = 0; i < chunk_count; i++) {
+        chunks[i].begin = p;
+        if (i + 1 < chunk_count) {
+            const char *target = data + (u64)(i + 1) * MESH_CHUNK_BYTES;
+            p = target > p ? mesh_next_line(target, end) : p;
+        } else {
+            p = end;
+        }
+        chunks[i].end = p;
+    }
+
+    MeshLoader loader = {
+        .chunks = chunks,
+        .translation = translation,
+        .scale = scale,
+    };
+    parallel_for(threads, chunk_count, 1, mesh_count_task, &loader);
+    u64 vertex_count = 0;
+    u64 triangle_count = 0;
+    for (u32 i = 0; i < chunk_count; i++) {
+        chunks[i].first_vertex = (u32)vertex_count;
+        chunks[i].first_triangle = (u32)triangle_count;
+        vertex_count += chunks[i].vertex_count;
+        triangle_count += chunks[i].triangle_count;
+    }
+    if (triangle_count == 0) {
+        failwithf("load_mesh: '%s' has no faces!\n", path);
+    }
+    if (vertex_count > 0xFFFFFFFFull || triangle_count > 0x3FFFFFFFull) {
+        failwithf("load_mesh: '%s' is too big!\n", path);
+    }
+    loader.vertex_count = (u32)vertex_count;
+    loader.positions = malloc(sizeof(f32) * 3 * vertex_count);
+    loader.indices = malloc(sizeof(u32) * 3 * triangle_count);
+    if (loader.positions == NULL || loader.indices == NULL) {
+        failwithf("load_mesh: could not allocate memory for %llu triangles!\n",
+            (unsigned long long)triangle_count);
+    }
+    parallel_for(threads, chunk_count, 1, mesh_parse_task, &loader);
+    for (u32 i = 0; i < chunk_count; i++) {
+        if (chunks[i].bad_index) {
+            failwithf("load_mesh: '%s' has a face with a vertex index out of "
+                      "range!\n",
+                path);
+        }
+    }
+    free(chunks);
+    unmap_file(data, size);
+    return new_mesh(loader.positions, (u32)vertex_count, loader.indices,
+        (u32)triangle_count, color, threads);
+}
@@ -0,0 +1,92 @@
+#ifndef MESH_H
+#define MESH_H
+/**
+ * @file mesh.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief Triangle meshes, loaded from Wavefront OBJ files, each with a
+ * hierarchy of its own over its triangles.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#include "aabb.h"
+#include "bvh.h"
+#include "color.h"
+#include "hit.h"
+#include "ray.h"
+#include "simd.h"
+#include "vec3.h"
+
+#define MESH_LEAF_SIZE 4
+#define MESH_MISS 0xFFFFFFFFu
+
+/**
+ * @brief Vertices are shared between triangles, three floats each, and each
+ * triangle is three indices into them. Triangles are stored in the leaf order
+ * of the hierarchy, so a leaf's triangles are contiguous.
+ */
+typedef struct _Mesh {
+    f32 *positions;
+    u32 *indices;
+    u32 vertex_count;
+    u32 triangle_count;
+    BVHNode *nodes;
+    u32 node_count;
+    Color color;
+} Mesh;
+
+/**
+ * @brief Make a mesh of the given triangles and build its hierarchy. The mesh
+ * takes over both arrays, and reorders the indices.
+ *
+ * @param positions Three floats per vertex.
+ * @param indices Three vertex indices per triangle.
+ * @param threads How many threads may help build the hierarchy.
+ */
+Mesh *new_mesh(f32 *positions, u32 vertex_count, u32 *indices,
+    u32 triangle_count, Color color, u32 threads);
+
+/**
+ * @brief Load a mesh from a Wavefront OBJ file. Only vertex positions and
+ * faces are read, faces with more than three corners are split into fans of
+ * triangles, and every other kind of line is skipped. The file is mapped into
+ * memory and parsed in parallel, one chunk of lines per task.
+ *
+ * @param translation Added to every vertex, after scaling.
+ * @param scale Every vertex is multiplied by this.
+ * @param threads How many threads may help parse and build.
+ */
+Mesh *load_mesh(const char *path, Vec3 translation, f32 scale, Color color,
+    u32 threads);
+
+/**
+ * @brief How far along a ray it hits the mesh, or INFINITY if it misses.
+ */
+f32 mesh_distance(Mesh *mesh, Ray *ray);
+
+/**
+ * @brief The closest hit of a ray with the mesh, with the triangle's normal
+ * turned towards where the ray came from.
+ */
+HitOption mesh_intersect(Mesh *mesh, Ray *ray);
+
+/**
+ * @brief Whether a ray hits any triangle of the mesh nearer than t_max.
+ */
+bool mesh_occluded(Mesh *mesh, Ray *ray, f32 t_max);
+
+AABB mesh_bounds(Mesh *mesh);
+
+/**
+ * @brief Pick the triangle test for a SIMD level. Until it is called, the
+ * scalar test is used.
+ */
+void mesh_select_kernel(SimdLevel level);
+
+void destroy_mesh(Mesh *mesh);
+
+#endif
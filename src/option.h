@@ -18,7 +18,7 @@ typedef enum __attribute__((packed)) _OptionType
 } OptionType;
 
 #define option_type(T)                                                                                                 \
-    typedef struct __attribute__((packed)) _##T##Option                                                                \
+    typedef struct _##T##Option                                                                                        \
     {                                                                                                                  \
         OptionType type;                                                                                               \
         T value;                                                                                                       \
@@ -0,0 +1,393 @@
+#include "parallel.h"
+#include "fail.h"
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+// glibc only declares the affinity calls and CPU_SET under _GNU_SOURCE, which
+// has to come before the first system header of the bundle, so from the build.
+#ifndef CPU_SET
+#error "Pinning threads needs the affinity calls; build with -D_GNU_SOURCE."
+#endif
+#elif defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#define NOGDI
+#include <windows.h>
+// The BVH traversals name their children near and far.
+#undef near
+#undef far
+#endif
+
+static void job_queue_init(JobQueue *queue) {
+    queue->capacity = 16;
+    queue->head = 0;
+    queue->count = 0;
+    queue->jobs = malloc(sizeof(PoolJob) * queue->capacity);
+    if (queue->jobs == NULL) {
+        failwith("job_queue_init: could not allocate memory!\n");
+    }
+}
+
+static void job_queue_push(JobQueue *queue, PoolJob job) {
+    if (queue->count == queue->capacity) {
+        PoolJob *jobs = malloc(sizeof(PoolJob) * queue->capacity * 2);
+        if (jobs == NULL) {
+            failwith("job_queue_push: could not grow the queue!\n");
+        }
+        for (u32 i = 0; i < queue->count; i++) {
+            jobs[i] = queue->jobs[(queue->head + i) % queue->capacity];
+        }
+        free(queue->jobs);
+        queue->jobs = jobs;
+        queue->head = 0;
+        queue->capacity *= 2;
+    }
+    queue->jobs[(queue->head + queue->count) % queue->capacity] = job;
+    queue->count++;
+}
+
+static PoolJob job_queue_pop(JobQueue *queue) {
+    PoolJob job = queue->jobs[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    return job;
+}
+
+// Take every queued job of fn on ctx out of the queue, keeping the others in
+// order, and return how many there were.
+static u32 job_queue_remove(JobQueue *queue, void (*fn)(void *ctx), void *ctx) {
+    u32 kept = 0;
+    for (u32 i = 0; i < queue->count; i++) {
+        PoolJob job = queue->jobs[(queue->head + i) % queue->capacity];
+        if (job.fn != fn || job.ctx != ctx) {
+            queue->jobs[(queue->head + kept) % queue->capacity] = job;
+            kept++;
+        }
+    }
+    u32 removed = queue->count - kept;
+    queue->count = kept;
+    return removed;
+}
+
+typedef struct _ParallelFor {
+    u32 count;
+    u32 chunk;
+    void (*fn)(u32 begin, u32 end, void *ctx);
+    void *ctx;
+    SDL_atomic_t next;
+    // The pool lending a hand, and how many of its jobs are queued or running
+    // for this loop, under the pool's lock.
+    ThreadPool *pool;
+    u32 helpers;
+} ParallelFor;
+
+// The pool parallel_for borrows its helpers from, see parallel_use_pool.
+static ThreadPool *helper_pool = NULL;
+
+static int parallel_for_worker(void *args) {
+    ParallelFor *pf = (ParallelFor *)args;
+    while (true) {
+        u32 begin = (u32)SDL_AtomicAdd(&pf->next, (int)pf->chunk);
+        if (begin >= pf->count) {
+            break;
+        }
+        u32 end = begin + pf->chunk < pf->count ? begin + pf->chunk : pf->count;
+        pf->fn(begin, end, pf->ctx);
+    }
+    return 0;
+}
+
+static void parallel_for_helper(void *args) {
+    ParallelFor *pf = (ParallelFor *)args;
+    parallel_for_worker(pf);
+    SDL_LockMutex(pf->pool->lock);
+    // The loop may be gone once this is down to zero, so nothing after it
+    // touches pf.
+    pf->helpers--;
+    SDL_CondBroadcast(pf->pool->idle);
+    SDL_UnlockMutex(pf->pool->lock);
+}
+
+// Run the loop with up to helpers jobs on the pool besides the caller. Once
+// the caller runs out of chunks, it takes back the jobs no worker has picked
+// up yet and only waits for those that have, so a loop started from a pool
+// worker cannot wait on itself.
+static void parallel_for_pooled(
+    ThreadPool *pool, ParallelFor *pf, u32 helpers) {
+    pf->pool = pool;
+    SDL_LockMutex(pool->lock);
+    for (u32 i = 0; i < helpers; i++) {
+        job_queue_push(&pool->queue,
+            (PoolJob){.fn = parallel_for_helper, .ctx = pf});
+    }
+    pool->pending += helpers;
+    pf->helpers = helpers;
+    SDL_CondBroadcast(pool->work);
+    SDL_UnlockMutex(pool->lock);
+
+    parallel_for_worker(pf);
+
+    SDL_LockMutex(pool->lock);
+    u32 unstarted = job_queue_remove(&pool->queue, parallel_for_helper, pf);
+    pf->helpers -= unstarted;
+    pool->pending -= unstarted;
+    if (pool->pending == 0) {
+        SDL_CondBroadcast(pool->idle);
+    }
+    while (pf->helpers > 0) {
+        SDL_CondWait(pool->idle, pool->lock);
+    }
+    SDL_UnlockMutex(pool->lock);
+}
+
+void parallel_for(u32 threads, u32 count, u32 chunk,
+    void (*fn)(u32 begin, u32 end, void *ctx), void *ctx) {
+    if (chunk == 0) {
+        chunk = 1;
+    }
+    u32 chunks = (count + chunk - 1) / chunk;
+    if (threads > chunks) {
+        threads = chunks;
+    }
+    ParallelFor pf = {.count = count, .chunk = chunk, .fn = fn, .ctx = ctx};
+    SDL_AtomicSet(&pf.next, 0);
+    if (threads <= 1) {
+        parallel_for_worker(&pf);
+        return;
+    }
+    if (helper_pool != NULL) {
+        u32 helpers = threads - 1 < helper_pool->threads
+                          ? threads - 1
+                          : helper_pool->threads;
+        parallel_for_pooled(helper_pool, &pf, helpers);
+        return;
+    }
+    SDL_Thread **helpers = malloc(sizeof(SDL_Thread *) * (threads - 1));
+    if (helpers == NULL) {
+        failwith("parallel_for: could not allocate helper threads!\n");
+    }
+    for (u32 i = 0; i < threads - 1; i++) {
+        helpers[i] = SDL_CreateThread(parallel_for_worker, "HELPER", &pf);
+    }
+    parallel_for_worker(&pf);
+    for (u32 i = 0; i < threads - 1; i++) {
+        SDL_WaitThread(helpers[i], NULL);
+    }
+    free(helpers);
+}
+
+void atomic_max(SDL_atomic_t *a, int value) {
+    int current = SDL_AtomicGet(a);
+    while (current < value && !SDL_AtomicCAS(a, current, value)) {
+        current = SDL_AtomicGet(a);
+    }
+}
+
+static int thread_pool_worker(void *args) {
+    PoolWorker *worker = (PoolWorker *)args;
+    ThreadPool *pool = worker->pool;
+    bool pinned = false;
+    if (pool->pin) {
+        u32 cpu = pool->cpus[worker->index % pool->cpu_total];
+        pinned = pin_current_thread(cpu);
+        if (!pinned) {
+            fprintf(stderr, "Could not pin pool worker %u to CPU %u.\n",
+                worker->index, cpu);
+        }
+    }
+    SDL_LockMutex(pool->lock);
+    pool->started++;
+    pool->pinned += pinned;
+    SDL_CondBroadcast(pool->idle);
+    while (true) {
+        while (worker->queue.count == 0 && pool->queue.count == 0 &&
+               !pool->stopping) {
+            SDL_CondWait(pool->work, pool->lock);
+        }
+        if (worker->queue.count == 0 && pool->queue.count == 0) {
+            break;
+        }
+        PoolJob job = worker->queue.count > 0 ? job_queue_pop(&worker->queue)
+                                              : job_queue_pop(&pool->queue);
+        SDL_UnlockMutex(pool->lock);
+        job.fn(job.ctx);
+        SDL_LockMutex(pool->lock);
+        if (--pool->pending == 0) {
+            SDL_CondBroadcast(pool->idle);
+        }
+    }
+    SDL_UnlockMutex(pool->lock);
+    return 0;
+}
+
+// The CPUs the process may run on, in order, which is fewer than are online
+// when it is started under taskset or in a cpuset. Where the affinity mask
+// cannot be read, every online CPU.
+static u32 *allowed_cpus(u32 *count) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+        u32 *cpus = malloc(sizeof(u32) * CPU_COUNT(&set));
+        if (cpus == NULL) {
+            failwith("allowed_cpus: could not allocate memory!\n");
+        }
+        u32 n = 0;
+        for (u32 cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus[n++] = cpu;
+            }
+        }
+        *count = n;
+        return cpus;
+    }
+#elif defined(_WIN32)
+    DWORD_PTR process_mask;
+    DWORD_PTR system_mask;
+    if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask,
+            &system_mask) && process_mask != 0) {
+        u32 bits = sizeof(DWORD_PTR) * 8;
+        u32 *cpus = malloc(sizeof(u32) * bits);
+        if (cpus == NULL) {
+            failwith("allowed_cpus: could not allocate memory!\n");
+        }
+        u32 n = 0;
+        for (u32 cpu = 0; cpu < bits; cpu++) {
+            if (process_mask >> cpu & 1) {
+                cpus[n++] = cpu;
+            }
+        }
+        *count = n;
+        return cpus;
+    }
+#endif
+    u32 n = online_cpu_count();
+    u32 *cpus = malloc(sizeof(u32) * n);
+    if (cpus == NULL) {
+        failwith("allowed_cpus: could not allocate memory!\n");
+    }
+    for (u32 cpu = 0; cpu < n; cpu++) {
+        cpus[cpu] = cpu;
+    }
+    *count = n;
+    return cpus;
+}
+
+ThreadPool *new_thread_pool(u32 threads, bool pin) {
+    ThreadPool *pool = malloc(sizeof(ThreadPool));
+    if (pool == NULL) {
+        failwith("new_thread_pool: could not allocate memory!\n");
+    }
+    pool->threads = threads > 0 ? threads : 1;
+    pool->pending = 0;
+    pool->started = 0;
+    pool->pinned = 0;
+    pool->pin = pin;
+    pool->cpus = pin ? allowed_cpus(&pool->cpu_total) : NULL;
+    pool->stopping = false;
+    job_queue_init(&pool->queue);
+    pool->workers = malloc(sizeof(PoolWorker) * pool->threads);
+    pool->lock = SDL_CreateMutex();
+    pool->work = SDL_CreateCond();
+    pool->idle = SDL_CreateCond();
+    if (pool->workers == NULL || pool->lock == NULL || pool->work == NULL ||
+        pool->idle == NULL) {
+        failwith("new_thread_pool: could not allocate memory!\n");
+    }
+    for (u32 i = 0; i < pool->threads; i++) {
+        PoolWorker *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        job_queue_init(&worker->queue);
+    }
+    for (u32 i = 0; i < pool->threads; i++) {
+        pool->workers[i].thread =
+            SDL_CreateThread(thread_pool_worker, "POOL", &pool->workers[i]);
+    }
+    // Wait for the workers to have tried pinning, so pinned can be reported.
+    SDL_LockMutex(pool->lock);
+    while (pool->started < pool->threads) {
+        SDL_CondWait(pool->idle, pool->lock);
+    }
+    SDL_UnlockMutex(pool->lock);
+    return pool;
+}
+
+void thread_pool_submit(ThreadPool *pool, void (*fn)(void *ctx), void *ctx) {
+    SDL_LockMutex(pool->lock);
+    job_queue_push(&pool->queue, (PoolJob){.fn = fn, .ctx = ctx});
+    pool->pending++;
+    SDL_CondSignal(pool->work);
+    SDL_UnlockMutex(pool->lock);
+}
+
+void thread_pool_submit_to(ThreadPool *pool, u32 worker,
+    void (*fn)(void *ctx), void *ctx) {
+    SDL_LockMutex(pool->lock);
+    job_queue_push(&pool->workers[worker % pool->threads].queue,
+        (PoolJob){.fn = fn, .ctx = ctx});
+    pool->pending++;
+    // The sleepers share one condition, so wake them all to reach this one.
+    SDL_CondBroadcast(pool->work);
+    SDL_UnlockMutex(pool->lock);
+}
+
+void thread_pool_wait(ThreadPool *pool) {
+    SDL_LockMutex(pool->lock);
+    while (pool->pending > 0) {
+        SDL_CondWait(pool->idle, pool->lock);
+    }
+    SDL_UnlockMutex(pool->lock);
+}
+
+void parallel_use_pool(ThreadPool *pool) {
+    helper_pool = pool;
+}
+
+void destroy_thread_pool(ThreadPool *pool) {
+    SDL_LockMutex(pool->lock);
+    pool->stopping = true;
+    SDL_CondBroadcast(pool->work);
+    SDL_UnlockMutex(pool->lock);
+    for (u32 i = 0; i < pool->threads; i++) {
+        SDL_WaitThread(pool->workers[i].thread, NULL);
+        free(pool->workers[i].queue.jobs);
+    }
+    SDL_DestroyCond(pool->idle);
+    SDL_DestroyCond(pool->work);
+    SDL_DestroyMutex(pool->lock);
+    free(pool->workers);
+    free(pool->queue.jobs);
+    free(pool->cpus);
+    free(pool);
+}
+
+u32 online_cpu_count() {
+    int count = SDL_GetCPUCount();
+#if defined(__linux__) && defined(_SC_NPROCESSORS_ONLN)
+    if (count < 1) {
+        count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+#endif
+    return count > 0 ? (u32)count : 1;
+}
+
+bool pin_current_thread(u32 cpu) {
+#if defined(__linux__)
+    if (cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+    if (cpu >= sizeof(DWORD_PTR) * 8) {
+        return false;
+    }
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
@@ -0,0 +1,147 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+/**
+ * @file parallel.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief Fork-join helpers for splitting work over several threads, and a pool
+ * of long-lived threads for work that comes back again and again.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#define SDL_MAIN_HANDLED
+#include <SDL2/SDL.h>
+#include "defs.h"
+
+/**
+ * @brief Split [0, count) into chunks and run fn over them on up to `threads`
+ * threads, including the calling one. Chunks are handed out from a shared
+ * counter, so uneven chunks even out. Returns when every chunk is done. The
+ * other threads are the workers of the pool given to parallel_use_pool, or
+ * threads started for the call if there is none.
+ *
+ * @param threads The most threads to use, 1 runs everything inline.
+ * @param count The number of items.
+ * @param chunk The number of items given to fn at a time.
+ * @param fn Called with the [begin, end) range of each chunk.
+ * @param ctx Passed along to fn.
+ */
+void parallel_for(u32 threads, u32 count, u32 chunk,
+    void (*fn)(u32 begin, u32 end, void *ctx), void *ctx);
+
+/**
+ * @brief A job for a thread pool, run once by whichever worker takes it.
+ */
+typedef struct _PoolJob {
+    void (*fn)(void *ctx);
+    void *ctx;
+} PoolJob;
+
+/**
+ * @brief A queue of jobs, as a ring buffer that doubles when it fills up.
+ */
+typedef struct _JobQueue {
+    PoolJob *jobs;
+    u32 capacity;
+    u32 head;
+    u32 count;
+} JobQueue;
+
+typedef struct _PoolWorker {
+    struct _ThreadPool *pool;
+    u32 index;
+    SDL_Thread *thread;
+    // Jobs for this worker alone, taken before the shared ones.
+    JobQueue queue;
+} PoolWorker;
+
+/**
+ * @brief Threads that stay around between jobs. Jobs wait in a shared queue
+ * or in the queue of one worker, and workers with nothing to do sleep on a
+ * condition variable until one comes.
+ */
+typedef struct _ThreadPool {
+    u32 threads;
+    PoolWorker *workers;
+    SDL_mutex *lock;
+    SDL_cond *work;
+    SDL_cond *idle;
+    JobQueue queue;
+    // Jobs queued or running, anywhere in the pool.
+    u32 pending;
+    // Workers that have started, and of those, how many were pinned.
+    u32 started;
+    u32 pinned;
+    bool pin;
+    // When pinning, the CPUs the workers are pinned to in turn.
+    u32 *cpus;
+    u32 cpu_total;
+    bool stopping;
+} ThreadPool;
+
+/**
+ * @brief Start a pool of threads, which sleep until jobs are submitted.
+ *
+ * @param pin Whether to pin worker i to the i-th CPU the process may run on,
+ * as its affinity mask was when the pool was made, wrapping around when there
+ * are more workers than CPUs. Supported on Linux and Windows; elsewhere the
+ * workers are left wherever the scheduler puts them. Returns once every worker
+ * has tried, with pinned counting those that succeeded.
+ */
+ThreadPool *new_thread_pool(u32 threads, bool pin);
+
+/**
+ * @brief Queue up fn(ctx) to run on one of the pool's threads. Jobs are taken
+ * in the order they are submitted; with several workers they may run at the
+ * same time and finish in any order.
+ */
+void thread_pool_submit(ThreadPool *pool, void (*fn)(void *ctx), void *ctx);
+
+/**
+ * @brief Like thread_pool_submit, but the job is run by one worker in
+ * particular, for work whose memory should stay with the same thread (and,
+ * when pinned, the same core) from one job to the next.
+ */
+void thread_pool_submit_to(ThreadPool *pool, u32 worker,
+    void (*fn)(void *ctx), void *ctx);
+
+/**
+ * @brief Wait until every job submitted so far has finished.
+ */
+void thread_pool_wait(ThreadPool *pool);
+
+/**
+ * @brief Have parallel_for borrow its helpers from a pool, rather than start
+ * and stop threads on every call. Builds call it several times per node near
+ * the top of a tree, which adds up. Pass NULL before destroying the pool.
+ */
+void parallel_use_pool(ThreadPool *pool);
+
+/**
+ * @brief Let the workers finish the jobs already queued, then stop them.
+ */
+void destroy_thread_pool(ThreadPool *pool);
+
+/**
+ * @brief How many CPUs are online, at least 1.
+ */
+u32 online_cpu_count();
+
+/**
+ * @brief Pin the calling thread to one CPU.
+ *
+ * @return bool Whether it worked; pinning is only supported on Linux and
+ * Windows.
+ */
+bool pin_current_thread(u32 cpu);
+
+/**
+ * @brief Atomically raise an SDL_atomic_t to value if it is lower.
+ */
+void atomic_max(SDL_atomic_t *a, int value);
+
+#endif
@@ -66,27 +66,122 @@ void parse_lights(Scene *scene, cJSON *root)
     }
 }
 
-void parse_shapes(Scene *scene, cJSON *root)
+Sphere *parse_sphere(cJSON *shape)
+{
+    cJSON *color = cJSON_GetObjectItem(shape, "color");
+    cJSON *radius = cJSON_GetObjectItem(shape, "radius");
+    cJSON *center = cJSON_GetObjectItem(shape, "center");
+    return new_sphere(parse_vec3(center), radius->valuedouble, parse_vec3(color));
+}
+
+void parse_groups(Scene *scene, cJSON *root)
+{
+    cJSON *groups = cJSON_GetObjectItem(root, "groups");
+    if (groups == NULL)
+    {
+        return;
+    }
+    // Every member of the groups object is a named list of spheres.
+    cJSON *members;
+    cJSON_ArrayForEach(members, groups)
+    {
+        if (scene_find_group(scene, members->string) != NULL) {
+            failwithf("Group '%s' is defined more than once!\n", members->string);
+        }
+        Group *group = new_group(members->string);
+        cJSON *shape;
+        cJSON_ArrayForEach(shape, members)
+        {
+            cJSON *type = cJSON_GetObjectItem(shape, "type");
+            if (strcmp(type->valuestring, "sphere") != 0) {
+                failwithf("Group '%s' can only hold spheres, not '%s'!\n", members->string, type->valuestring);
+            }
+            group_add_sphere(group, parse_sphere(shape));
+        }
+        scene_add_group(scene, group);
+    }
+}
+
+void parse_shapes(Scene *scene, cJSON *root, u32 threads)
 {
     cJSON *shapes = cJSON_GetObjectItem(root, "shapes");
     if (shapes == NULL)
     {
         return;
     }
-    u32 shapes_count = cJSON_GetArraySize(shapes);
-    for (int i = 0; i < shapes_count; i++)
+    // cJSON arrays are linked lists, so indexing them in a loop is quadratic.
+    cJSON *shape;
+    cJSON_ArrayForEach(shape, shapes)
     {
-        cJSON *shape = cJSON_GetArrayItem(shapes, i);
-
         cJSON *type = cJSON_GetObjectItem(shape, "type");
 
         if (strcmp(type->valuestring, "sphere") == 0) {
+            scene_add_sphere(scene, parse_sphere(shape));
+        }
+
+        if (strcmp(type->valuestring, "box") == 0) {
+            cJSON *color = cJSON_GetObjectItem(shape, "color");
+            cJSON *min = cJSON_GetObjectItem(shape, "min");
+            cJSON *max = cJSON_GetObjectItem(shape, "max");
+
+            Box *box = new_box(parse_vec3(min), parse_vec3(max), parse_vec3(color));
+            scene_add_shape(scene, new_box_shape(box));
+        }
+
+        if (strcmp(type->valuestring, "disc") == 0) {
             cJSON *color = cJSON_GetObjectItem(shape, "color");
-            cJSON *radius = cJSON_GetObjectItem(shape, "radius");
             cJSON *center = cJSON_GetObjectItem(shape, "center");
+            cJSON *normal = cJSON_GetObjectItem(shape, "normal");
+            cJSON *radius = cJSON_GetObjectItem(shape, "radius");
+
+            Disc *disc = new_disc(parse_vec3(center), parse_vec3(normal), radius->valuedouble, parse_vec3(color));
+            scene_add_shape(scene, new_disc_shape(disc));
+        }
+
+        if (strcmp(type->valuestring, "rect") == 0) {
+            cJSON *color = cJSON_GetObjectItem(shape, "color");
+            cJSON *corner = cJSON_GetObjectItem(shape, "corner");
+            cJSON *u = cJSON_GetObjectItem(shape, "u");
+            cJSON *v = cJSON_GetObjectItem(shape, "v");
+
+            Rect *rect = new_rect(parse_vec3(corner), parse_vec3(u), parse_vec3(v), parse_vec3(color));
+            scene_add_shape(scene, new_rect_shape(rect));
+        }
+
+        if (strcmp(type->valuestring, "mesh") == 0) {
+            cJSON *file = cJSON_GetObjectItem(shape, "file");
+            if (file == NULL || !cJSON_IsString(file)) {
+                failwith("Mesh has no file name!\n");
+            }
+            cJSON *color = cJSON_GetObjectItem(shape, "color");
+            cJSON *translation = cJSON_GetObjectItem(shape, "translation");
+            cJSON *scale = cJSON_GetObjectItem(shape, "scale");
+            Mesh *mesh = load_mesh(
+                file->valuestring,
+                translation != NULL ? parse_vec3(translation) : vec3(0.0, 0.0, 0.0),
+                scale != NULL ? scale->valuedouble : 1.0,
+                parse_vec3(color),
+                threads
+            );
+            scene_add_shape(scene, new_mesh_shape(mesh));
+        }
 
-            Sphere *sphere = new_sphere(parse_vec3(center), radius->valuedouble, parse_vec3(color));
-            scene_add_sphere(scene, sphere);
+        if (strcmp(type->valuestring, "instance") == 0) {
+            cJSON *name = cJSON_GetObjectItem(shape, "group");
+            if (name == NULL || !cJSON_IsString(name)) {
+                failwith("Instance has no group name!\n");
+            }
+            Group *group = scene_find_group(scene, name->valuestring);
+            if (group == NULL) {
+                failwithf("Instance refers to unknown group '%s'!\n", name->valuestring);
+            }
+            cJSON *translation = cJSON_GetObjectItem(shape, "translation");
+            cJSON *scale = cJSON_GetObjectItem(shape, "scale");
+            scene_add_instance(scene, new_instance(
+                group,
+                translation != NULL ? parse_vec3(translation) : vec3(0.0, 0.0, 0.0),
+                scale != NULL ? scale->valuedouble : 1.0
+            ));
         }
 
         if (strcmp(type->valuestring, "plane") == 0) {
@@ -100,7 +195,7 @@ void parse_shapes(Scene *scene, cJSON *root)
     }
 }
 
-Scene *parse_scene(char *path)
+Scene *parse_scene(char *path, u32 threads)
 {
     char *contents = read_file(path);
     cJSON *root = cJSON_Parse(contents);
@@ -117,7 +212,8 @@ Scene *parse_scene(char *path)
     Camera *camera = parse_camera(root);
     scene_set_camera(scene, camera);
     parse_lights(scene, root);
-    parse_shapes(scene, root);
+    parse_groups(scene, root);
+    parse_shapes(scene, root, threads);
     free(contents);
     return scene;
 }
\ No newline at end of file
@@ -14,6 +14,11 @@
 
 #include "scene.h"
 
-Scene *parse_scene(char *path);
+/**
+ * @brief Parse a scene file, along with the meshes it refers to.
+ *
+ * @param threads How many threads may help load meshes.
+ */
+Scene *parse_scene(char *path, u32 threads);
 
 #endif
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "plane.h"
 #include <math.h>
+#include "vec4.h"
 
 Plane * new_plane(Vec3 pivot, Vec3 normal, Color color) {
     Plane *plane = malloc(sizeof(Plane));
@@ -9,24 +10,36 @@ Plane * new_plane(Vec3 pivot, Vec3 normal, Color color) {
     return plane;
 }
 
-HitOption plane_intersect(Plane * plane, Ray * ray) {
-    f32 d = dot(plane->normal, ray->direction);
+f32 plane_distance(Plane * plane, Ray * ray) {
+    Vec3A normal = vec3a_load(plane->normal);
+    f32 d = dot3a(normal, vec3a_load(ray->direction));
     if (fabsf(d) < eps) {
-        return no_Hit();
+        return INFINITY;
     }
 
-    Vec3 pivot_minus_origin = vsub(plane->pivot, ray->origin);
-    f32 t = dot(pivot_minus_origin, plane->normal) / d;
+    Vec3A pivot_minus_origin =
+        vsub4(vec3a_load(plane->pivot), vec3a_load(ray->origin));
+    f32 t = dot3a(pivot_minus_origin, normal) / d;
+
+    return t < 0 ? INFINITY : t;
+}
 
-    if (t < 0) {
+HitOption plane_intersect(Plane * plane, Ray * ray) {
+    f32 t = plane_distance(plane, ray);
+    if (t == INFINITY) {
         return no_Hit();
     }
 
-    Vec3 hit_position = vadd(ray->origin, smul(ray->direction, t));
+    Vec3A origin = vec3a_load(ray->origin);
+    Vec3A hit_position = vadd4(origin, smul4(vec3a_load(ray->direction), t));
     return some_Hit((Hit) {
-        .distance = dist(ray->origin, hit_position),
-        .position = hit_position,
+        .distance = dist3a(origin, hit_position),
+        .position = vec3a_store(hit_position),
         .norm = plane->normal,
         .color = plane->color
     });
 }
+
+bool plane_occluded(Plane * plane, Ray * ray, f32 t_max) {
+    return plane_distance(plane, ray) < t_max;
+}
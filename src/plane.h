@@ -25,5 +25,16 @@ typedef struct _Plane {
 
 Plane *new_plane(Vec3 pivot, Vec3 normal, Color color);
 
+/**
+ * @brief How far along a ray it hits the plane, or INFINITY if it misses.
+ * Only the closest candidate needs plane_intersect.
+ */
+f32 plane_distance(Plane *plane, Ray *ray);
+
 HitOption plane_intersect(Plane *plane, Ray *ray);
+
+/**
+ * @brief Whether a ray hits the plane nearer than t_max.
+ */
+bool plane_occluded(Plane *plane, Ray *ray, f32 t_max);
 #endif
\ No newline at end of file
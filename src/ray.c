@@ -1,3 +1,113 @@
 #include "ray.h"
+#include "simd.h"
+#include <math.h>
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
 
+#define SLABS_TINY 1e-20f
 
+static f32 nudge_from_zero(f32 d) {
+    return fabsf(d) < SLABS_TINY ? copysignf(SLABS_TINY, d) : d;
+}
+
+Vec3 safe_inverse(Vec3 direction) {
+    return vec3(1.0f / nudge_from_zero(direction.x),
+        1.0f / nudge_from_zero(direction.y),
+        1.0f / nudge_from_zero(direction.z));
+}
+
+static u32 slabs4_scalar(const f32 *bounds, u32 stride, Vec3 origin,
+    Vec3 inv_dir, f32 t_max, f32 *t_near) {
+    u32 mask = 0;
+    for (u32 i = 0; i < 4; i++) {
+        f32 t0 = 0.0f;
+        f32 t1 = t_max;
+        for (u8 axis = 0; axis < 3; axis++) {
+            f32 o = vaxis(origin, axis);
+            f32 inv = vaxis(inv_dir, axis);
+            f32 ta = (bounds[axis * stride + i] - o) * inv;
+            f32 tb = (bounds[(axis + 3) * stride + i] - o) * inv;
+            f32 entry = ta < tb ? ta : tb;
+            f32 exit = ta < tb ? tb : ta;
+            t0 = entry > t0 || entry != entry ? entry : t0;
+            t1 = exit < t1 || exit != exit ? exit : t1;
+        }
+        t_near[i] = t0;
+        mask |= (t0 <= t1) << i;
+    }
+    return mask;
+}
+
+static u32 slabs8_pair(const f32 *bounds, u32 stride, Vec3 origin,
+    Vec3 inv_dir, f32 t_max, f32 *t_near) {
+    // Without eight-wide registers, test the two halves separately.
+    u32 lo = slabs4(bounds, stride, origin, inv_dir, t_max, t_near);
+    u32 hi = slabs4(bounds + 4, stride, origin, inv_dir, t_max, t_near + 4);
+    return lo | hi << 4;
+}
+
+#ifdef SIMD_X86
+
+SIMD_TARGET("sse4.2")
+static u32 slabs4_sse42(const f32 *bounds, u32 stride, Vec3 origin,
+    Vec3 inv_dir, f32 t_max, f32 *t_near) {
+    __m128 o[3] = {
+        _mm_set1_ps(origin.x), _mm_set1_ps(origin.y), _mm_set1_ps(origin.z)};
+    __m128 inv[3] = {_mm_set1_ps(inv_dir.x), _mm_set1_ps(inv_dir.y),
+        _mm_set1_ps(inv_dir.z)};
+    __m128 t0 = _mm_setzero_ps();
+    __m128 t1 = _mm_set1_ps(t_max);
+    for (u32 axis = 0; axis < 3; axis++) {
+        __m128 lo = _mm_loadu_ps(bounds + axis * stride);
+        __m128 hi = _mm_loadu_ps(bounds + (axis + 3) * stride);
+        __m128 ta = _mm_mul_ps(_mm_sub_ps(lo, o[axis]), inv[axis]);
+        __m128 tb = _mm_mul_ps(_mm_sub_ps(hi, o[axis]), inv[axis]);
+        // min and max return their second operand on NaN, so NaN boxes
+        // carry their NaN all the way to the compare below.
+        t0 = _mm_max_ps(t0, _mm_min_ps(tb, ta));
+        t1 = _mm_min_ps(t1, _mm_max_ps(tb, ta));
+    }
+    _mm_storeu_ps(t_near, t0);
+    return (u32)_mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+
+SIMD_TARGET("avx2")
+static u32 slabs8_avx2(const f32 *bounds, u32 stride, Vec3 origin,
+    Vec3 inv_dir, f32 t_max, f32 *t_near) {
+    __m256 o[3] = {_mm256_set1_ps(origin.x), _mm256_set1_ps(origin.y),
+        _mm256_set1_ps(origin.z)};
+    __m256 inv[3] = {_mm256_set1_ps(inv_dir.x), _mm256_set1_ps(inv_dir.y),
+        _mm256_set1_ps(inv_dir.z)};
+    __m256 t0 = _mm256_setzero_ps();
+    __m256 t1 = _mm256_set1_ps(t_max);
+    for (u32 axis = 0; axis < 3; axis++) {
+        __m256 lo = _mm256_loadu_ps(bounds + axis * stride);
+        __m256 hi = _mm256_loadu_ps(bounds + (axis + 3) * stride);
+        __m256 ta = _mm256_mul_ps(_mm256_sub_ps(lo, o[axis]), inv[axis]);
+        __m256 tb = _mm256_mul_ps(_mm256_sub_ps(hi, o[axis]), inv[axis]);
+        t0 = _mm256_max_ps(t0, _mm256_min_ps(tb, ta));
+        t1 = _mm256_min_ps(t1, _mm256_max_ps(tb, ta));
+    }
+    _mm256_storeu_ps(t_near, t0);
+    return (u32)_mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+
+#endif
+
+SlabsFn slabs4 = slabs4_scalar;
+SlabsFn slabs8 = slabs8_pair;
+
+void ray_select_kernels(SimdLevel level) {
+    slabs4 = slabs4_scalar;
+    slabs8 = slabs8_pair;
+#ifdef SIMD_X86
+    // Nodes are at most eight wide, so AVX-512 has nothing to add here.
+    if (level >= SIMD_SSE42) {
+        slabs4 = slabs4_sse42;
+    }
+    if (level >= SIMD_AVX2) {
+        slabs8 = slabs8_avx2;
+    }
+#endif
+}
@@ -12,14 +12,47 @@
  * 
  */
 
+#include "simd.h"
 #include "vec3.h"
 
-typedef struct __attribute__((packed)) _Ray
+typedef struct _Ray
 {
     Vec3 origin;
     Vec3 direction;
 } Ray;
 
-bool slabs(Vec3 p0, Vec3 p1, Ray ray);
+/**
+ * @brief The slab test against four boxes at once. The boxes are laid out as
+ * structure-of-arrays rows: min x, min y, min z, max x, max y, max z, with
+ * the four boxes side by side in each row. Boxes with NaN coordinates are
+ * never hit. Points at the version picked by ray_select_kernels.
+ *
+ * @param bounds The first row of the boxes.
+ * @param stride The distance in floats from one row to the next.
+ * @param origin The ray origin.
+ * @param inv_dir The reciprocal ray direction, which must not hold infinities.
+ * @param t_max Boxes entered beyond this distance are counted as misses.
+ * @param t_near Set to the entry distance of each box.
+ * @return u32 A bitmask of the boxes that were hit.
+ */
+typedef u32 (*SlabsFn)(const f32 *bounds, u32 stride, Vec3 origin,
+    Vec3 inv_dir, f32 t_max, f32 *t_near);
+extern SlabsFn slabs4;
+
+/**
+ * @brief Like slabs4, but for eight boxes.
+ */
+extern SlabsFn slabs8;
+
+/**
+ * @brief The reciprocal of a ray direction, with zero components nudged away
+ * from zero so that the slab tests never see 0 * infinity.
+ */
+Vec3 safe_inverse(Vec3 direction);
+
+/**
+ * @brief Point slabs4 and slabs8 at their versions for a SIMD level.
+ */
+void ray_select_kernels(SimdLevel level);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,55 @@
+#include "rect.h"
+#include "fail.h"
+#include <math.h>
+
+Rect *new_rect(Vec3 corner, Vec3 u, Vec3 v, Color color) {
+    Vec3 span = cross(u, v);
+    f32 area = mag(span);
+    if (area < eps) {
+        failwith("A rectangle's edges must not be parallel!\n");
+    }
+    Rect *rect = malloc(sizeof(Rect));
+    rect->corner = corner;
+    rect->u = u;
+    rect->v = v;
+    rect->normal = smul(span, 1.0f / area);
+    rect->inv_area = 1.0f / area;
+    rect->color = color;
+    return rect;
+}
+
+HitOption rect_intersect(Rect *rect, Ray *ray) {
+    f32 d = dot(rect->normal, ray->direction);
+    if (fabsf(d) < eps) {
+        return no_Hit();
+    }
+    f32 t = dot(vsub(rect->corner, ray->origin), rect->normal) / d;
+    if (t < 0.0f) {
+        return no_Hit();
+    }
+    Vec3 hit_position = vadd(ray->origin, smul(ray->direction, t));
+    Vec3 offset = vsub(hit_position, rect->corner);
+    // The hit's coordinates along u and v, as fractions of the edges.
+    f32 a = dot(cross(offset, rect->v), rect->normal) * rect->inv_area;
+    f32 b = dot(cross(rect->u, offset), rect->normal) * rect->inv_area;
+    if (a < 0.0f || a > 1.0f || b < 0.0f || b > 1.0f) {
+        return no_Hit();
+    }
+    return some_Hit((Hit){
+        .color = rect->color,
+        .distance = t,
+        .position = hit_position,
+        .norm = d > 0.0f ? smul(rect->normal, -1.0f) : rect->normal,
+    });
+}
+
+AABB rect_bounds(Rect *rect) {
+    AABB bounds = aabb_empty();
+    bounds = aabb_grow(bounds, rect->corner);
+    bounds = aabb_grow(bounds, vadd(rect->corner, rect->u));
+    bounds = aabb_grow(bounds, vadd(rect->corner, rect->v));
+    bounds = aabb_grow(bounds, vadd(vadd(rect->corner, rect->u), rect->v));
+    // Keep the box from being perfectly flat.
+    Vec3 pad = vec3(eps, eps, eps);
+    return (AABB){.min = vsub(bounds.min, pad), .max = vadd(bounds.max, pad)};
+}
@@ -0,0 +1,43 @@
+#ifndef RECT_H
+#define RECT_H
+/**
+ * @file rect.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief A module for flat rectangles, or any parallelogram.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#include "aabb.h"
+#include "color.h"
+#include "hit.h"
+#include "ray.h"
+#include "vec3.h"
+
+typedef struct _Rect {
+    Vec3 corner;
+    Vec3 u;
+    Vec3 v;
+    Vec3 normal;
+    f32 inv_area;
+    Color color;
+} Rect;
+
+/**
+ * @brief Make the rectangle spanned by two edges u and v from one corner.
+ */
+Rect *new_rect(Vec3 corner, Vec3 u, Vec3 v, Color color);
+
+/**
+ * @brief Compute the intersect between a rectangle and a ray. Rectangles are
+ * two-sided, the normal of a hit faces the ray.
+ */
+HitOption rect_intersect(Rect *rect, Ray *ray);
+
+AABB rect_bounds(Rect *rect);
+
+#endif
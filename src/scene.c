@@ -1,18 +1,18 @@
 #include "scene.h"
 #include "fail.h"
+#include "kdtree.h"
+#include "lbvh.h"
 #include "list.h"
+#include "vec4.h"
+#include <float.h>
+#include <string.h>
+#include <time.h>
 
 #ifndef SpherePtrList_T
 #define SpherePtrList_T
 
 typedef Sphere *SpherePtr;
 list_type(SpherePtr);
-#define sphere_by_x(sphere) (i32)((sphere->center.x)*2)
-#define sphere_by_y(sphere) (i32)((sphere->center.y)*2)
-#define sphere_by_z(sphere) (i32)((sphere->center.z)*2)
-list_define_sort_by(SpherePtr, x, sphere_by_x);
-list_define_sort_by(SpherePtr, y, sphere_by_y);
-list_define_sort_by(SpherePtr, z, sphere_by_z);
 
 #endif
 
@@ -23,6 +23,58 @@ list_type(Light);
 
 #endif
 
+#ifndef SpherePtrV3Tree_T
+#define SpherePtrV3Tree_T
+
+#define sphere_position(sphere) ((sphere)->center)
+define_V3Tree(SpherePtr, sphere_position, sphere_bounds);
+define_V3Tree_raycast(SpherePtr, sphere_distance);
+define_V3Tree_occlusion(SpherePtr, sphere_occluded);
+
+#endif
+
+#ifndef GroupPtrList_T
+#define GroupPtrList_T
+
+typedef Group *GroupPtr;
+list_type(GroupPtr);
+
+#endif
+
+#ifndef InstancePtrList_T
+#define InstancePtrList_T
+
+typedef Instance *InstancePtr;
+list_type(InstancePtr);
+
+#endif
+
+#ifndef InstancePtrV3Tree_T
+#define InstancePtrV3Tree_T
+
+define_V3Tree(InstancePtr, instance_position, instance_bounds);
+define_V3Tree_raycast(InstancePtr, instance_distance);
+define_V3Tree_occlusion(InstancePtr, instance_occluded);
+
+#endif
+
+#ifndef ShapePtrList_T
+#define ShapePtrList_T
+
+typedef Shape *ShapePtr;
+list_type(ShapePtr);
+
+#endif
+
+#ifndef ShapePtrV3Tree_T
+#define ShapePtrV3Tree_T
+
+define_V3Tree(ShapePtr, shape_position, shape_bounds);
+define_V3Tree_raycast(ShapePtr, shape_distance);
+define_V3Tree_occlusion(ShapePtr, shape_occluded);
+
+#endif
+
 #ifndef PlanePtrList_T
 #define PlanePtrList_T
 
@@ -43,6 +95,24 @@ typedef struct _Scene
     LightList *lights;
     SpherePtrList *spheres;
     PlanePtrList *planes;
+    ShapePtrList *shapes;
+    ShapePtrV3Tree *shape_tree;
+    GroupPtrList *groups;
+    InstancePtrList *instances;
+    InstancePtrV3Tree *instance_tree;
+    Accelerator accelerator;
+    u32 leaf_size;
+    // Counts the builds of the acceleration structures, so shadow caches can
+    // tell when what they point into has been freed.
+    u32 generation;
+    SphereStore *store;
+    BVH *bvh;
+    SpherePtrV3Tree *kdtree;
+    Grid *grid;
+    WBVH4 *wbvh4;
+    WBVH8 *wbvh8;
+    CBVH8 *cbvh8;
+    CBVH16 *cbvh16;
 } Scene;
 
 Scene *new_scene()
@@ -52,6 +122,22 @@ Scene *new_scene()
     s->lights = new_LightList(4);
     s->spheres = new_SpherePtrList(8);
     s->planes = new_PlanePtrList(3);
+    s->shapes = new_ShapePtrList(4);
+    s->shape_tree = NULL;
+    s->groups = new_GroupPtrList(4);
+    s->instances = new_InstancePtrList(8);
+    s->instance_tree = NULL;
+    s->accelerator = ACCEL_NONE;
+    s->leaf_size = BVH_DEFAULT_LEAF_SIZE;
+    s->generation = 0;
+    s->store = NULL;
+    s->bvh = NULL;
+    s->kdtree = NULL;
+    s->grid = NULL;
+    s->wbvh4 = NULL;
+    s->wbvh8 = NULL;
+    s->cbvh8 = NULL;
+    s->cbvh16 = NULL;
     return s;
 }
 
@@ -74,57 +160,586 @@ void scene_add_plane(Scene *scene, Plane *plane) {
     PlanePtrList_add(scene->planes, plane);
 }
 
-static HitOption cast_ray(Scene *scene, Ray *ray)
+void scene_add_shape(Scene *scene, Shape *shape)
 {
-    if (scene->camera == NULL) {
-        failwith("No camera set in scene, cannot cast rays!\n");
+    ShapePtrList_add(scene->shapes, shape);
+}
+
+void scene_add_group(Scene *scene, Group *group)
+{
+    GroupPtrList_add(scene->groups, group);
+}
+
+Group *scene_find_group(Scene *scene, const char *name)
+{
+    for (u32 i = 0; i < scene->groups->size; i++) {
+        if (strcmp(scene->groups->elements[i]->name, name) == 0) {
+            return scene->groups->elements[i];
+        }
     }
-    HitOption closest_ = no_Hit();
-    f32 closest_dist = 999999.0f;
-    for (u16 i = 0; i < scene->spheres->size; i++)
-    {
-        Sphere *s = scene->spheres->elements[i];
-        HitOption current_ = sphere_intersect(s, ray);
-        if (is_some(current_) && current_.value.distance <= closest_dist)
-        {
-            closest_dist = current_.value.distance;
-            closest_ = current_;
+    return NULL;
+}
+
+void scene_add_instance(Scene *scene, Instance *instance)
+{
+    InstancePtrList_add(scene->instances, instance);
+}
+
+bool accelerator_parse(const char *name, Accelerator *out)
+{
+    if (strcmp(name, "none") == 0) {
+        *out = ACCEL_NONE;
+        return true;
+    }
+    if (strcmp(name, "bvh") == 0) {
+        *out = ACCEL_BVH;
+        return true;
+    }
+    if (strcmp(name, "lbvh") == 0) {
+        *out = ACCEL_LBVH;
+        return true;
+    }
+    if (strcmp(name, "kdtree") == 0) {
+        *out = ACCEL_KDTREE;
+        return true;
+    }
+    if (strcmp(name, "grid") == 0) {
+        *out = ACCEL_GRID;
+        return true;
+    }
+    if (strcmp(name, "grid2") == 0) {
+        *out = ACCEL_GRID2;
+        return true;
+    }
+    if (strcmp(name, "qbvh") == 0) {
+        *out = ACCEL_QBVH;
+        return true;
+    }
+    if (strcmp(name, "obvh") == 0) {
+        *out = ACCEL_OBVH;
+        return true;
+    }
+    if (strcmp(name, "cbvh8") == 0) {
+        *out = ACCEL_CBVH8;
+        return true;
+    }
+    if (strcmp(name, "cbvh16") == 0) {
+        *out = ACCEL_CBVH16;
+        return true;
+    }
+    return false;
+}
+
+static void scene_free_acceleration(Scene *scene)
+{
+    if (scene->store != NULL) {
+        destroy_sphere_store(scene->store);
+        scene->store = NULL;
+    }
+    if (scene->instance_tree != NULL) {
+        destroy_InstancePtrV3Tree(scene->instance_tree);
+        scene->instance_tree = NULL;
+    }
+    if (scene->shape_tree != NULL) {
+        destroy_ShapePtrV3Tree(scene->shape_tree);
+        scene->shape_tree = NULL;
+    }
+    if (scene->bvh != NULL) {
+        destroy_bvh(scene->bvh);
+        scene->bvh = NULL;
+    }
+    if (scene->kdtree != NULL) {
+        destroy_SpherePtrV3Tree(scene->kdtree);
+        scene->kdtree = NULL;
+    }
+    if (scene->grid != NULL) {
+        destroy_grid(scene->grid);
+        scene->grid = NULL;
+    }
+    if (scene->wbvh4 != NULL) {
+        destroy_wbvh4(scene->wbvh4);
+        scene->wbvh4 = NULL;
+    }
+    if (scene->wbvh8 != NULL) {
+        destroy_wbvh8(scene->wbvh8);
+        scene->wbvh8 = NULL;
+    }
+    if (scene->cbvh8 != NULL) {
+        destroy_cbvh8(scene->cbvh8);
+        scene->cbvh8 = NULL;
+    }
+    if (scene->cbvh16 != NULL) {
+        destroy_cbvh16(scene->cbvh16);
+        scene->cbvh16 = NULL;
+    }
+}
+
+void scene_build_acceleration(Scene *scene, Accelerator accelerator, u32 leaf_size, u32 threads)
+{
+    scene_free_acceleration(scene);
+    scene->accelerator = accelerator;
+    scene->leaf_size = leaf_size;
+    scene->generation++;
+    for (u32 i = 0; i < scene->groups->size; i++) {
+        group_build(scene->groups->elements[i], leaf_size, threads);
+    }
+    if (scene->instances->size > 0) {
+        scene->instance_tree = new_InstancePtrV3Tree(scene->instances->elements, scene->instances->size);
+    }
+    if (scene->shapes->size > 0) {
+        scene->shape_tree = new_ShapePtrV3Tree(scene->shapes->elements, scene->shapes->size);
+    }
+    switch (accelerator) {
+        case ACCEL_BVH:
+            scene->bvh = new_bvh(scene->spheres->elements, scene->spheres->size, leaf_size, threads);
+            break;
+        case ACCEL_LBVH:
+            scene->bvh = new_lbvh(scene->spheres->elements, scene->spheres->size, leaf_size, threads);
+            break;
+        case ACCEL_KDTREE:
+            scene->kdtree = new_SpherePtrV3Tree(scene->spheres->elements, scene->spheres->size);
+            break;
+        case ACCEL_GRID:
+        case ACCEL_GRID2:
+            scene->grid = new_grid(scene->spheres->elements, scene->spheres->size, accelerator == ACCEL_GRID2, threads);
+            break;
+        case ACCEL_QBVH:
+            scene->wbvh4 = new_wbvh4(new_bvh(scene->spheres->elements, scene->spheres->size, leaf_size, threads));
+            break;
+        case ACCEL_OBVH:
+            scene->wbvh8 = new_wbvh8(new_bvh(scene->spheres->elements, scene->spheres->size, leaf_size, threads));
+            break;
+        case ACCEL_CBVH8:
+            scene->cbvh8 = new_cbvh8(new_wbvh4(new_bvh(scene->spheres->elements, scene->spheres->size, leaf_size, threads)));
+            break;
+        case ACCEL_CBVH16:
+            scene->cbvh16 = new_cbvh16(new_wbvh4(new_bvh(scene->spheres->elements, scene->spheres->size, leaf_size, threads)));
+            break;
+        case ACCEL_NONE:
+            scene->store = new_sphere_store(scene->spheres->elements, NULL, scene->spheres->size);
+            break;
+    }
+}
+
+bool scene_refit(Scene *scene, u32 threads)
+{
+    switch (scene->accelerator) {
+        case ACCEL_BVH:
+        case ACCEL_LBVH:
+            bvh_refit(scene->bvh, threads);
+            if (bvh_sah_cost(scene->bvh) <= scene->bvh->build_cost * BVH_REFIT_MAX_DEGRADATION) {
+                return false;
+            }
+            break;
+        case ACCEL_NONE:
+            sphere_store_update(scene->store);
+            return false;
+        default:
+            break;
+    }
+    scene_build_acceleration(scene, scene->accelerator, scene->leaf_size, threads);
+    return true;
+}
+
+typedef enum _SurfaceKind {
+    SURFACE_NONE,
+    SURFACE_SPHERE,
+    // A sphere in a SphereStore, tested by the store's kernel.
+    SURFACE_STORED_SPHERE,
+    SURFACE_PLANE,
+    SURFACE_SHAPE,
+    SURFACE_INSTANCE,
+} SurfaceKind;
+
+/**
+ * @brief The closest surface a ray has hit so far, found by distance alone.
+ * Its hit point, normal and color are only worked out once all candidates
+ * have been tested, by candidate_hit.
+ */
+typedef struct _Candidate {
+    f32 t;
+    SurfaceKind kind;
+    union {
+        Sphere *sphere;
+        struct {
+            SphereStore *store;
+            u32 index;
+        } stored;
+        Plane *plane;
+        Shape *shape;
+        Instance *instance;
+    };
+} Candidate;
+
+static Candidate no_candidate()
+{
+    return (Candidate){.t = FLT_MAX, .kind = SURFACE_NONE, .sphere = NULL};
+}
+
+static HitOption candidate_hit(Candidate *candidate, Ray *ray)
+{
+    switch (candidate->kind) {
+        case SURFACE_SPHERE:
+            return sphere_intersect(candidate->sphere, ray);
+        case SURFACE_STORED_SPHERE:
+            return sphere_intersect(candidate->stored.store->spheres[candidate->stored.index], ray);
+        case SURFACE_PLANE:
+            return plane_intersect(candidate->plane, ray);
+        case SURFACE_SHAPE:
+            return shape_intersect(candidate->shape, ray);
+        case SURFACE_INSTANCE:
+            return instance_intersect(candidate->instance, ray);
+        case SURFACE_NONE:
+            break;
+    }
+    return no_Hit();
+}
+
+// Make the loose sphere at index in spheres the candidate, if there is one.
+static void candidate_sphere(Candidate *candidate, Sphere **spheres, u32 index, f32 t)
+{
+    if (index != SPHERE_STORE_MISS) {
+        candidate->t = t;
+        candidate->kind = SURFACE_SPHERE;
+        candidate->sphere = spheres[index];
+    }
+}
+
+static void cast_ray_spheres(Scene *scene, Ray *ray, Candidate *closest)
+{
+    u32 hit;
+    f32 t = FLT_MAX;
+    switch (scene->accelerator) {
+        case ACCEL_BVH:
+        case ACCEL_LBVH:
+            hit = bvh_closest(scene->bvh, ray, &t);
+            candidate_sphere(closest, scene->bvh->spheres, hit, t);
+            break;
+        case ACCEL_KDTREE: {
+            Sphere *sphere;
+            if (SpherePtrV3Tree_closest(scene->kdtree, ray, &t, &sphere)) {
+                closest->t = t;
+                closest->kind = SURFACE_SPHERE;
+                closest->sphere = sphere;
+            }
+            break;
+        }
+        case ACCEL_GRID:
+        case ACCEL_GRID2: {
+            Sphere *sphere = grid_closest(scene->grid, ray, &t);
+            if (sphere != NULL) {
+                closest->t = t;
+                closest->kind = SURFACE_SPHERE;
+                closest->sphere = sphere;
+            }
+            break;
+        }
+        case ACCEL_QBVH:
+            hit = wbvh4_closest(scene->wbvh4, ray, &t);
+            candidate_sphere(closest, scene->wbvh4->spheres, hit, t);
+            break;
+        case ACCEL_OBVH:
+            hit = wbvh8_closest(scene->wbvh8, ray, &t);
+            candidate_sphere(closest, scene->wbvh8->spheres, hit, t);
+            break;
+        case ACCEL_CBVH8:
+            hit = cbvh8_closest(scene->cbvh8, ray, &t);
+            candidate_sphere(closest, scene->cbvh8->spheres, hit, t);
+            break;
+        case ACCEL_CBVH16:
+            hit = cbvh16_closest(scene->cbvh16, ray, &t);
+            candidate_sphere(closest, scene->cbvh16->spheres, hit, t);
+            break;
+        case ACCEL_NONE:
+            hit = sphere_intersect_n(scene->store, 0, scene->store->count, ray, &t);
+            candidate_sphere(closest, scene->spheres->elements, hit, t);
+            break;
+    }
+}
+
+// Test everything that is not a loose sphere against the candidate.
+static void cast_ray_others(Scene *scene, Ray *ray, Candidate *closest)
+{
+    f32 t = closest->t;
+    if (scene->instance_tree != NULL) {
+        Instance *instance;
+        if (InstancePtrV3Tree_closest(scene->instance_tree, ray, &t, &instance)) {
+            closest->t = t;
+            closest->kind = SURFACE_INSTANCE;
+            closest->instance = instance;
+        }
+    }
+    if (scene->shape_tree != NULL) {
+        Shape *shape;
+        if (ShapePtrV3Tree_closest(scene->shape_tree, ray, &t, &shape)) {
+            closest->t = t;
+            closest->kind = SURFACE_SHAPE;
+            closest->shape = shape;
         }
     }
+    // Planes are unbounded, so no structure can cull them; there are few.
     for (u16 i = 0; i < scene->planes->size; i++)
     {
         Plane *p = scene->planes->elements[i];
-        HitOption current_ = plane_intersect(p, ray);
-        if (is_some(current_) && current_.value.distance <= closest_dist) {
-            closest_dist = current_.value.distance;
-            closest_ = current_;
+        f32 current = plane_distance(p, ray);
+        if (current <= closest->t) {
+            closest->t = current;
+            closest->kind = SURFACE_PLANE;
+            closest->plane = p;
         }
     }
-    return closest_;
 }
 
-HitOption trace_ray(Scene *scene, Ray *ray)
+static HitOption cast_ray(Scene *scene, Ray *ray)
+{
+    if (scene->camera == NULL) {
+        failwith("No camera set in scene, cannot cast rays!\n");
+    }
+    Candidate closest = no_candidate();
+    cast_ray_spheres(scene, ray, &closest);
+    cast_ray_others(scene, ray, &closest);
+    return candidate_hit(&closest, ray);
+}
+
+void cast_packet(Scene *scene, Ray *rays, u32 count, HitOption *hits)
 {
     if (scene->camera == NULL) {
         failwith("No camera set in scene, cannot cast rays!\n");
     }
-    HitOption closest_ = cast_ray(scene, ray);
+    // Only the binary BVHs have a packet traversal, the others go ray by ray.
+    if (scene->accelerator != ACCEL_BVH && scene->accelerator != ACCEL_LBVH) {
+        for (u32 i = 0; i < count; i++) {
+            hits[i] = cast_ray(scene, &rays[i]);
+        }
+        return;
+    }
+    for (u32 first = 0; first < count; first += BVH_PACKET_MAX) {
+        u32 n = count - first < BVH_PACKET_MAX ? count - first : BVH_PACKET_MAX;
+        u32 index[BVH_PACKET_MAX];
+        f32 t[BVH_PACKET_MAX];
+        bvh_closest_packet(scene->bvh, rays + first, n, index, t);
+        for (u32 i = 0; i < n; i++) {
+            Candidate closest = no_candidate();
+            candidate_sphere(&closest, scene->bvh->spheres, index[i], t[i]);
+            cast_ray_others(scene, &rays[first + i], &closest);
+            hits[first + i] = candidate_hit(&closest, &rays[first + i]);
+        }
+    }
+}
+
+// Whether anything in the scene blocks a ray before t_max, leaving what was
+// found in occluder.
+static bool scene_occluded(Scene *scene, Ray *ray, f32 t_max, Candidate *occluder)
+{
+    // Spheres are reported the way the structure tested them, so a cached
+    // occluder is tested again the same way.
+    SphereStore *store = NULL;
+    u32 index = SPHERE_STORE_MISS;
+    Sphere *sphere = NULL;
+    switch (scene->accelerator) {
+        case ACCEL_BVH:
+        case ACCEL_LBVH:
+            if (bvh_occluded(scene->bvh, ray, t_max, &index)) {
+                store = scene->bvh->store;
+            }
+            break;
+        case ACCEL_KDTREE:
+            SpherePtrV3Tree_occluded(scene->kdtree, ray, t_max, &sphere);
+            break;
+        case ACCEL_GRID:
+        case ACCEL_GRID2:
+            grid_occluded(scene->grid, ray, t_max, &sphere);
+            break;
+        case ACCEL_QBVH:
+            if (wbvh4_occluded(scene->wbvh4, ray, t_max, &index)) {
+                store = scene->wbvh4->store;
+            }
+            break;
+        case ACCEL_OBVH:
+            if (wbvh8_occluded(scene->wbvh8, ray, t_max, &index)) {
+                store = scene->wbvh8->store;
+            }
+            break;
+        case ACCEL_CBVH8:
+            if (cbvh8_occluded(scene->cbvh8, ray, t_max, &index)) {
+                store = scene->cbvh8->store;
+            }
+            break;
+        case ACCEL_CBVH16:
+            if (cbvh16_occluded(scene->cbvh16, ray, t_max, &index)) {
+                store = scene->cbvh16->store;
+            }
+            break;
+        case ACCEL_NONE: {
+            f32 t = t_max;
+            index = sphere_intersect_n(scene->store, 0, scene->store->count, ray, &t);
+            if (index != SPHERE_STORE_MISS) {
+                store = scene->store;
+            }
+            break;
+        }
+    }
+    if (store != NULL) {
+        occluder->kind = SURFACE_STORED_SPHERE;
+        occluder->stored.store = store;
+        occluder->stored.index = index;
+        return true;
+    }
+    if (sphere != NULL) {
+        occluder->kind = SURFACE_SPHERE;
+        occluder->sphere = sphere;
+        return true;
+    }
+    Instance *instance;
+    if (scene->instance_tree != NULL && InstancePtrV3Tree_occluded(scene->instance_tree, ray, t_max, &instance)) {
+        occluder->kind = SURFACE_INSTANCE;
+        occluder->instance = instance;
+        return true;
+    }
+    Shape *shape;
+    if (scene->shape_tree != NULL && ShapePtrV3Tree_occluded(scene->shape_tree, ray, t_max, &shape)) {
+        occluder->kind = SURFACE_SHAPE;
+        occluder->shape = shape;
+        return true;
+    }
+    for (u16 i = 0; i < scene->planes->size; i++)
+    {
+        if (plane_occluded(scene->planes->elements[i], ray, t_max)) {
+            occluder->kind = SURFACE_PLANE;
+            occluder->plane = scene->planes->elements[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool occluded(Scene *scene, Ray *ray, f32 t_max)
+{
+    Candidate occluder = no_candidate();
+    return scene_occluded(scene, ray, t_max, &occluder);
+}
+
+// Whether a ray hits a sphere's box before t_max. Structures only test spheres
+// inside boxes the ray hits, and those boxes hold the sphere's, so a cached
+// sphere that passes this is never let through where a structure would not.
+// Far away, grazing rays otherwise hit it by rounding alone.
+static bool sphere_box_hit(Sphere *sphere, Ray *ray, f32 t_max)
+{
+    AABB box = sphere_bounds(sphere);
+    Vec3 inv_dir = safe_inverse(ray->direction);
+    f32 t_near;
+    return aabb_hit(&box, ray->origin, inv_dir, t_max, &t_near);
+}
+
+// Whether one surface blocks a ray before t_max. This is never true where
+// searching the scene would not find the surface, so a cache of occluders
+// does not change what is in shadow.
+static bool candidate_occludes(Candidate *candidate, Ray *ray, f32 t_max)
+{
+    switch (candidate->kind) {
+        case SURFACE_SPHERE:
+            return sphere_box_hit(candidate->sphere, ray, t_max) && sphere_occluded(candidate->sphere, ray, t_max);
+        case SURFACE_STORED_SPHERE: {
+            SphereStore *store = candidate->stored.store;
+            u32 index = candidate->stored.index;
+            f32 t = t_max;
+            return sphere_box_hit(store->spheres[index], ray, t_max) &&
+                   sphere_intersect_n(store, index, 1, ray, &t) != SPHERE_STORE_MISS;
+        }
+        case SURFACE_PLANE:
+            return plane_occluded(candidate->plane, ray, t_max);
+        case SURFACE_SHAPE:
+            return shape_occluded(candidate->shape, ray, t_max);
+        case SURFACE_INSTANCE:
+            return instance_occluded(candidate->instance, ray, t_max);
+        case SURFACE_NONE:
+            break;
+    }
+    return false;
+}
+
+ShadowCache *new_shadow_cache(Scene *scene)
+{
+    ShadowCache *cache = malloc(sizeof(ShadowCache));
+    u32 light_count = scene->lights->size;
+    Candidate *occluders = malloc(sizeof(Candidate) * (light_count > 0 ? light_count : 1));
+    if (cache == NULL || occluders == NULL) {
+        failwith("new_shadow_cache: could not allocate memory!\n");
+    }
+    for (u32 i = 0; i < light_count; i++) {
+        occluders[i] = no_candidate();
+    }
+    *cache = (ShadowCache){
+        .occluders = occluders,
+        .light_count = light_count,
+        .generation = scene->generation,
+        .rays = 0,
+        .blocked = 0,
+        .hits = 0,
+    };
+    return cache;
+}
+
+void destroy_shadow_cache(ShadowCache *cache)
+{
+    free(cache->occluders);
+    free(cache);
+}
+
+bool shadow_occluded(Scene *scene, Ray *ray, f32 t_max, u32 light, ShadowCache *cache)
+{
+    if (cache == NULL || light >= cache->light_count) {
+        return occluded(scene, ray, t_max);
+    }
+    // The occluders may point into structures a rebuild has since freed.
+    if (cache->generation != scene->generation) {
+        for (u32 i = 0; i < cache->light_count; i++) {
+            cache->occluders[i] = no_candidate();
+        }
+        cache->generation = scene->generation;
+    }
+    cache->rays++;
+    Candidate *last = &cache->occluders[light];
+    if (candidate_occludes(last, ray, t_max)) {
+        cache->blocked++;
+        cache->hits++;
+        return true;
+    }
+    // A lit point keeps the last occluder, the next one may well be in its
+    // shadow again.
+    Candidate found = no_candidate();
+    if (scene_occluded(scene, ray, t_max, &found)) {
+        cache->blocked++;
+        *last = found;
+        return true;
+    }
+    return false;
+}
+
+// Set up the shadow ray from a hit towards a light, returning the distance to
+// the light. Anything beyond it cannot cast a shadow from it.
+static f32 shadow_ray_setup(Hit *hit, Light *light, Ray *shadow_ray)
+{
+    Vec3A origin = vadd4(vec3a_load(hit->position), smul4(vec3a_load(hit->norm), 0.01f));
+    Vec3A to_light = vsub4(vec3a_load(light->position), origin);
+    f32 distance = mag3a(to_light);
+    shadow_ray->origin = vec3a_store(origin);
+    shadow_ray->direction = vec3a_store(sdiv4(to_light, distance));
+    return distance;
+}
+
+// Black out a hit that no light reaches.
+static HitOption shade(Scene *scene, HitOption closest_, ShadowCache *cache)
+{
     if (is_some(closest_))
     {
         // Compute the color depending on whether we are in darkness or not.
         bool reached_by_light = false;
         Ray shadow_ray;
-        shadow_ray.origin = vadd(closest_.value.position, smul(closest_.value.norm, 0.01));
-        for (u16 i = 0; i < scene->lights->size; i++)
+        for (u16 i = 0; i < scene->lights->size && !reached_by_light; i++)
         {
-            Light l = scene->lights->elements[i];
-            shadow_ray.direction = norm(vsub(l.position, shadow_ray.origin));
-            HitOption shadow_hit_ = cast_ray(scene, &shadow_ray);
-            if (is_none(shadow_hit_))
-            {
-                reached_by_light = true;
-                closest_.value.color = closest_.value.color;
-            }
+            f32 t_max = shadow_ray_setup(&closest_.value, &scene->lights->elements[i], &shadow_ray);
+            reached_by_light = !shadow_occluded(scene, &shadow_ray, t_max, i, cache);
         }
         if (!reached_by_light)
         {
@@ -134,8 +749,105 @@ HitOption trace_ray(Scene *scene, Ray *ray)
     return closest_;
 }
 
+HitOption trace_ray(Scene *scene, Ray *ray, ShadowCache *cache)
+{
+    if (scene->camera == NULL) {
+        failwith("No camera set in scene, cannot cast rays!\n");
+    }
+    return shade(scene, cast_ray(scene, ray), cache);
+}
+
+void trace_packet(Scene *scene, Ray *rays, u32 count, HitOption *hits, ShadowCache *cache)
+{
+    cast_packet(scene, rays, count, hits);
+    for (u32 i = 0; i < count; i++) {
+        hits[i] = shade(scene, hits[i], cache);
+    }
+}
+
+// The sort key of a shadow ray: its direction octant, above the Morton code of
+// its origin within bounds.
+static u64 shadow_ray_key(Ray *ray, Vec3 lo, Vec3 scale)
+{
+    Vec3A q = vmul4(vsub4(vec3a_load(ray->origin), vec3a_load(lo)), vec3a_load(scale));
+    u64 octant = (ray->direction.x < 0.0f) << 2 | (ray->direction.y < 0.0f) << 1 | (ray->direction.z < 0.0f);
+    return octant << (3 * SHADOW_SORT_MORTON_BITS) |
+           morton_spread((u64)q.x) << 2 | morton_spread((u64)q.y) << 1 | morton_spread((u64)q.z);
+}
+
+void trace_batch(Scene *scene, Ray *rays, u32 count, HitOption *hits, ShadowCache *cache)
+{
+    if (scene->camera == NULL) {
+        failwith("No camera set in scene, cannot cast rays!\n");
+    }
+    for (u32 i = 0; i < count; i++) {
+        hits[i] = cast_ray(scene, &rays[i]);
+    }
+    // Shadow rays are indexed by the pixel they belong to, and pending lists
+    // the pixels no light has reached yet, in the order they are traced.
+    Ray *shadow_rays = malloc(sizeof(Ray) * (count > 0 ? count : 1));
+    f32 *t_max = malloc(sizeof(f32) * (count > 0 ? count : 1));
+    u64 *keys = malloc(sizeof(u64) * (count > 0 ? count : 1));
+    u32 *pending = malloc(sizeof(u32) * (count > 0 ? count : 1));
+    if (shadow_rays == NULL || t_max == NULL || keys == NULL || pending == NULL) {
+        failwithf("trace_batch: could not allocate memory for %u rays!\n", count);
+    }
+    u32 pending_count = 0;
+    for (u32 i = 0; i < count; i++) {
+        if (is_some(hits[i])) {
+            pending[pending_count++] = i;
+        }
+    }
+    f32 cells = (f32)((1u << SHADOW_SORT_MORTON_BITS) - 1);
+    for (u16 l = 0; l < scene->lights->size && pending_count > 0; l++) {
+        AABB bounds = aabb_empty();
+        for (u32 k = 0; k < pending_count; k++) {
+            u32 i = pending[k];
+            t_max[i] = shadow_ray_setup(&hits[i].value, &scene->lights->elements[l], &shadow_rays[i]);
+            bounds = aabb_grow(bounds, shadow_rays[i].origin);
+        }
+        Vec3 extent = vsub(bounds.max, bounds.min);
+        Vec3 scale = vec3(extent.x > eps ? cells / extent.x : 0.0f,
+            extent.y > eps ? cells / extent.y : 0.0f,
+            extent.z > eps ? cells / extent.z : 0.0f);
+        for (u32 k = 0; k < pending_count; k++) {
+            keys[k] = shadow_ray_key(&shadow_rays[pending[k]], bounds.min, scale);
+        }
+        radix_sort_u64(keys, pending, pending_count, 3 * SHADOW_SORT_MORTON_BITS + 3, 1);
+        // Points this light reaches are done, the rest try the next light.
+        u32 still_dark = 0;
+        for (u32 k = 0; k < pending_count; k++) {
+            u32 i = pending[k];
+            if (shadow_occluded(scene, &shadow_rays[i], t_max[i], l, cache)) {
+                pending[still_dark++] = i;
+            }
+        }
+        pending_count = still_dark;
+    }
+    for (u32 k = 0; k < pending_count; k++) {
+        hits[pending[k]].value.color = vec3(0.0, 0.0, 0.0);
+    }
+    free(shadow_rays);
+    free(t_max);
+    free(keys);
+    free(pending);
+}
+
 void scene_free(Scene *scene)
 {
+    scene_free_acceleration(scene);
+    for (u32 i = 0; i < scene->instances->size; i++) {
+        free(scene->instances->elements[i]);
+    }
+    destroy_InstancePtrList(scene->instances);
+    for (u32 i = 0; i < scene->shapes->size; i++) {
+        destroy_shape(scene->shapes->elements[i]);
+    }
+    destroy_ShapePtrList(scene->shapes);
+    for (u32 i = 0; i < scene->groups->size; i++) {
+        destroy_group(scene->groups->elements[i]);
+    }
+    destroy_GroupPtrList(scene->groups);
     destroy_SpherePtrList(scene->spheres);
     destroy_LightList(scene->lights);
     free(scene);
@@ -194,6 +906,103 @@ void scene_debug_print(Scene *scene)
     }
 }
 
+void scene_debug_print_acceleration(Scene *scene)
+{
+    switch (scene->accelerator) {
+        case ACCEL_BVH:
+        case ACCEL_LBVH:
+            bvh_debug_print(scene->bvh);
+            break;
+        case ACCEL_KDTREE:
+            printf("KD-tree: %u nodes, depth %u\n", scene->kdtree->size, scene->kdtree->depth);
+            break;
+        case ACCEL_GRID:
+        case ACCEL_GRID2:
+            grid_debug_print(scene->grid);
+            break;
+        case ACCEL_QBVH:
+            wbvh4_debug_print(scene->wbvh4);
+            break;
+        case ACCEL_OBVH:
+            wbvh8_debug_print(scene->wbvh8);
+            break;
+        case ACCEL_CBVH8:
+            cbvh8_debug_print(scene->cbvh8);
+            break;
+        case ACCEL_CBVH16:
+            cbvh16_debug_print(scene->cbvh16);
+            break;
+        case ACCEL_NONE:
+            printf("No acceleration structure, rays test every sphere.\n");
+            break;
+    }
+    if (scene->shape_tree != NULL) {
+        u32 meshes = 0;
+        u64 triangles = 0;
+        for (u32 i = 0; i < scene->shapes->size; i++) {
+            Shape *shape = scene->shapes->elements[i];
+            if (shape->kind == SHAPE_MESH) {
+                meshes++;
+                triangles += shape->mesh->triangle_count;
+            }
+        }
+        printf("Shapes: %u boxes, discs, rectangles and meshes, kd-tree depth %u\n",
+            scene->shapes->size, scene->shape_tree->depth);
+        if (meshes > 0) {
+            printf("Meshes: %u with %llu triangles\n", meshes, (unsigned long long)triangles);
+        }
+    }
+    if (scene->instance_tree != NULL) {
+        u32 unique = 0;
+        u64 placed = 0;
+        for (u32 i = 0; i < scene->groups->size; i++) {
+            unique += scene->groups->elements[i]->spheres->size;
+        }
+        for (u32 i = 0; i < scene->instances->size; i++) {
+            placed += scene->instances->elements[i]->group->spheres->size;
+        }
+        printf("Instances: %u of %u groups, %u unique spheres placed as %llu, kd-tree depth %u\n",
+            scene->instances->size, scene->groups->size, unique, (unsigned long long)placed, scene->instance_tree->depth);
+    }
+}
+
+f64 scene_measure_throughput(Scene *scene, u32 width, u32 height, u32 block)
+{
+    Ray *rays = setup_perspective_rays(scene_get_camera(scene), width, height);
+    u32 count = width * height;
+    clock_t start = clock();
+    if (block == 0) {
+        for (u32 i = 0; i < count; i++) {
+            cast_ray(scene, &rays[i]);
+        }
+    } else {
+        Ray packet[BVH_PACKET_MAX];
+        HitOption hits[BVH_PACKET_MAX];
+        for (u32 y = 0; y < height; y += block) {
+            for (u32 x = 0; x < width; x += block) {
+                u32 n = camera_gather_block(rays, width, height, x, y, block, packet);
+                cast_packet(scene, packet, n, hits);
+            }
+        }
+    }
+    f64 seconds = (f64)(clock() - start) / CLOCKS_PER_SEC;
+    free(rays);
+    if (seconds <= 0.0) {
+        return 0.0;
+    }
+    return count / seconds / 1e6;
+}
+
+u32 scene_light_count(Scene *scene)
+{
+    return scene->lights->size;
+}
+
+Light scene_get_light(Scene *scene, u32 index)
+{
+    return scene->lights->elements[index];
+}
+
 Camera *scene_get_camera(Scene *scene)
 {
     if(scene->camera != NULL) {
@@ -12,20 +12,178 @@
  *
  */
 
+#include "bvh.h"
 #include "camera.h"
+#include "cbvh.h"
+#include "grid.h"
+#include "instance.h"
 #include "light.h"
 #include "plane.h"
+#include "shape.h"
 #include "sphere.h"
+#include "wbvh.h"
 
 typedef struct _Scene Scene;
 
+// Bits per axis of the origins that shadow rays are sorted by.
+#define SHADOW_SORT_MORTON_BITS 10
+
+typedef enum _Accelerator {
+    ACCEL_NONE,
+    ACCEL_BVH,
+    ACCEL_LBVH,
+    ACCEL_KDTREE,
+    ACCEL_GRID,
+    ACCEL_GRID2,
+    ACCEL_QBVH,
+    ACCEL_OBVH,
+    ACCEL_CBVH8,
+    ACCEL_CBVH16,
+} Accelerator;
+
+/**
+ * @brief Parse an accelerator name, as given on the command line.
+ *
+ * @return bool Whether the name was recognized.
+ */
+bool accelerator_parse(const char *name, Accelerator *out);
+
 Scene *new_scene();
 Camera *scene_get_camera(Scene *scene);
 void scene_set_camera(Scene *scene, Camera *camera);
 void scene_add_sphere(Scene *scene, Sphere *sphere);
+u32 scene_light_count(Scene *scene);
+Light scene_get_light(Scene *scene, u32 index);
 void scene_add_plane(Scene *scene, Plane *plane);
+/**
+ * @brief Add a bounded shape, such as a box, disc or rectangle. Unlike planes,
+ * these are found through a kd-tree over their bounds. The scene takes
+ * ownership of the shape.
+ */
+void scene_add_shape(Scene *scene, Shape *shape);
 void scene_add_light(Scene *scene, Light light);
-HitOption trace_ray(Scene *scene, Ray *ray);
+/**
+ * @brief Add a named group of spheres, which instances can then refer to.
+ * The scene takes ownership of the group.
+ */
+void scene_add_group(Scene *scene, Group *group);
+/**
+ * @brief Look up a group by name.
+ *
+ * @return Group* The group, or NULL if there is none by that name.
+ */
+Group *scene_find_group(Scene *scene, const char *name);
+void scene_add_instance(Scene *scene, Instance *instance);
+/**
+ * @brief Build an acceleration structure over the spheres currently in the
+ * scene. Call this once all spheres have been added; rays are cast through it
+ * from then on. Groups always get a BVH each, and instances and bounded shapes
+ * a kd-tree each, whichever accelerator is chosen for the loose spheres.
+ *
+ * @param accelerator Which structure to build, ACCEL_NONE tests every sphere.
+ * @param leaf_size The largest number of spheres a BVH leaf may hold.
+ * @param threads How many threads may help with the build.
+ */
+void scene_build_acceleration(Scene *scene, Accelerator accelerator, u32 leaf_size, u32 threads);
+/**
+ * @brief Bring the acceleration structure up to date after spheres have moved
+ * or changed radius. A BVH is refitted in place, and only rebuilt once its SAH
+ * cost has grown past BVH_REFIT_MAX_DEGRADATION times that of its last build.
+ * Other structures have no refit and are always rebuilt. A rebuild frees the
+ * old structures, so shadow caches drop whatever occluders they found in them
+ * the next time they are used.
+ *
+ * @param threads How many threads may help.
+ * @return bool Whether the structure was rebuilt.
+ */
+bool scene_refit(Scene *scene, u32 threads);
+/**
+ * @brief What last blocked a shadow ray towards each light of a scene. Each
+ * thread keeps its own, and tests that surface first, as neighbouring pixels
+ * are mostly shadowed by the same one. It counts how often that pays off.
+ * The occluders point into the scene's acceleration structures, so they are
+ * dropped once the scene has been rebuilt since they were found.
+ */
+typedef struct _ShadowCache {
+    struct _Candidate *occluders;
+    u32 light_count;
+    // The build of the scene the occluders were found in.
+    u32 generation;
+    // Shadow rays traced through the cache.
+    u64 rays;
+    // Of those, the ones that were blocked.
+    u64 blocked;
+    // Of those, the ones the cached occluder blocked.
+    u64 hits;
+} ShadowCache;
+
+/**
+ * @brief Make an empty cache for the lights the scene has now.
+ */
+ShadowCache *new_shadow_cache(Scene *scene);
+void destroy_shadow_cache(ShadowCache *cache);
+/**
+ * @brief Find what a ray hits and whether any light reaches it.
+ *
+ * @param cache The calling thread's shadow cache, or NULL to go without.
+ */
+HitOption trace_ray(Scene *scene, Ray *ray, ShadowCache *cache);
+/**
+ * @brief Whether anything in the scene blocks a ray before t_max. This is for
+ * shadow rays: it stops at the first blocker found, nearest or not, and works
+ * out nothing about the hit.
+ *
+ * @param t_max The distance to the light, blockers at or beyond it are
+ * ignored.
+ */
+bool occluded(Scene *scene, Ray *ray, f32 t_max);
+/**
+ * @brief Like occluded for a shadow ray towards one of the scene's lights,
+ * trying whatever last blocked one towards the same light on this thread
+ * before searching the scene. The answer is the same as occluded's.
+ *
+ * @param light The index of the light.
+ * @param cache The calling thread's shadow cache, or NULL to go without.
+ */
+bool shadow_occluded(Scene *scene, Ray *ray, f32 t_max, u32 light, ShadowCache *cache);
+/**
+ * @brief Find the closest hit of each of a batch of rays, without shading
+ * them. With a BVH, consecutive rays go through the hierarchy together in
+ * packets of BVH_PACKET_MAX; other accelerators trace them one by one.
+ *
+ * @param hits Set to the hit of each ray.
+ */
+void cast_packet(Scene *scene, Ray *rays, u32 count, HitOption *hits);
+/**
+ * @brief Like trace_ray for each of a packet of coherent rays, such as the
+ * primary rays of a block of pixels. With a BVH, the packet goes through the
+ * hierarchy together; other accelerators trace it ray by ray.
+ *
+ * @param hits Set to the hit of each ray.
+ * @param cache The calling thread's shadow cache, or NULL to go without.
+ */
+void trace_packet(Scene *scene, Ray *rays, u32 count, HitOption *hits, ShadowCache *cache);
+/**
+ * @brief Like trace_ray for each of a batch of rays, such as a tile of
+ * pixels, with the shadow rays traced as a stage of their own. All hits are
+ * found first, then their shadow rays are traced light by light, sorted by
+ * direction octant and by the Morton code of their origin, so rays through
+ * the same part of the scene are traced one after another.
+ *
+ * @param hits Set to the hit of each ray.
+ * @param cache The calling thread's shadow cache, or NULL to go without.
+ */
+void trace_batch(Scene *scene, Ray *rays, u32 count, HitOption *hits, ShadowCache *cache);
 void scene_free(Scene *scene);
 void scene_debug_print(Scene *scene);
+void scene_debug_print_acceleration(Scene *scene);
+/**
+ * @brief Time closest-hit queries for one ray per pixel through the camera,
+ * on the calling thread, without any shading.
+ *
+ * @param block The side of the pixel blocks traced as packets, or 0 to trace
+ * one ray at a time.
+ * @return f64 Millions of rays per second.
+ */
+f64 scene_measure_throughput(Scene *scene, u32 width, u32 height, u32 block);
 #endif
\ No newline at end of file
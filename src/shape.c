@@ -0,0 +1,102 @@
+#include "shape.h"
+#include "fail.h"
+#include <math.h>
+
+static Shape *new_shape(ShapeKind kind) {
+    Shape *shape = malloc(sizeof(Shape));
+    if (shape == NULL) {
+        failwith("new_shape: could not allocate memory!\n");
+    }
+    shape->kind = kind;
+    return shape;
+}
+
+Shape *new_box_shape(Box *box) {
+    Shape *shape = new_shape(SHAPE_BOX);
+    shape->box = box;
+    return shape;
+}
+
+Shape *new_disc_shape(Disc *disc) {
+    Shape *shape = new_shape(SHAPE_DISC);
+    shape->disc = disc;
+    return shape;
+}
+
+Shape *new_rect_shape(Rect *rect) {
+    Shape *shape = new_shape(SHAPE_RECT);
+    shape->rect = rect;
+    return shape;
+}
+
+Shape *new_mesh_shape(Mesh *mesh) {
+    Shape *shape = new_shape(SHAPE_MESH);
+    shape->mesh = mesh;
+    return shape;
+}
+
+HitOption shape_intersect(Shape *shape, Ray *ray) {
+    switch (shape->kind) {
+        case SHAPE_BOX:
+            return box_intersect(shape->box, ray);
+        case SHAPE_DISC:
+            return disc_intersect(shape->disc, ray);
+        case SHAPE_RECT:
+            return rect_intersect(shape->rect, ray);
+        case SHAPE_MESH:
+            return mesh_intersect(shape->mesh, ray);
+    }
+    return no_Hit();
+}
+
+f32 shape_distance(Shape *shape, Ray *ray) {
+    if (shape->kind == SHAPE_MESH) {
+        return mesh_distance(shape->mesh, ray);
+    }
+    // The other shapes are few and cheap enough that the full test will do.
+    HitOption hit_ = shape_intersect(shape, ray);
+    return is_some(hit_) ? hit_.value.distance : INFINITY;
+}
+
+bool shape_occluded(Shape *shape, Ray *ray, f32 t_max) {
+    if (shape->kind == SHAPE_MESH) {
+        return mesh_occluded(shape->mesh, ray, t_max);
+    }
+    return shape_distance(shape, ray) < t_max;
+}
+
+AABB shape_bounds(Shape *shape) {
+    switch (shape->kind) {
+        case SHAPE_BOX:
+            return box_bounds(shape->box);
+        case SHAPE_DISC:
+            return disc_bounds(shape->disc);
+        case SHAPE_RECT:
+            return rect_bounds(shape->rect);
+        case SHAPE_MESH:
+            return mesh_bounds(shape->mesh);
+    }
+    return aabb_empty();
+}
+
+Vec3 shape_position(Shape *shape) {
+    return aabb_centroid(shape_bounds(shape));
+}
+
+void destroy_shape(Shape *shape) {
+    switch (shape->kind) {
+        case SHAPE_BOX:
+            free(shape->box);
+            break;
+        case SHAPE_DISC:
+            free(shape->disc);
+            break;
+        case SHAPE_RECT:
+            free(shape->rect);
+            break;
+        case SHAPE_MESH:
+            destroy_mesh(shape->mesh);
+            break;
+    }
+    free(shape);
+}
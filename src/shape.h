@@ -0,0 +1,68 @@
+#ifndef SHAPE_H
+#define SHAPE_H
+/**
+ * @file shape.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief Bounded shapes other than spheres, behind one type so they can share
+ * an acceleration structure.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#include "aabb.h"
+#include "box.h"
+#include "disc.h"
+#include "hit.h"
+#include "mesh.h"
+#include "ray.h"
+#include "rect.h"
+#include "vec3.h"
+
+typedef enum _ShapeKind {
+    SHAPE_BOX,
+    SHAPE_DISC,
+    SHAPE_RECT,
+    SHAPE_MESH,
+} ShapeKind;
+
+typedef struct _Shape {
+    ShapeKind kind;
+    union {
+        Box *box;
+        Disc *disc;
+        Rect *rect;
+        Mesh *mesh;
+    };
+} Shape;
+
+Shape *new_box_shape(Box *box);
+Shape *new_disc_shape(Disc *disc);
+Shape *new_rect_shape(Rect *rect);
+Shape *new_mesh_shape(Mesh *mesh);
+
+HitOption shape_intersect(Shape *shape, Ray *ray);
+
+/**
+ * @brief How far along a ray it hits the shape, or INFINITY if it misses.
+ */
+f32 shape_distance(Shape *shape, Ray *ray);
+
+/**
+ * @brief Whether a ray hits the shape nearer than t_max.
+ */
+bool shape_occluded(Shape *shape, Ray *ray, f32 t_max);
+
+AABB shape_bounds(Shape *shape);
+
+Vec3 shape_position(Shape *shape);
+
+/**
+ * @brief Free the shape along with what it wraps.
+ */
+void destroy_shape(Shape *shape);
+
+#endif
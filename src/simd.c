@@ -0,0 +1,51 @@
+#include "simd.h"
+#include "fail.h"
+#define SDL_MAIN_HANDLED
+#include <SDL2/SDL.h>
+
+static SimdLevel selected = SIMD_SCALAR;
+
+static const char *simd_names[] = {"scalar", "sse4.2", "avx2", "avx512"};
+
+SimdLevel simd_detect() {
+#ifdef SIMD_X86
+    // SDL asks cpuid, and also checks that the OS saves the wide registers.
+    if (SDL_HasAVX512F()) {
+        return SIMD_AVX512;
+    }
+    if (SDL_HasAVX2()) {
+        return SIMD_AVX2;
+    }
+    if (SDL_HasSSE42()) {
+        return SIMD_SSE42;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+void simd_select(SimdLevel level) {
+    SimdLevel supported = simd_detect();
+    if (level > supported) {
+        failwithf("This CPU supports %s at most, it cannot run %s kernels.\n",
+            simd_names[supported], simd_names[level]);
+    }
+    selected = level;
+}
+
+SimdLevel simd_level() {
+    return selected;
+}
+
+const char *simd_level_name(SimdLevel level) {
+    return simd_names[level];
+}
+
+bool simd_level_parse(const char *name, SimdLevel *out) {
+    for (u32 i = 0; i < sizeof(simd_names) / sizeof(simd_names[0]); i++) {
+        if (strcmp(name, simd_names[i]) == 0) {
+            *out = (SimdLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,72 @@
+#ifndef SIMD_H
+#define SIMD_H
+/**
+ * @file simd.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief Picks which instruction set the vector kernels run with, from what
+ * the CPU reports at startup, so one binary runs well on old and new CPUs.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#include "defs.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define SIMD_X86
+// Compile one function for an instruction set the rest of the bundle may
+// not be built for. Only call it once simd_select has checked the CPU.
+// Contracting a * b + c into an FMA rounds once instead of twice, so with it
+// on (as GCC has it in its gnu modes) a kernel for an ISA with FMA no longer
+// hits exactly what the scalar one does. make.bat passes -ffp-contract=off as
+// well, for compilers that ignore the attribute.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define SIMD_TARGET(isa)
+#elif defined(__GNUC__) && !defined(__clang__)
+#define SIMD_TARGET(isa)                                                       \
+    __attribute__((target(isa), optimize("fp-contract=off")))
+#else
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+typedef enum _SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE42,
+    SIMD_AVX2,
+    SIMD_AVX512,
+} SimdLevel;
+
+/**
+ * @brief The widest level this CPU and operating system support.
+ */
+SimdLevel simd_detect();
+
+/**
+ * @brief Check that the CPU supports a level and make it the one kernels are
+ * selected for. Modules with vector kernels pick their versions from it; until
+ * they do, they use scalar code.
+ *
+ * @param level A level no higher than simd_detect() returns.
+ */
+void simd_select(SimdLevel level);
+
+/**
+ * @brief The level given to simd_select, or SIMD_SCALAR before it is called.
+ */
+SimdLevel simd_level();
+
+const char *simd_level_name(SimdLevel level);
+
+/**
+ * @brief Parse a level name, as given on the command line: scalar, sse4.2,
+ * avx2 or avx512.
+ *
+ * @return bool Whether the name was recognized.
+ */
+bool simd_level_parse(const char *name, SimdLevel *out);
+
+#endif
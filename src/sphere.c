@@ -1,5 +1,6 @@
 #include "sphere.h"
 #include <math.h>
+#include "vec4.h"
 
 Sphere *new_sphere(Vec3 center, f32 radius, Color color) {
     Sphere *sphere = malloc(sizeof(Sphere));
@@ -9,6 +10,24 @@ Sphere *new_sphere(Vec3 center, f32 radius, Color color) {
     return sphere;
 }
 
+f32 sphere_distance(Sphere *sphere, Ray *ray) {
+    f32 radius2 = (sphere->radius * sphere->radius);
+    Vec3A center_dir =
+        vsub4(vec3a_load(sphere->center), vec3a_load(ray->origin));
+    f32 origin_to_center = dot3a(center_dir, vec3a_load(ray->direction));
+
+    if (origin_to_center < 0.0f)
+        return INFINITY;
+
+    f32 offset =
+        dot3a(center_dir, center_dir) - (origin_to_center * origin_to_center);
+    if (offset > (radius2 + eps))
+        return INFINITY;
+
+    f32 distance = origin_to_center - sqrtf(maxf(radius2 - offset, 0.0f));
+    return distance < 0.0f ? INFINITY : distance;
+}
+
 /**
  * @brief Compute the intersect between a sphere and a ray.
  *
@@ -17,35 +36,36 @@ Sphere *new_sphere(Vec3 center, f32 radius, Color color) {
  * @return HitOption An option of the Hit-persuasion.
  */
 HitOption sphere_intersect(Sphere *sphere, Ray *ray) {
-    f32 radius2 = (sphere->radius * sphere->radius);
-    Vec3 center_dir = vsub(sphere->center, ray->origin);
-    f32 origin_to_center = dot(center_dir, ray->direction);
-
-    if (origin_to_center < 0.0f)
-        return no_Hit();
-
-    f32 offset =
-        dot(center_dir, center_dir) - (origin_to_center * origin_to_center);
-    if (offset > (radius2 + eps))
-        return no_Hit();
-
-    f32 hit_to_center = sqrtf(radius2 - offset);
-    f32 distance =
-        min(origin_to_center - hit_to_center, origin_to_center + hit_to_center);
-    if (distance < 0.0f) {
+    f32 distance = sphere_distance(sphere, ray);
+    if (distance == INFINITY) {
         return no_Hit();
     }
 
-    Vec3 hit_point = vadd(ray->origin, smul(ray->direction, distance));
-    Vec3 hit_norm = norm(vsub(hit_point, sphere->center));
-    Vec3 hit_to_center_vec = norm(vsub(sphere->center, hit_point));
-    if (dot(hit_norm, hit_to_center_vec) < 0.1) {
-        hit_norm = smul(hit_norm, -1.0f);
+    Vec3A origin = vec3a_load(ray->origin);
+    Vec3A center = vec3a_load(sphere->center);
+    Vec3A hit_point =
+        vadd4(origin, smul4(vec3a_load(ray->direction), distance));
+    Vec3A hit_norm = norm3a(vsub4(hit_point, center));
+    Vec3A hit_to_center_vec = norm3a(vsub4(center, hit_point));
+    if (dot3a(hit_norm, hit_to_center_vec) < 0.1) {
+        hit_norm = smul4(hit_norm, -1.0f);
     }
     return some_Hit((Hit){
         .color = sphere->color,
-        .distance = dist(ray->origin, hit_point),
-        .position = hit_point,
-        .norm = hit_norm,
+        .distance = dist3a(origin, hit_point),
+        .position = vec3a_store(hit_point),
+        .norm = vec3a_store(hit_norm),
     });
 }
+
+bool sphere_occluded(Sphere *sphere, Ray *ray, f32 t_max) {
+    return sphere_distance(sphere, ray) < t_max;
+}
+
+AABB sphere_bounds(Sphere *sphere) {
+    Vec3 extent = vec3(sphere->radius, sphere->radius, sphere->radius);
+    return (AABB){
+        .min = vsub(sphere->center, extent),
+        .max = vadd(sphere->center, extent),
+    };
+}
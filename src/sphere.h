@@ -12,6 +12,7 @@
  *
  */
 
+#include "aabb.h"
 #include "color.h"
 #include "hit.h"
 #include "ray.h"
@@ -25,6 +26,21 @@ typedef struct _Sphere {
 
 Sphere *new_sphere(Vec3 center, f32 radius, Color color);
 
+/**
+ * @brief How far along a ray it first hits the sphere, or INFINITY if it
+ * misses. This is the cheap part of sphere_intersect, for testing candidates;
+ * only the closest one needs sphere_intersect.
+ */
+f32 sphere_distance(Sphere *sphere, Ray *ray);
+
 HitOption sphere_intersect(Sphere *sphere, Ray *ray);
 
+/**
+ * @brief Whether a ray hits the sphere nearer than t_max, without working out
+ * where or with what normal.
+ */
+bool sphere_occluded(Sphere *sphere, Ray *ray, f32 t_max);
+
+AABB sphere_bounds(Sphere *sphere);
+
 #endif
@@ -0,0 +1,271 @@
+#include "sphere_store.h"
+#include "fail.h"
+#include "util.h"
+#include <math.h>
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+SphereStore *new_sphere_store(Sphere **spheres, u32 *materials, u32 count) {
+    SphereStore *store = malloc(sizeof(SphereStore));
+    if (store == NULL) {
+        failwith("new_sphere_store: could not allocate memory!\n");
+    }
+    // Round up to whole vectors, plus one more for tests that start mid-way.
+    u32 padded =
+        (count + 2 * SPHERE_STORE_WIDTH - 1) & ~(SPHERE_STORE_WIDTH - 1);
+    size_t bytes = sizeof(f32) * padded;
+    store->cx = aligned_malloc(64, bytes);
+    store->cy = aligned_malloc(64, bytes);
+    store->cz = aligned_malloc(64, bytes);
+    store->r2 = aligned_malloc(64, bytes);
+    store->material = aligned_malloc(64, sizeof(u32) * padded);
+    store->spheres = spheres;
+    store->count = count;
+    for (u32 i = 0; i < padded; i++) {
+        store->material[i] = i < count && materials != NULL ? materials[i] : i;
+    }
+    // Padding sits at the origin with a negative squared radius, which no
+    // ray can hit.
+    for (u32 i = count; i < padded; i++) {
+        store->cx[i] = 0.0f;
+        store->cy[i] = 0.0f;
+        store->cz[i] = 0.0f;
+        store->r2[i] = -1.0f;
+    }
+    sphere_store_update(store);
+    return store;
+}
+
+void sphere_store_update(SphereStore *store) {
+    sphere_store_update_range(store, 0, store->count);
+}
+
+void sphere_store_update_range(SphereStore *store, u32 first, u32 count) {
+    for (u32 i = first; i < first + count; i++) {
+        Sphere *sphere = store->spheres[i];
+        store->cx[i] = sphere->center.x;
+        store->cy[i] = sphere->center.y;
+        store->cz[i] = sphere->center.z;
+        store->r2[i] = sphere->radius * sphere->radius;
+    }
+}
+
+void destroy_sphere_store(SphereStore *store) {
+    aligned_free(store->cx);
+    aligned_free(store->cy);
+    aligned_free(store->cz);
+    aligned_free(store->r2);
+    aligned_free(store->material);
+    free(store);
+}
+
+static u32 sphere_intersect_n_scalar(
+    SphereStore *store, u32 first, u32 count, Ray *ray, f32 *t_max) {
+    u32 best = SPHERE_STORE_MISS;
+    for (u32 i = first; i < first + count; i++) {
+        f32 cx = store->cx[i] - ray->origin.x;
+        f32 cy = store->cy[i] - ray->origin.y;
+        f32 cz = store->cz[i] - ray->origin.z;
+        f32 b = cx * ray->direction.x + cy * ray->direction.y +
+                cz * ray->direction.z;
+        f32 offset = cx * cx + cy * cy + cz * cz - b * b;
+        // The same tolerance as sphere_distance, so every structure agrees
+        // on rays that only graze a sphere.
+        if (b < 0.0f || offset > store->r2[i] + eps) {
+            continue;
+        }
+        f32 t = b - sqrtf(maxf(store->r2[i] - offset, 0.0f));
+        if (t >= 0.0f && t <= *t_max) {
+            *t_max = t;
+            best = i;
+        }
+    }
+    return best;
+}
+
+#ifdef SIMD_X86
+
+SIMD_TARGET("sse4.2")
+static u32 sphere_intersect_n_sse42(
+    SphereStore *store, u32 first, u32 count, Ray *ray, f32 *t_max) {
+    u32 best = SPHERE_STORE_MISS;
+    u32 end = first + count;
+    __m128 ox = _mm_set1_ps(ray->origin.x);
+    __m128 oy = _mm_set1_ps(ray->origin.y);
+    __m128 oz = _mm_set1_ps(ray->origin.z);
+    __m128 dx = _mm_set1_ps(ray->direction.x);
+    __m128 dy = _mm_set1_ps(ray->direction.y);
+    __m128 dz = _mm_set1_ps(ray->direction.z);
+    __m128 zero = _mm_setzero_ps();
+    for (u32 base = first; base < end; base += 4) {
+        __m128 cx = _mm_sub_ps(_mm_loadu_ps(store->cx + base), ox);
+        __m128 cy = _mm_sub_ps(_mm_loadu_ps(store->cy + base), oy);
+        __m128 cz = _mm_sub_ps(_mm_loadu_ps(store->cz + base), oz);
+        __m128 r2 = _mm_loadu_ps(store->r2 + base);
+        __m128 b = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(cx, dx), _mm_mul_ps(cy, dy)),
+            _mm_mul_ps(cz, dz));
+        __m128 c2 = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cy, cy)),
+            _mm_mul_ps(cz, cz));
+        __m128 offset = _mm_sub_ps(c2, _mm_mul_ps(b, b));
+        __m128 h = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(r2, offset), zero));
+        __m128 t = _mm_sub_ps(b, h);
+        __m128 hit = _mm_cmpge_ps(b, zero);
+        hit = _mm_and_ps(
+            hit, _mm_cmple_ps(offset, _mm_add_ps(r2, _mm_set1_ps(eps))));
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(t, zero));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(t, _mm_set1_ps(*t_max)));
+        u32 mask = (u32)_mm_movemask_ps(hit);
+        if (end - base < 4) {
+            mask &= (1u << (end - base)) - 1;
+        }
+        if (mask == 0) {
+            continue;
+        }
+        f32 ts[4];
+        _mm_storeu_ps(ts, t);
+        while (mask != 0) {
+            u32 lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (ts[lane] <= *t_max) {
+                *t_max = ts[lane];
+                best = base + lane;
+            }
+        }
+    }
+    return best;
+}
+
+SIMD_TARGET("avx2")
+static u32 sphere_intersect_n_avx2(
+    SphereStore *store, u32 first, u32 count, Ray *ray, f32 *t_max) {
+    u32 best = SPHERE_STORE_MISS;
+    u32 end = first + count;
+    __m256 ox = _mm256_set1_ps(ray->origin.x);
+    __m256 oy = _mm256_set1_ps(ray->origin.y);
+    __m256 oz = _mm256_set1_ps(ray->origin.z);
+    __m256 dx = _mm256_set1_ps(ray->direction.x);
+    __m256 dy = _mm256_set1_ps(ray->direction.y);
+    __m256 dz = _mm256_set1_ps(ray->direction.z);
+    __m256 zero = _mm256_setzero_ps();
+    for (u32 base = first; base < end; base += 8) {
+        __m256 cx = _mm256_sub_ps(_mm256_loadu_ps(store->cx + base), ox);
+        __m256 cy = _mm256_sub_ps(_mm256_loadu_ps(store->cy + base), oy);
+        __m256 cz = _mm256_sub_ps(_mm256_loadu_ps(store->cz + base), oz);
+        __m256 r2 = _mm256_loadu_ps(store->r2 + base);
+        // Distance along the ray to the point closest to the center, and the
+        // squared distance from the center to that point.
+        __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, dx),
+                                     _mm256_mul_ps(cy, dy)),
+            _mm256_mul_ps(cz, dz));
+        __m256 c2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, cx),
+                                      _mm256_mul_ps(cy, cy)),
+            _mm256_mul_ps(cz, cz));
+        __m256 offset = _mm256_sub_ps(c2, _mm256_mul_ps(b, b));
+        __m256 h =
+            _mm256_sqrt_ps(_mm256_max_ps(_mm256_sub_ps(r2, offset), zero));
+        __m256 t = _mm256_sub_ps(b, h);
+        // Rays pass within the radius, give or take the same tolerance as
+        // sphere_distance's, so every structure agrees on grazing hits.
+        __m256 hit = _mm256_cmp_ps(b, zero, _CMP_GE_OQ);
+        hit = _mm256_and_ps(hit,
+            _mm256_cmp_ps(offset, _mm256_add_ps(r2, _mm256_set1_ps(eps)),
+                _CMP_LE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+        hit = _mm256_and_ps(
+            hit, _mm256_cmp_ps(t, _mm256_set1_ps(*t_max), _CMP_LE_OQ));
+        u32 mask = (u32)_mm256_movemask_ps(hit);
+        if (end - base < 8) {
+            mask &= (1u << (end - base)) - 1;
+        }
+        if (mask == 0) {
+            continue;
+        }
+        f32 ts[8];
+        _mm256_storeu_ps(ts, t);
+        while (mask != 0) {
+            u32 lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (ts[lane] <= *t_max) {
+                *t_max = ts[lane];
+                best = base + lane;
+            }
+        }
+    }
+    return best;
+}
+
+SIMD_TARGET("avx512f")
+static u32 sphere_intersect_n_avx512(
+    SphereStore *store, u32 first, u32 count, Ray *ray, f32 *t_max) {
+    u32 best = SPHERE_STORE_MISS;
+    u32 end = first + count;
+    __m512 ox = _mm512_set1_ps(ray->origin.x);
+    __m512 oy = _mm512_set1_ps(ray->origin.y);
+    __m512 oz = _mm512_set1_ps(ray->origin.z);
+    __m512 dx = _mm512_set1_ps(ray->direction.x);
+    __m512 dy = _mm512_set1_ps(ray->direction.y);
+    __m512 dz = _mm512_set1_ps(ray->direction.z);
+    __m512 zero = _mm512_setzero_ps();
+    for (u32 base = first; base < end; base += 16) {
+        __m512 cx = _mm512_sub_ps(_mm512_loadu_ps(store->cx + base), ox);
+        __m512 cy = _mm512_sub_ps(_mm512_loadu_ps(store->cy + base), oy);
+        __m512 cz = _mm512_sub_ps(_mm512_loadu_ps(store->cz + base), oz);
+        __m512 r2 = _mm512_loadu_ps(store->r2 + base);
+        __m512 b = _mm512_add_ps(
+            _mm512_add_ps(_mm512_mul_ps(cx, dx), _mm512_mul_ps(cy, dy)),
+            _mm512_mul_ps(cz, dz));
+        __m512 c2 = _mm512_add_ps(
+            _mm512_add_ps(_mm512_mul_ps(cx, cx), _mm512_mul_ps(cy, cy)),
+            _mm512_mul_ps(cz, cz));
+        __m512 offset = _mm512_sub_ps(c2, _mm512_mul_ps(b, b));
+        __m512 h =
+            _mm512_sqrt_ps(_mm512_max_ps(_mm512_sub_ps(r2, offset), zero));
+        __m512 t = _mm512_sub_ps(b, h);
+        // The tail is masked off before the compares rather than after.
+        __mmask16 hit = end - base < 16 ? (__mmask16)((1u << (end - base)) - 1)
+                                        : (__mmask16)0xffff;
+        hit = _mm512_mask_cmp_ps_mask(hit, b, zero, _CMP_GE_OQ);
+        hit = _mm512_mask_cmp_ps_mask(hit, offset,
+            _mm512_add_ps(r2, _mm512_set1_ps(eps)), _CMP_LE_OQ);
+        hit = _mm512_mask_cmp_ps_mask(hit, t, zero, _CMP_GE_OQ);
+        hit = _mm512_mask_cmp_ps_mask(
+            hit, t, _mm512_set1_ps(*t_max), _CMP_LE_OQ);
+        u32 mask = (u32)hit;
+        if (mask == 0) {
+            continue;
+        }
+        f32 ts[16];
+        _mm512_storeu_ps(ts, t);
+        while (mask != 0) {
+            u32 lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (ts[lane] <= *t_max) {
+                *t_max = ts[lane];
+                best = base + lane;
+            }
+        }
+    }
+    return best;
+}
+
+#endif
+
+SphereKernelFn sphere_intersect_n = sphere_intersect_n_scalar;
+
+void sphere_store_select_kernel(SimdLevel level) {
+    sphere_intersect_n = sphere_intersect_n_scalar;
+#ifdef SIMD_X86
+    if (level >= SIMD_SSE42) {
+        sphere_intersect_n = sphere_intersect_n_sse42;
+    }
+    if (level >= SIMD_AVX2) {
+        sphere_intersect_n = sphere_intersect_n_avx2;
+    }
+    if (level >= SIMD_AVX512) {
+        sphere_intersect_n = sphere_intersect_n_avx512;
+    }
+#endif
+}
@@ -0,0 +1,84 @@
+#ifndef SPHERE_STORE_H
+#define SPHERE_STORE_H
+/**
+ * @file sphere_store.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief Spheres kept as structure-of-arrays, so one ray can be tested
+ * against several of them at a time.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#include "defs.h"
+#include "ray.h"
+#include "simd.h"
+#include "sphere.h"
+
+// The widest vector any kernel reads, which is sixteen lanes for AVX-512.
+#define SPHERE_STORE_WIDTH 16
+#define SPHERE_STORE_MISS 0xffffffffu
+
+/**
+ * @brief Sphere i has its center at (cx[i], cy[i], cz[i]), its squared
+ * radius in r2[i], and came from spheres[i], which was at index material[i]
+ * of the list the store was made from. The arrays are aligned to and padded
+ * past the vector width, with padding that is never hit, so a test may start
+ * at any sphere and read a full vector.
+ */
+typedef struct _SphereStore {
+    f32 *cx;
+    f32 *cy;
+    f32 *cz;
+    f32 *r2;
+    u32 *material;
+    Sphere **spheres;
+    u32 count;
+} SphereStore;
+
+/**
+ * @brief Copy spheres into a new store.
+ *
+ * @param spheres The spheres, in the order to store them.
+ * @param materials The index each sphere had originally, or NULL if the
+ * spheres are in their original order.
+ * @param count The number of spheres.
+ */
+SphereStore *new_sphere_store(Sphere **spheres, u32 *materials, u32 count);
+
+/**
+ * @brief Copy the centers and radii of the spheres into the store again,
+ * after they have moved.
+ */
+void sphere_store_update(SphereStore *store);
+
+/**
+ * @brief Like sphere_store_update, for count spheres from first.
+ */
+void sphere_store_update_range(SphereStore *store, u32 first, u32 count);
+
+void destroy_sphere_store(SphereStore *store);
+
+typedef u32 (*SphereKernelFn)(
+    SphereStore *store, u32 first, u32 count, Ray *ray, f32 *t_max);
+
+/**
+ * @brief Find the closest of count spheres from first that a ray hits nearer
+ * than *t_max, testing four, eight or sixteen spheres per step depending on
+ * the version picked by sphere_store_select_kernel.
+ *
+ * @param t_max The farthest distance to consider, lowered to the distance of
+ * the hit if there is one.
+ * @return u32 The index of the sphere hit, or SPHERE_STORE_MISS.
+ */
+extern SphereKernelFn sphere_intersect_n;
+
+/**
+ * @brief Point sphere_intersect_n at its version for a SIMD level.
+ */
+void sphere_store_select_kernel(SimdLevel level);
+
+#endif
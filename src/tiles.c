@@ -0,0 +1,264 @@
+#include "tiles.h"
+#include <string.h>
+#include "fail.h"
+#include "lbvh.h"
+#include "util.h"
+
+// Spread the low 16 bits of v out so there is a zero between every bit, and
+// back again.
+static u32 tile_morton_spread(u32 v) {
+    v &= 0x0000FFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+static u32 tile_morton_compact(u32 v) {
+    v &= 0x55555555;
+    v = (v | (v >> 1)) & 0x33333333;
+    v = (v | (v >> 2)) & 0x0F0F0F0F;
+    v = (v | (v >> 4)) & 0x00FF00FF;
+    v = (v | (v >> 8)) & 0x0000FFFF;
+    return v;
+}
+
+// The distance along the Hilbert curve through an n by n grid, n a power of
+// two, to the cell at x, y.
+static u64 tile_hilbert_index(u32 n, u32 x, u32 y) {
+    u64 d = 0;
+    for (u32 s = n / 2; s > 0; s /= 2) {
+        u32 rx = (x & s) > 0;
+        u32 ry = (y & s) > 0;
+        d += (u64)s * s * ((3 * rx) ^ ry);
+        // Turn the quadrant so the curve inside it starts where it enters.
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            u32 t = x;
+            x = y;
+            y = t;
+        }
+    }
+    return d;
+}
+
+// Lay out the tiles in the order they are to be dealt out in.
+static void tile_sequence(TileScheduler *sched) {
+    u32 count = sched->tile_count;
+    for (u32 i = 0; i < count; i++) {
+        sched->sequence[i] = i;
+    }
+    if (sched->order == TILE_ORDER_SCANLINE || count == 0) {
+        return;
+    }
+    u32 side = 1, bits = 0;
+    while (side < sched->tiles_w || side < sched->tiles_h) {
+        side *= 2;
+        bits++;
+    }
+    u64 *keys = malloc(sizeof(u64) * count);
+    if (keys == NULL) {
+        failwith("tile_sequence: could not allocate memory!\n");
+    }
+    for (u32 i = 0; i < count; i++) {
+        u32 x = i % sched->tiles_w;
+        u32 y = i / sched->tiles_w;
+        keys[i] = sched->order == TILE_ORDER_HILBERT
+                      ? tile_hilbert_index(side, x, y)
+                      : tile_morton_spread(x) | tile_morton_spread(y) << 1;
+    }
+    radix_sort_u64(keys, sched->sequence, count, 2 * bits > 0 ? 2 * bits : 1,
+        1);
+    free(keys);
+}
+
+TileScheduler *new_tile_scheduler(u32 width, u32 height, u32 tile_size,
+    u32 threads, TileOrder order) {
+    TileScheduler *sched = malloc(sizeof(TileScheduler));
+    if (sched == NULL) {
+        failwith("new_tile_scheduler: could not allocate memory!\n");
+    }
+    sched->width = width;
+    sched->height = height;
+    sched->tile_size = tile_size > 0 ? tile_size : TILE_DEFAULT_SIZE;
+    sched->tiles_w = (width + sched->tile_size - 1) / sched->tile_size;
+    sched->tiles_h = (height + sched->tile_size - 1) / sched->tile_size;
+    sched->tile_count = sched->tiles_w * sched->tiles_h;
+    sched->threads = threads > 0 ? threads : 1;
+    sched->order = order;
+    sched->sequence = malloc(sizeof(u32) * (sched->tile_count + 1));
+    if (sched->sequence == NULL) {
+        failwith("new_tile_scheduler: could not allocate memory!\n");
+    }
+    tile_sequence(sched);
+    sched->deques =
+        aligned_malloc(sizeof(TileDeque), sizeof(TileDeque) * sched->threads);
+    for (u32 t = 0; t < sched->threads; t++) {
+        TileDeque *deque = &sched->deques[t];
+        deque->lock = 0;
+        // Room for every tile, as steals can move any of them here.
+        deque->tiles = malloc(sizeof(u32) * (sched->tile_count + 1));
+        if (deque->tiles == NULL) {
+            failwith("new_tile_scheduler: could not allocate memory!\n");
+        }
+    }
+    tile_scheduler_reset(sched);
+    return sched;
+}
+
+void tile_scheduler_reset(TileScheduler *sched) {
+    tile_scheduler_pass(sched, 1, 0);
+}
+
+void tile_scheduler_pass(TileScheduler *sched, u32 step, u32 coarser) {
+    sched->step = step > 0 ? step : 1;
+    sched->coarser = coarser;
+    for (u32 t = 0; t < sched->threads; t++) {
+        TileDeque *deque = &sched->deques[t];
+        u32 first = (u32)((u64)sched->tile_count * t / sched->threads);
+        u32 last = (u32)((u64)sched->tile_count * (t + 1) / sched->threads);
+        for (u32 i = first; i < last; i++) {
+            deque->tiles[i - first] = sched->sequence[i];
+        }
+        deque->head = 0;
+        deque->tail = last - first;
+        deque->taken = 0;
+        deque->steals = 0;
+    }
+}
+
+Tile tile_scheduler_tile(TileScheduler *sched, u32 index) {
+    u32 x = (index % sched->tiles_w) * sched->tile_size;
+    u32 y = (index / sched->tiles_w) * sched->tile_size;
+    return (Tile){
+        .x = x,
+        .y = y,
+        .w = sched->width - x < sched->tile_size ? sched->width - x
+                                                 : sched->tile_size,
+        .h = sched->height - y < sched->tile_size ? sched->height - y
+                                                  : sched->tile_size,
+        .step = sched->step,
+        .coarser = sched->coarser,
+    };
+}
+
+// Move the back half of a victim's tiles over to an empty deque, handing the
+// first of them straight back.
+static bool tile_steal(TileDeque *own, TileDeque *victim, u32 *index) {
+    SDL_AtomicLock(&victim->lock);
+    u32 left = victim->tail - victim->head;
+    if (left == 0) {
+        SDL_AtomicUnlock(&victim->lock);
+        return false;
+    }
+    u32 take = (left + 1) / 2;
+    u32 *stolen = &victim->tiles[victim->tail - take];
+    *index = stolen[0];
+    // No thief reads our tiles while the deque is empty, so they can be
+    // written before it is locked.
+    for (u32 i = 1; i < take; i++) {
+        own->tiles[i - 1] = stolen[i];
+    }
+    victim->tail -= take;
+    SDL_AtomicUnlock(&victim->lock);
+
+    SDL_AtomicLock(&own->lock);
+    own->head = 0;
+    own->tail = take - 1;
+    SDL_AtomicUnlock(&own->lock);
+    return true;
+}
+
+bool tile_scheduler_next(TileScheduler *sched, u32 thread, Tile *tile) {
+    TileDeque *own = &sched->deques[thread];
+    u32 index = 0;
+    bool found = false;
+    SDL_AtomicLock(&own->lock);
+    if (own->head < own->tail) {
+        index = own->tiles[own->head++];
+        found = true;
+    }
+    SDL_AtomicUnlock(&own->lock);
+    for (u32 k = 1; !found && k < sched->threads; k++) {
+        TileDeque *victim = &sched->deques[(thread + k) % sched->threads];
+        found = tile_steal(own, victim, &index);
+        own->steals += found;
+    }
+    if (!found) {
+        return false;
+    }
+    own->taken++;
+    *tile = tile_scheduler_tile(sched, index);
+    return true;
+}
+
+// Whether a pixel is in a tile's pass.
+static bool tile_in_pass(Tile *tile, u32 x, u32 y) {
+    if (x % tile->step != 0 || y % tile->step != 0) {
+        return false;
+    }
+    return tile->coarser == 0 || x % tile->coarser != 0 ||
+           y % tile->coarser != 0;
+}
+
+u32 tile_pixels(TileScheduler *sched, Tile *tile, u32 *pixels) {
+    u32 n = 0;
+    u32 step = tile->step;
+    u32 coarser = tile->coarser;
+    if (sched->order != TILE_ORDER_SCANLINE) {
+        u32 side = 1;
+        while (side < tile->w || side < tile->h) {
+            side *= 2;
+        }
+        // Codes that land outside a tile cut short by the canvas are skipped.
+        for (u32 code = 0; code < side * side; code++) {
+            u32 x = tile->x + tile_morton_compact(code);
+            u32 y = tile->y + tile_morton_compact(code >> 1);
+            if (x < tile->x + tile->w && y < tile->y + tile->h &&
+                tile_in_pass(tile, x, y)) {
+                pixels[n++] = y * sched->width + x;
+            }
+        }
+        return n;
+    }
+    for (u32 y = tile->y; y < tile->y + tile->h; y += step) {
+        // On rows of the coarser pass, skip its pixels.
+        bool coarse_row = coarser > 0 && y % coarser == 0;
+        for (u32 x = tile->x; x < tile->x + tile->w; x += step) {
+            if (!coarse_row || x % coarser != 0) {
+                pixels[n++] = y * sched->width + x;
+            }
+        }
+    }
+    return n;
+}
+
+static const char *tile_order_names[] = {"scanline", "morton", "hilbert"};
+
+bool tile_order_parse(const char *name, TileOrder *out) {
+    for (u32 i = 0; i < sizeof(tile_order_names) / sizeof(tile_order_names[0]);
+         i++) {
+        if (strcmp(name, tile_order_names[i]) == 0) {
+            *out = (TileOrder)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *tile_order_name(TileOrder order) {
+    return tile_order_names[order];
+}
+
+void destroy_tile_scheduler(TileScheduler *sched) {
+    for (u32 t = 0; t < sched->threads; t++) {
+        free(sched->deques[t].tiles);
+    }
+    aligned_free(sched->deques);
+    free(sched->sequence);
+    free(sched);
+}
@@ -0,0 +1,150 @@
+#ifndef TILES_H
+#define TILES_H
+/**
+ * @file tiles.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief Hands out the tiles of a frame to render threads. Each thread starts
+ * with a contiguous share of the tiles in a deque of its own, and once it runs
+ * dry it steals half of what is left in another thread's deque, so threads
+ * that drew cheap tiles help out with the expensive ones. Tiles can be dealt
+ * out along a space-filling curve, and their pixels visited in Z-order, so
+ * that work done one after the other looks at the same part of the scene.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#define SDL_MAIN_HANDLED
+#include <SDL2/SDL.h>
+#include "defs.h"
+
+#define TILE_DEFAULT_SIZE 16
+
+/**
+ * @brief The order tiles are dealt out in, and pixels visited in within them.
+ * With scanline order both go row by row; with Morton order tiles follow the
+ * Z-order curve, and with Hilbert order the Hilbert curve, and in both cases
+ * the pixels of a tile follow the Z-order curve.
+ */
+typedef enum _TileOrder {
+    TILE_ORDER_SCANLINE,
+    TILE_ORDER_MORTON,
+    TILE_ORDER_HILBERT,
+} TileOrder;
+
+/**
+ * @brief A rectangle of pixels, clipped to the canvas, and the pass over it:
+ * every step-th pixel of every step-th row, bar the pixels the coarser pass
+ * already covered.
+ */
+typedef struct _Tile {
+    u32 x;
+    u32 y;
+    u32 w;
+    u32 h;
+    u32 step;
+    u32 coarser;
+} Tile;
+
+/**
+ * @brief One thread's tiles. The owner takes them from the head, in order,
+ * and thieves take from the tail. Each deque sits on a cache line of its own.
+ */
+typedef struct __attribute__((aligned(64))) _TileDeque {
+    SDL_SpinLock lock;
+    u32 head;
+    u32 tail;
+    u32 *tiles;
+    // How many tiles and steals the owner has had this frame.
+    u32 taken;
+    u32 steals;
+} TileDeque;
+
+typedef struct _TileScheduler {
+    u32 width;
+    u32 height;
+    u32 tile_size;
+    u32 tiles_w;
+    u32 tiles_h;
+    u32 tile_count;
+    u32 threads;
+    TileDeque *deques;
+    TileOrder order;
+    // The tile indices in the order they are dealt out.
+    u32 *sequence;
+    // The pass the tiles are handed out for, see Tile.
+    u32 step;
+    u32 coarser;
+} TileScheduler;
+
+/**
+ * @brief Cut a canvas into square tiles and deal them out to the threads.
+ *
+ * @param tile_size The side of a tile; the last row and column may be cut
+ * short by the canvas.
+ * @param threads How many threads will ask for tiles, each with its own id
+ * below this.
+ * @param order The order tiles are dealt out in; each thread gets a
+ * contiguous run of them.
+ */
+TileScheduler *new_tile_scheduler(u32 width, u32 height, u32 tile_size,
+    u32 threads, TileOrder order);
+
+/**
+ * @brief Deal the tiles out again for a new frame, to be rendered in full. No
+ * thread may be asking for tiles meanwhile.
+ */
+void tile_scheduler_reset(TileScheduler *sched);
+
+/**
+ * @brief Like tile_scheduler_reset, but for a pass over only some pixels of
+ * every tile, for rendering coarse to fine.
+ *
+ * @param step Only every step-th pixel of every step-th row is in the pass.
+ * The tile size should be a multiple of it.
+ * @param coarser The step of the pass before, whose pixels are left out, or 0
+ * if there was none.
+ */
+void tile_scheduler_pass(TileScheduler *sched, u32 step, u32 coarser);
+
+/**
+ * @brief Take the next tile for a thread, stealing one if its own deque is
+ * empty.
+ *
+ * @param thread The id of the calling thread.
+ * @param tile Set to the tile.
+ * @return bool False once every tile of the frame has been handed out.
+ */
+bool tile_scheduler_next(TileScheduler *sched, u32 thread, Tile *tile);
+
+/**
+ * @brief The tile with an index, counting row by row across the canvas. The
+ * deques hold tiles by index.
+ */
+Tile tile_scheduler_tile(TileScheduler *sched, u32 index);
+
+/**
+ * @brief List the pixels of a tile's pass as indices into the canvas, row by
+ * row in scanline order and along the Z-order curve otherwise.
+ *
+ * @param pixels Room for tile_size * tile_size indices.
+ * @return u32 How many pixels the tile has.
+ */
+u32 tile_pixels(TileScheduler *sched, Tile *tile, u32 *pixels);
+
+/**
+ * @brief Parse an order name, as given on the command line: scanline, morton
+ * or hilbert.
+ *
+ * @return bool Whether the name was recognized.
+ */
+bool tile_order_parse(const char *name, TileOrder *out);
+
+const char *tile_order_name(TileOrder order);
+
+void destroy_tile_scheduler(TileScheduler *sched);
+
+#endif
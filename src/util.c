@@ -7,6 +7,11 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
 
 /**
  * @brief Checks if a char exists in a string.
@@ -44,3 +49,78 @@ char *read_file(char *path)
     contents[fsize] = '\0';
     return contents;
 }
+
+void *aligned_malloc(size_t alignment, size_t size)
+{
+    size = (size + alignment - 1) & ~(alignment - 1);
+#ifdef _WIN32
+    void *pointer = _aligned_malloc(size, alignment);
+#else
+    void *pointer = aligned_alloc(alignment, size);
+#endif
+    if (pointer == NULL && size > 0) {
+        failwithf("Could not allocate %zu bytes aligned to %zu.\n", size, alignment);
+    }
+    return pointer;
+}
+
+void aligned_free(void *pointer)
+{
+#ifdef _WIN32
+    _aligned_free(pointer);
+#else
+    free(pointer);
+#endif
+}
+
+char *map_file(const char *path, size_t *size)
+{
+#ifdef _WIN32
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        failwithf("Could not open '%s'!\n", path);
+    }
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *contents = malloc(*size > 0 ? *size : 1);
+    if (contents == NULL || fread(contents, 1, *size, fp) != *size) {
+        failwithf("Could not read %zu bytes from '%s'!\n", *size, path);
+    }
+    fclose(fp);
+    return contents;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        failwithf("Could not open '%s'!\n", path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        failwithf("Could not stat '%s'!\n", path);
+    }
+    *size = (size_t)info.st_size;
+    if (*size == 0) {
+        close(fd);
+        return NULL;
+    }
+    char *contents = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (contents == MAP_FAILED) {
+        failwithf("Could not map %zu bytes from '%s'!\n", *size, path);
+    }
+    // It is read front to back, in one chunk per thread.
+    madvise(contents, *size, MADV_SEQUENTIAL);
+    return contents;
+#endif
+}
+
+void unmap_file(char *contents, size_t size)
+{
+#ifdef _WIN32
+    free(contents);
+#else
+    if (contents != NULL) {
+        munmap(contents, size);
+    }
+#endif
+}
@@ -2,6 +2,7 @@
 #define UTIL_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 /**
  * @brief Checks if a char exists in a string.
@@ -24,4 +25,28 @@ void char_replace(char* string, char before, char after);
 
 char *read_file(char* path);
 
+/**
+ * @brief Allocate memory whose address is a multiple of the given alignment.
+ * It must be released with aligned_free, not free.
+ *
+ * @param alignment A power of two.
+ * @param size The number of bytes, rounded up to a multiple of the alignment.
+ */
+void *aligned_malloc(size_t alignment, size_t size);
+
+void aligned_free(void *pointer);
+
+/**
+ * @brief Map a file into memory read-only, so it can be read without copying
+ * it first. Where mapping is not available, the file is read into memory.
+ * It must be released with unmap_file.
+ *
+ * @param path The file to map.
+ * @param size Set to the size of the file in bytes.
+ * @return char* The contents, which are not zero terminated.
+ */
+char *map_file(const char *path, size_t *size);
+
+void unmap_file(char *contents, size_t size);
+
 #endif
\ No newline at end of file
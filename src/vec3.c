@@ -59,3 +59,15 @@ f32 vmin(Vec3 v) {
 f32 vmax(Vec3 v) {
     return max(max(v.x, v.y), v.z);
 }
+
+f32 vaxis(Vec3 v, u8 axis) {
+    return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+f32 minf(f32 a, f32 b) {
+    return a < b ? a : b;
+}
+
+f32 maxf(f32 a, f32 b) {
+    return a > b ? a : b;
+}
@@ -14,7 +14,7 @@
 
 #include "defs.h"
 
-typedef struct __attribute__((packed)) _Vec3
+typedef struct _Vec3
 {
     f32 x;
     f32 y;
@@ -47,4 +47,17 @@ f32 vmin(Vec3 v);
 
 f32 vmax(Vec3 v);
 
+/**
+ * @brief Get a component by index, 0 is x, 1 is y and 2 is z.
+ */
+f32 vaxis(Vec3 v, u8 axis);
+
+/**
+ * @brief Like fminf and fmaxf, minus the NaN handling, so they compile down
+ * to a single instruction. When either argument is NaN, b is returned.
+ */
+f32 minf(f32 a, f32 b);
+
+f32 maxf(f32 a, f32 b);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include "wavefront.h"
+#include "fail.h"
+#include "util.h"
+#include <math.h>
+
+#define WAVEFRONT_ALIGNMENT 64
+
+static f32 *wavefront_floats(u32 capacity) {
+    return aligned_malloc(WAVEFRONT_ALIGNMENT, sizeof(f32) * capacity);
+}
+
+Wavefront *new_wavefront(u32 capacity) {
+    Wavefront *wf = malloc(sizeof(Wavefront));
+    if (wf == NULL) {
+        failwith("new_wavefront: could not allocate memory!\n");
+    }
+    capacity = capacity > 0 ? capacity : 1;
+    wf->capacity = capacity;
+    wf->count = 0;
+    wf->dark_count = 0;
+    f32 **floats[] = {&wf->ox, &wf->oy, &wf->oz, &wf->dx, &wf->dy, &wf->dz,
+        &wf->px, &wf->py, &wf->pz, &wf->nx, &wf->ny, &wf->nz, &wf->cr,
+        &wf->cg, &wf->cb, &wf->sox, &wf->soy, &wf->soz, &wf->sdx, &wf->sdy,
+        &wf->sdz, &wf->st_max};
+    for (u32 i = 0; i < sizeof(floats) / sizeof(floats[0]); i++) {
+        *floats[i] = wavefront_floats(capacity);
+    }
+    wf->pixel = aligned_malloc(WAVEFRONT_ALIGNMENT, sizeof(u32) * capacity);
+    wf->dark = aligned_malloc(WAVEFRONT_ALIGNMENT, sizeof(u32) * capacity);
+    wf->hit = aligned_malloc(WAVEFRONT_ALIGNMENT, sizeof(bool) * capacity);
+    wf->rays = malloc(sizeof(Ray) * BVH_PACKET_MAX);
+    wf->hits = malloc(sizeof(HitOption) * BVH_PACKET_MAX);
+    if (wf->rays == NULL || wf->hits == NULL) {
+        failwith("new_wavefront: could not allocate memory!\n");
+    }
+    return wf;
+}
+
+// Load the camera rays of a list of pixels into the wave.
+static void wavefront_generate(
+    Wavefront *wf, Ray *rays, u32 *pixels, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+        Ray *ray = &rays[pixels[i]];
+        wf->ox[i] = ray->origin.x;
+        wf->oy[i] = ray->origin.y;
+        wf->oz[i] = ray->origin.z;
+        wf->dx[i] = ray->direction.x;
+        wf->dy[i] = ray->direction.y;
+        wf->dz[i] = ray->direction.z;
+        wf->pixel[i] = pixels[i];
+    }
+    wf->count = count;
+}
+
+// Find what every ray of the wave hits, a packet at a time.
+static void wavefront_closest(Wavefront *wf, Scene *scene) {
+    for (u32 first = 0; first < wf->count; first += BVH_PACKET_MAX) {
+        u32 n = wf->count - first < BVH_PACKET_MAX ? wf->count - first
+                                                   : BVH_PACKET_MAX;
+        for (u32 i = 0; i < n; i++) {
+            u32 j = first + i;
+            wf->rays[i].origin = vec3(wf->ox[j], wf->oy[j], wf->oz[j]);
+            wf->rays[i].direction = vec3(wf->dx[j], wf->dy[j], wf->dz[j]);
+        }
+        cast_packet(scene, wf->rays, n, wf->hits);
+        for (u32 i = 0; i < n; i++) {
+            u32 j = first + i;
+            wf->hit[j] = is_some(wf->hits[i]);
+            if (!wf->hit[j]) {
+                continue;
+            }
+            Hit *hit = &wf->hits[i].value;
+            wf->px[j] = hit->position.x;
+            wf->py[j] = hit->position.y;
+            wf->pz[j] = hit->position.z;
+            wf->nx[j] = hit->norm.x;
+            wf->ny[j] = hit->norm.y;
+            wf->nz[j] = hit->norm.z;
+            wf->cr[j] = hit->color.x;
+            wf->cg[j] = hit->color.y;
+            wf->cb[j] = hit->color.z;
+        }
+    }
+    wf->dark_count = 0;
+    for (u32 i = 0; i < wf->count; i++) {
+        if (wf->hit[i]) {
+            wf->dark[wf->dark_count++] = i;
+        }
+    }
+}
+
+// Set up the shadow ray from every hit still in the dark towards a light, the
+// same way trace_ray does.
+static void wavefront_shadow_rays(Wavefront *wf, Light light) {
+    for (u32 k = 0; k < wf->dark_count; k++) {
+        u32 i = wf->dark[k];
+        f32 ox = wf->px[i] + wf->nx[i] * 0.01f;
+        f32 oy = wf->py[i] + wf->ny[i] * 0.01f;
+        f32 oz = wf->pz[i] + wf->nz[i] * 0.01f;
+        f32 tx = light.position.x - ox;
+        f32 ty = light.position.y - oy;
+        f32 tz = light.position.z - oz;
+        f32 m = sqrtf(tx * tx + ty * ty + tz * tz);
+        wf->sox[k] = ox;
+        wf->soy[k] = oy;
+        wf->soz[k] = oz;
+        wf->sdx[k] = tx / m;
+        wf->sdy[k] = ty / m;
+        wf->sdz[k] = tz / m;
+        wf->st_max[k] = m;
+    }
+}
+
+// Trace the shadow rays, keeping only the hits the light does not reach.
+static void wavefront_occlusion(
+    Wavefront *wf, Scene *scene, u32 light, ShadowCache *cache) {
+    u32 still_dark = 0;
+    for (u32 k = 0; k < wf->dark_count; k++) {
+        Ray ray = {
+            .origin = vec3(wf->sox[k], wf->soy[k], wf->soz[k]),
+            .direction = vec3(wf->sdx[k], wf->sdy[k], wf->sdz[k]),
+        };
+        if (shadow_occluded(scene, &ray, wf->st_max[k], light, cache)) {
+            wf->dark[still_dark++] = wf->dark[k];
+        }
+    }
+    wf->dark_count = still_dark;
+}
+
+// Black out the hits no light reached and write every hit to its pixel.
+static void wavefront_shade(Wavefront *wf, u32 *raster) {
+    for (u32 k = 0; k < wf->dark_count; k++) {
+        u32 i = wf->dark[k];
+        wf->cr[i] = 0.0f;
+        wf->cg[i] = 0.0f;
+        wf->cb[i] = 0.0f;
+    }
+    for (u32 i = 0; i < wf->count; i++) {
+        if (wf->hit[i]) {
+            raster[wf->pixel[i]] =
+                color_to_pixel(vec3(wf->cr[i], wf->cg[i], wf->cb[i]));
+        }
+    }
+}
+
+void wavefront_render(Wavefront *wf, Scene *scene, Ray *rays, u32 *pixels,
+    u32 count, u32 *raster, ShadowCache *cache) {
+    u32 light_count = scene_light_count(scene);
+    for (u32 done = 0; done < count; done += wf->capacity) {
+        u32 n = count - done < wf->capacity ? count - done : wf->capacity;
+        wavefront_generate(wf, rays, pixels + done, n);
+        wavefront_closest(wf, scene);
+        for (u32 l = 0; l < light_count && wf->dark_count > 0; l++) {
+            wavefront_shadow_rays(wf, scene_get_light(scene, l));
+            wavefront_occlusion(wf, scene, l, cache);
+        }
+        wavefront_shade(wf, raster);
+    }
+}
+
+void destroy_wavefront(Wavefront *wf) {
+    f32 *floats[] = {wf->ox, wf->oy, wf->oz, wf->dx, wf->dy, wf->dz, wf->px,
+        wf->py, wf->pz, wf->nx, wf->ny, wf->nz, wf->cr, wf->cg, wf->cb,
+        wf->sox, wf->soy, wf->soz, wf->sdx, wf->sdy, wf->sdz, wf->st_max};
+    for (u32 i = 0; i < sizeof(floats) / sizeof(floats[0]); i++) {
+        aligned_free(floats[i]);
+    }
+    aligned_free(wf->pixel);
+    aligned_free(wf->dark);
+    aligned_free(wf->hit);
+    free(wf->rays);
+    free(wf->hits);
+    free(wf);
+}
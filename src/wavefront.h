@@ -0,0 +1,76 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+/**
+ * @file wavefront.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief Rendering in waves: instead of taking each pixel through the whole
+ * pipeline in turn, every stage runs over the queue of a whole wave of rays
+ * before the next one starts, with rays and hits kept one array per
+ * component.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#include "defs.h"
+#include "ray.h"
+#include "scene.h"
+
+#define WAVEFRONT_DEFAULT_SIZE 16384
+
+/**
+ * @brief The queues of one wave. Rays are indexed by their place in the wave,
+ * and shadow rays by their place in the queue of hits that no light has
+ * reached yet.
+ */
+typedef struct _Wavefront {
+    u32 capacity;
+    u32 count;
+    // The camera rays, and the pixel each one belongs to.
+    f32 *ox, *oy, *oz;
+    f32 *dx, *dy, *dz;
+    u32 *pixel;
+    // What each ray hit, if anything.
+    bool *hit;
+    f32 *px, *py, *pz;
+    f32 *nx, *ny, *nz;
+    f32 *cr, *cg, *cb;
+    // The hits that no light has reached so far, and their shadow rays
+    // towards the light being tested.
+    u32 *dark;
+    u32 dark_count;
+    f32 *sox, *soy, *soz;
+    f32 *sdx, *sdy, *sdz;
+    f32 *st_max;
+    // Room for a batch of rays to go through the scene's queries together.
+    Ray *rays;
+    HitOption *hits;
+} Wavefront;
+
+/**
+ * @brief Make the queues for waves of up to capacity rays. Each thread needs
+ * its own.
+ */
+Wavefront *new_wavefront(u32 capacity);
+
+/**
+ * @brief Render a list of pixels in waves. Each wave goes through generation,
+ * closest hits, shadow ray generation, occlusion and shading, one stage at a
+ * time, and ends up the same as tracing its pixels one by one with
+ * trace_ray.
+ *
+ * @param rays The rays from setup_perspective_rays.
+ * @param pixels The indices of the pixels, and of their rays.
+ * @param count How many pixels.
+ * @param raster Where the colors of the pixels that hit something go.
+ * @param cache The calling thread's shadow cache, or NULL to go without.
+ */
+void wavefront_render(Wavefront *wf, Scene *scene, Ray *rays, u32 *pixels,
+    u32 count, u32 *raster, ShadowCache *cache);
+
+void destroy_wavefront(Wavefront *wf);
+
+#endif
@@ -0,0 +1,221 @@
+#include "wbvh.h"
+#include "fail.h"
+#include "util.h"
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+
+// Every node visited pushes at most W - 1 more than it pops.
+#define WBVH_STACK_SIZE (BVH_MAX_DEPTH * 8)
+
+#define define_WBVH(W)                                                          \
+    static void wbvh##W##_set_child(WBVH##W##Node *node, u32 slot,              \
+        AABB *bounds, u32 child, u32 count) {                                   \
+        node->bounds[0][slot] = bounds->min.x;                                  \
+        node->bounds[1][slot] = bounds->min.y;                                  \
+        node->bounds[2][slot] = bounds->min.z;                                  \
+        node->bounds[3][slot] = bounds->max.x;                                  \
+        node->bounds[4][slot] = bounds->max.y;                                  \
+        node->bounds[5][slot] = bounds->max.z;                                  \
+        node->child[slot] = child;                                              \
+        node->count[slot] = count;                                              \
+    }                                                                           \
+                                                                                \
+    static void wbvh##W##_clear_node(WBVH##W##Node *node) {                     \
+        for (u32 slot = 0; slot < W; slot++) {                                  \
+            for (u32 row = 0; row < 6; row++) {                                 \
+                node->bounds[row][slot] = NAN;                                  \
+            }                                                                   \
+            node->child[slot] = WBVH_EMPTY;                                     \
+            node->count[slot] = 0;                                              \
+        }                                                                       \
+    }                                                                           \
+                                                                                \
+    /* Collapse the binary subtree at from into the wide node at to, opening */ \
+    /* the widest interior children until there are W of them.               */ \
+    static void wbvh##W##_collapse(                                             \
+        WBVH##W *wbvh, BVH *bvh, u32 from, u32 to, u32 depth) {                 \
+        if (depth > wbvh->depth) {                                              \
+            wbvh->depth = depth;                                                \
+        }                                                                       \
+        BVHNode *source = &bvh->nodes[from];                                    \
+        u32 children[W];                                                        \
+        u32 child_count = 2;                                                    \
+        children[0] = source->left_first;                                       \
+        children[1] = source->left_first + 1;                                   \
+        while (child_count < W) {                                               \
+            i32 widest = -1;                                                    \
+            f32 widest_area = -1.0f;                                            \
+            for (u32 i = 0; i < child_count; i++) {                             \
+                BVHNode *child = &bvh->nodes[children[i]];                      \
+                f32 area = aabb_half_area(child->bounds);                       \
+                if (child->count == 0 && area > widest_area) {                  \
+                    widest = i;                                                 \
+                    widest_area = area;                                         \
+                }                                                               \
+            }                                                                   \
+            if (widest < 0) {                                                   \
+                break;                                                          \
+            }                                                                   \
+            u32 opened = bvh->nodes[children[widest]].left_first;               \
+            children[widest] = opened;                                          \
+            children[child_count++] = opened + 1;                               \
+        }                                                                       \
+        WBVH##W##Node *node = &wbvh->nodes[to];                                 \
+        wbvh##W##_clear_node(node);                                             \
+        for (u32 i = 0; i < child_count; i++) {                                 \
+            BVHNode *child = &bvh->nodes[children[i]];                          \
+            if (child->count > 0) {                                             \
+                wbvh##W##_set_child(node, i, &child->bounds,                    \
+                    child->left_first, child->count);                           \
+                wbvh->leaf_count++;                                             \
+            } else {                                                            \
+                u32 index = wbvh->node_count++;                                 \
+                wbvh##W##_set_child(node, i, &child->bounds, index, 0);         \
+            }                                                                   \
+        }                                                                       \
+        for (u32 i = 0; i < child_count; i++) {                                 \
+            if (node->count[i] == 0) {                                          \
+                wbvh##W##_collapse(                                             \
+                    wbvh, bvh, children[i], node->child[i], depth + 1);         \
+                node = &wbvh->nodes[to];                                        \
+            }                                                                   \
+        }                                                                       \
+    }                                                                           \
+                                                                                \
+    WBVH##W *new_wbvh##W(BVH *bvh) {                                            \
+        WBVH##W *wbvh = malloc(sizeof(WBVH##W));                                \
+        wbvh->spheres = bvh->spheres;                                           \
+        wbvh->store = bvh->store;                                               \
+        wbvh->sphere_count = bvh->sphere_count;                                 \
+        wbvh->node_count = 1;                                                   \
+        wbvh->leaf_count = 0;                                                   \
+        wbvh->depth = 1;                                                        \
+        /* A wide tree never has more nodes than the binary one. */             \
+        wbvh->nodes = aligned_malloc(                                           \
+            64, sizeof(WBVH##W##Node) * (bvh->node_count + 1));                 \
+        if (bvh->node_count == 0 || bvh->nodes[0].count > 0) {                  \
+            wbvh##W##_clear_node(&wbvh->nodes[0]);                              \
+            if (bvh->sphere_count > 0) {                                        \
+                wbvh##W##_set_child(&wbvh->nodes[0], 0,                         \
+                    &bvh->nodes[0].bounds, 0, bvh->sphere_count);               \
+                wbvh->leaf_count = 1;                                           \
+            }                                                                   \
+        } else {                                                                \
+            wbvh##W##_collapse(wbvh, bvh, 0, 0, 1);                             \
+        }                                                                       \
+        free(bvh->nodes);                                                       \
+        free(bvh);                                                              \
+        return wbvh;                                                            \
+    }                                                                           \
+                                                                                \
+    u32 wbvh##W##_closest(WBVH##W *wbvh, Ray *ray, f32 *t) {                    \
+        u32 closest = SPHERE_STORE_MISS;                                        \
+        f32 closest_dist = FLT_MAX;                                             \
+        Vec3 inv_dir = safe_inverse(ray->direction);                            \
+        u32 stack[WBVH_STACK_SIZE];                                             \
+        f32 stack_t[WBVH_STACK_SIZE];                                           \
+        u32 sp = 0;                                                             \
+        stack[sp] = 0;                                                          \
+        stack_t[sp++] = 0.0f;                                                   \
+        while (sp > 0) {                                                        \
+            sp--;                                                               \
+            if (stack_t[sp] > closest_dist) {                                   \
+                continue;                                                       \
+            }                                                                   \
+            WBVH##W##Node *node = &wbvh->nodes[stack[sp]];                      \
+            f32 t_near[W];                                                      \
+            u32 mask = slabs##W(&node->bounds[0][0], W, ray->origin, inv_dir,   \
+                closest_dist, t_near);                                          \
+            u32 inner[W];                                                       \
+            f32 inner_t[W];                                                     \
+            u32 inner_count = 0;                                                \
+            while (mask != 0) {                                                 \
+                u32 slot = __builtin_ctz(mask);                                 \
+                mask &= mask - 1;                                               \
+                if (node->count[slot] == 0) {                                   \
+                    /* Keep them farthest first so the nearest is popped */     \
+                    /* first.                                            */     \
+                    u32 j = inner_count++;                                      \
+                    while (j > 0 && inner_t[j - 1] < t_near[slot]) {            \
+                        inner[j] = inner[j - 1];                                \
+                        inner_t[j] = inner_t[j - 1];                            \
+                        j--;                                                    \
+                    }                                                           \
+                    inner[j] = node->child[slot];                               \
+                    inner_t[j] = t_near[slot];                                  \
+                    continue;                                                   \
+                }                                                               \
+                u32 hit = sphere_intersect_n(wbvh->store, node->child[slot],    \
+                    node->count[slot], ray, &closest_dist);                     \
+                if (hit != SPHERE_STORE_MISS) {                                 \
+                    closest = hit;                                              \
+                }                                                               \
+            }                                                                   \
+            for (u32 i = 0; i < inner_count; i++) {                             \
+                if (inner_t[i] <= closest_dist) {                               \
+                    stack[sp] = inner[i];                                       \
+                    stack_t[sp++] = inner_t[i];                                 \
+                }                                                               \
+            }                                                                   \
+        }                                                                       \
+        *t = closest_dist;                                                      \
+        return closest;                                                         \
+    }                                                                           \
+                                                                                \
+    HitOption wbvh##W##_intersect(WBVH##W *wbvh, Ray *ray) {                    \
+        f32 t;                                                                  \
+        u32 closest = wbvh##W##_closest(wbvh, ray, &t);                         \
+        if (closest == SPHERE_STORE_MISS) {                                     \
+            return no_Hit();                                                    \
+        }                                                                       \
+        return sphere_intersect(wbvh->spheres[closest], ray);                   \
+    }                                                                           \
+                                                                                \
+    bool wbvh##W##_occluded(                                                    \
+        WBVH##W *wbvh, Ray *ray, f32 t_max, u32 *occluder) {                    \
+        Vec3 inv_dir = safe_inverse(ray->direction);                            \
+        u32 stack[WBVH_STACK_SIZE];                                             \
+        u32 sp = 0;                                                             \
+        stack[sp++] = 0;                                                        \
+        while (sp > 0) {                                                        \
+            WBVH##W##Node *node = &wbvh->nodes[stack[--sp]];                    \
+            f32 t_near[W];                                                      \
+            u32 mask = slabs##W(&node->bounds[0][0], W, ray->origin, inv_dir,   \
+                t_max, t_near);                                                 \
+            while (mask != 0) {                                                 \
+                u32 slot = __builtin_ctz(mask);                                 \
+                mask &= mask - 1;                                               \
+                if (node->count[slot] == 0) {                                   \
+                    stack[sp++] = node->child[slot];                            \
+                    continue;                                                   \
+                }                                                               \
+                f32 t = t_max;                                                  \
+                u32 hit = sphere_intersect_n(wbvh->store, node->child[slot],    \
+                    node->count[slot], ray, &t);                                \
+                if (hit != SPHERE_STORE_MISS) {                                 \
+                    *occluder = hit;                                            \
+                    return true;                                                \
+                }                                                               \
+            }                                                                   \
+        }                                                                       \
+        return false;                                                           \
+    }                                                                           \
+                                                                                \
+    void destroy_wbvh##W(WBVH##W *wbvh) {                                       \
+        aligned_free(wbvh->nodes);                                              \
+        destroy_sphere_store(wbvh->store);                                      \
+        free(wbvh->spheres);                                                    \
+        free(wbvh);                                                             \
+    }                                                                           \
+                                                                                \
+    void wbvh##W##_debug_print(WBVH##W *wbvh) {                                 \
+        printf("WBVH%u: %u nodes of %zu bytes (%.2f MiB), %u leaves, "          \
+               "depth %u, %u spheres\n",                                        \
+            W, wbvh->node_count, sizeof(WBVH##W##Node),                         \
+            wbvh->node_count * sizeof(WBVH##W##Node) / (1024.0 * 1024.0),       \
+            wbvh->leaf_count, wbvh->depth, wbvh->sphere_count);                 \
+    }
+
+define_WBVH(4)
+define_WBVH(8)
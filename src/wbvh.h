@@ -0,0 +1,75 @@
+#ifndef WBVH_H
+#define WBVH_H
+/**
+ * @file wbvh.h
+ * @author Jon Voigt Tøttrup (jvoi@itu.dk)
+ *
+ * @brief Wide bounding volume hierarchies, with four or eight children per
+ * node, tested against a ray all at once.
+ * @version 0.1
+ * @date 2026-10-17
+ *
+ * @copyright WingCorp (c) 2023
+ *
+ */
+
+#include "bvh.h"
+#include "defs.h"
+#include "hit.h"
+#include "ray.h"
+#include "sphere.h"
+#include "sphere_store.h"
+
+#define WBVH_EMPTY 0xffffffffu
+
+/**
+ * @brief Define a hierarchy W children wide, collapsed from a binary BVH.
+ *
+ * The child boxes of a node are stored as structure-of-arrays, one row per
+ * bound with the W children side by side, so slabs4 or slabs8 can test them
+ * in one go. A child with count > 0 is a leaf holding count spheres from
+ * child onwards, a child with count 0 is the node at index child. Unused
+ * slots have child WBVH_EMPTY and NaN bounds, which the slab tests never hit.
+ *
+ * This defines:
+ * WBVH##W##Node, WBVH##W, new_wbvh##W, wbvh##W##_closest (which, like
+ * bvh_closest, returns a sphere index), wbvh##W##_intersect,
+ * wbvh##W##_occluded, destroy_wbvh##W and wbvh##W##_debug_print.
+ */
+#define define_WBVH_header(W)                                                   \
+    typedef struct __attribute__((aligned(64))) _WBVH##W##Node {                \
+        f32 bounds[6][W];                                                       \
+        u32 child[W];                                                           \
+        u32 count[W];                                                           \
+    } WBVH##W##Node;                                                            \
+                                                                                \
+    typedef struct _WBVH##W {                                                   \
+        WBVH##W##Node *nodes;                                                   \
+        u32 node_count;                                                         \
+        u32 leaf_count;                                                         \
+        u32 depth;                                                              \
+        Sphere **spheres;                                                       \
+        SphereStore *store;                                                     \
+        u32 sphere_count;                                                       \
+    } WBVH##W;                                                                  \
+                                                                                \
+    WBVH##W *new_wbvh##W(BVH *bvh);                                             \
+    u32 wbvh##W##_closest(WBVH##W *wbvh, Ray *ray, f32 *t);                     \
+    HitOption wbvh##W##_intersect(WBVH##W *wbvh, Ray *ray);                     \
+    bool wbvh##W##_occluded(                                                    \
+        WBVH##W *wbvh, Ray *ray, f32 t_max, u32 *occluder);                     \
+    void destroy_wbvh##W(WBVH##W *wbvh);                                        \
+    void wbvh##W##_debug_print(WBVH##W *wbvh);
+
+/**
+ * @brief WBVH4 and friends. new_wbvh4 takes over the spheres of the binary
+ * BVH and destroys the rest of it.
+ */
+define_WBVH_header(4)
+
+/**
+ * @brief WBVH8 and friends, like WBVH4.
+ */
+define_WBVH_header(8)
+
+#endif
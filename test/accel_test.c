@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../src/color.h"
+#include "../src/mesh.h"
+#include "../src/parallel.h"
+#include "../src/parser.h"
+#include "../src/ray.h"
+#include "../src/scene.h"
+#include "../src/simd.h"
+#include "../src/sphere_store.h"
+#include "../src/wavefront.h"
+
+#define THREADS 4
+#define SORT_BATCH 256
+#define WAVE_SIZE 1024
+
+typedef enum _Mode {
+    MODE_RAYS,
+    MODE_PACKETS_4,
+    MODE_PACKETS_8,
+    MODE_SORTED,
+    MODE_WAVEFRONT,
+} Mode;
+
+static const char *mode_names[] = {"rays", "packets4", "packets8", "sorted", "wavefront"};
+
+static const char *accelerator_names[] = {
+    "none", "bvh", "lbvh", "kdtree", "grid", "grid2", "qbvh", "obvh", "cbvh8", "cbvh16"};
+
+// The frame rendered, big enough by default that rays graze a few spheres.
+static u32 width = 320;
+static u32 height = 200;
+
+static u32 map_rgb(void *fmt, u8 r, u8 g, u8 b)
+{
+    return (u32)r << 16 | (u32)g << 8 | b;
+}
+
+static void select_simd(SimdLevel level)
+{
+    simd_select(level);
+    ray_select_kernels(level);
+    sphere_store_select_kernel(level);
+    mesh_select_kernel(level);
+}
+
+static void render_packets(Scene *scene, Ray *rays, u32 block, u32 *raster, ShadowCache *cache)
+{
+    Ray packet[BVH_PACKET_MAX];
+    HitOption hits[BVH_PACKET_MAX];
+    for (u32 y = 0; y < height; y += block) {
+        for (u32 x = 0; x < width; x += block) {
+            u32 n = camera_gather_block(rays, width, height, x, y, block, packet);
+            trace_packet(scene, packet, n, hits, cache);
+            u32 k = 0;
+            for (u32 row = y; row < y + block && row < height; row++) {
+                for (u32 col = x; col < x + block && col < width; col++, k++) {
+                    if (is_some(hits[k])) {
+                        raster[row * width + col] = color_to_pixel(hits[k].value.color);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Render a frame the way the renderer does in a mode, leaving 0 where rays
+// miss everything.
+static void render(Scene *scene, Ray *rays, Mode mode, u32 *raster, ShadowCache *cache)
+{
+    u32 count = width * height;
+    memset(raster, 0, sizeof(u32) * count);
+    switch (mode) {
+        case MODE_RAYS:
+            for (u32 i = 0; i < count; i++) {
+                HitOption hit = trace_ray(scene, &rays[i], cache);
+                if (is_some(hit)) {
+                    raster[i] = color_to_pixel(hit.value.color);
+                }
+            }
+            break;
+        case MODE_PACKETS_4:
+            render_packets(scene, rays, 4, raster, cache);
+            break;
+        case MODE_PACKETS_8:
+            render_packets(scene, rays, 8, raster, cache);
+            break;
+        case MODE_SORTED: {
+            HitOption *hits = malloc(sizeof(HitOption) * SORT_BATCH);
+            for (u32 first = 0; first < count; first += SORT_BATCH) {
+                u32 n = count - first < SORT_BATCH ? count - first : SORT_BATCH;
+                trace_batch(scene, rays + first, n, hits, cache);
+                for (u32 k = 0; k < n; k++) {
+                    if (is_some(hits[k])) {
+                        raster[first + k] = color_to_pixel(hits[k].value.color);
+                    }
+                }
+            }
+            free(hits);
+            break;
+        }
+        case MODE_WAVEFRONT: {
+            u32 *pixels = malloc(sizeof(u32) * count);
+            for (u32 i = 0; i < count; i++) {
+                pixels[i] = i;
+            }
+            Wavefront *wf = new_wavefront(WAVE_SIZE);
+            wavefront_render(wf, scene, rays, pixels, count, raster, cache);
+            destroy_wavefront(wf);
+            free(pixels);
+            break;
+        }
+    }
+}
+
+// A ray along an axis that lies in the plane of a box's face divides 0 by 0
+// in the slab test unless its reciprocal direction is nudged off infinity.
+// The sphere it grazes has a node of its own, which must not be skipped.
+static bool check_face_ray()
+{
+    Scene *scene = new_scene();
+    scene_set_camera(scene, new_camera(vec3(0.0f, 0.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f)));
+    scene_add_light(scene, (Light){.position = vec3(0.0f, 0.0f, 0.0f), .color = vec3(1.0f, 1.0f, 1.0f)});
+    Sphere *spheres[65];
+    spheres[0] = new_sphere(vec3(1.0f, 0.0f, 20.0f), 1.0f, vec3(1.0f, 0.0f, 0.0f));
+    for (u32 i = 1; i < 65; i++) {
+        spheres[i] = new_sphere(vec3(10.0f + i % 4, (f32)(i / 4), 5.0f), 0.3f, vec3(0.0f, 1.0f, 0.0f));
+    }
+    for (u32 i = 0; i < 65; i++) {
+        scene_add_sphere(scene, spheres[i]);
+    }
+    bool ok = true;
+    for (Accelerator a = ACCEL_NONE; a <= ACCEL_CBVH16; a++) {
+        scene_build_acceleration(scene, a, 1, THREADS);
+        Ray ray = {.origin = vec3(0.0f, 0.0f, 0.0f), .direction = vec3(0.0f, 0.0f, 1.0f)};
+        HitOption hit = trace_ray(scene, &ray, NULL);
+        if (is_none(hit) || hit.value.distance != 20.0f) {
+            printf("-a %-6s face ray FAILED, missed the sphere it grazes\n", accelerator_names[a]);
+            ok = false;
+        }
+    }
+    free(scene_get_camera(scene));
+    scene_free(scene);
+    for (u32 i = 0; i < 65; i++) {
+        free(spheres[i]);
+    }
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2 && argc != 4) {
+        printf("To test:\naccel_test <scene>.json [width height]\n");
+        printf("A scene can be made with: python test_gen.py <num_balls> <seed>\n");
+        return 1;
+    }
+    if (argc == 4) {
+        width = (u32)atoi(argv[2]);
+        height = (u32)atoi(argv[3]);
+    }
+    // Pixels are packed the way SDL_MapRGB packs them for RGB888.
+    static u8 format;
+    color_register_format(&format, map_rgb);
+    ThreadPool *pool = new_thread_pool(THREADS - 1, false);
+    parallel_use_pool(pool);
+    Scene *scene = parse_scene(argv[1], THREADS);
+    Ray *rays = setup_perspective_rays(scene_get_camera(scene), width, height);
+    u32 *reference = malloc(sizeof(u32) * width * height);
+    u32 *raster = malloc(sizeof(u32) * width * height);
+
+    // Every sphere tested one at a time in plain C, without a shadow cache.
+    select_simd(SIMD_SCALAR);
+    scene_build_acceleration(scene, ACCEL_NONE, BVH_DEFAULT_LEAF_SIZE, THREADS);
+    render(scene, rays, MODE_RAYS, reference, NULL);
+    u32 lit = 0;
+    for (u32 i = 0; i < width * height; i++) {
+        lit += reference[i] != 0;
+    }
+    printf("Reference: -a none -s scalar, %u of %u pixels hit and lit\n", lit, width * height);
+
+    bool ok = check_face_ray();
+    SimdLevel detected = simd_detect();
+    for (Accelerator a = ACCEL_NONE; a <= ACCEL_CBVH16; a++) {
+        scene_build_acceleration(scene, a, BVH_DEFAULT_LEAF_SIZE, THREADS);
+        for (SimdLevel level = SIMD_SCALAR; level <= detected; level++) {
+            select_simd(level);
+            for (Mode mode = MODE_RAYS; mode <= MODE_WAVEFRONT; mode++) {
+                ShadowCache *cache = new_shadow_cache(scene);
+                render(scene, rays, mode, raster, cache);
+                destroy_shadow_cache(cache);
+                u32 mismatches = 0;
+                for (u32 i = 0; i < width * height; i++) {
+                    mismatches += raster[i] != reference[i];
+                }
+                if (mismatches > 0) {
+                    ok = false;
+                }
+                printf("-a %-6s -s %-6s %-9s %s", accelerator_names[a], simd_level_name(level), mode_names[mode],
+                    mismatches == 0 ? "ok\n" : "FAILED");
+                if (mismatches > 0) {
+                    printf(", %u pixels differ\n", mismatches);
+                }
+            }
+        }
+    }
+
+    free(raster);
+    free(reference);
+    free(rays);
+    scene_free(scene);
+    parallel_use_pool(NULL);
+    destroy_thread_pool(pool);
+    printf(ok ? "Every combination matches the reference.\n" : "Some combinations differ from the reference!\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <string.h>
+#include "../src/kdtree.h"
+
+#define POINTS 5000
+#define QUERIES 2000
+
+typedef struct _Point {
+    Vec3 position;
+    u32 id;
+} Point;
+
+#define point_position(point) ((point).position)
+#define point_bounds(point) ((AABB){.min = (point).position, .max = (point).position})
+define_V3Tree(Point, point_position, point_bounds);
+
+static f32 random_f32(f32 min, f32 max)
+{
+    return min + (max - min) * ((f32)rand() / (f32)RAND_MAX);
+}
+
+static Vec3 random_point()
+{
+    return vec3(random_f32(-10.0f, 10.0f), random_f32(-10.0f, 10.0f), random_f32(-10.0f, 10.0f));
+}
+
+static f32 distance2(Vec3 a, Vec3 b)
+{
+    Vec3 d = vsub(a, b);
+    return dot(d, d);
+}
+
+typedef struct _Visits {
+    bool *seen;
+    u32 repeats;
+} Visits;
+
+static void mark(Point point, void *ctx)
+{
+    Visits *visits = (Visits *)ctx;
+    visits->repeats += visits->seen[point.id];
+    visits->seen[point.id] = true;
+}
+
+// Check nearest and radius queries against a scan over every point, with
+// queries both among the points and well outside them.
+static bool check_tree(Point *points, u32 count, const char *name)
+{
+    PointV3Tree *tree = new_PointV3Tree(points, count);
+    bool *seen = malloc(sizeof(bool) * (count > 0 ? count : 1));
+    u32 nearest_wrong = 0;
+    u32 radius_wrong = 0;
+    for (u32 q = 0; q < QUERIES; q++) {
+        Vec3 query = q % 10 == 0 ? smul(random_point(), 3.0f) : random_point();
+
+        // Ties may be broken either way, so only the distance has to match.
+        f32 best = FLT_MAX;
+        for (u32 i = 0; i < count; i++) {
+            f32 d2 = distance2(points[i].position, query);
+            best = d2 < best ? d2 : best;
+        }
+        Point found;
+        bool any = PointV3Tree_nearest(tree, query, &found);
+        if (any != (count > 0) || (any && distance2(found.position, query) != best)) {
+            nearest_wrong++;
+        }
+
+        f32 radius = random_f32(0.0f, 4.0f);
+        memset(seen, 0, sizeof(bool) * count);
+        Visits visits = {.seen = seen, .repeats = 0};
+        u32 visited = PointV3Tree_radius(tree, query, radius, mark, &visits);
+        u32 inside = 0;
+        bool same = visits.repeats == 0;
+        for (u32 i = 0; i < count; i++) {
+            bool within = distance2(points[i].position, query) <= radius * radius;
+            inside += within;
+            same &= within == seen[i];
+        }
+        if (!same || visited != inside) {
+            radius_wrong++;
+        }
+    }
+    bool ok = nearest_wrong == 0 && radius_wrong == 0;
+    printf("%-10s %s: %u of %u nearest and %u radius queries differ from a scan\n", name, ok ? "ok" : "FAILED",
+        nearest_wrong, QUERIES, radius_wrong);
+    free(seen);
+    destroy_PointV3Tree(tree);
+    return ok;
+}
+
+int main()
+{
+    srand(1234);
+    Point *points = malloc(sizeof(Point) * POINTS);
+    for (u32 i = 0; i < POINTS; i++) {
+        points[i] = (Point){.position = random_point(), .id = i};
+    }
+    bool ok = true;
+    ok &= check_tree(points, POINTS, "scattered");
+    ok &= check_tree(points, 1, "single");
+    ok &= check_tree(points, 0, "empty");
+
+    // Points on a coarse lattice share coordinates on every axis, and some
+    // share a position, which the median splits have to cope with.
+    for (u32 i = 0; i < POINTS; i++) {
+        points[i].position = vec3((f32)(rand() % 8), (f32)(rand() % 8), (f32)(rand() % 8));
+    }
+    ok &= check_tree(points, POINTS, "lattice");
+    free(points);
+    printf(ok ? "All queries match a scan.\n" : "Some queries do not match a scan!\n");
+    return ok ? 0 : 1;
+}
@@ -7,7 +7,7 @@ int main(int argc, char **argv)
         return 1;
     }
     printf("Parsing scene '%s'... ",argv[1]);
-    Scene *scene = parse_scene(argv[1]);
+    Scene *scene = parse_scene(argv[1], 1);
     printf("done!\n");
     scene_debug_print(scene);
     scene_free(scene);
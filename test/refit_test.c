@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include "../src/parallel.h"
+#include "../src/scene.h"
+
+#define SPHERES 2000
+#define WIDTH 160
+#define HEIGHT 120
+#define THREADS 4
+
+static f32 random_f32(f32 min, f32 max)
+{
+    return min + (max - min) * ((f32)rand() / (f32)RAND_MAX);
+}
+
+static Vec3 random_position()
+{
+    return vec3(random_f32(-1.5f, 1.5f), random_f32(-1.0f, 1.0f), random_f32(2.0f, 8.0f));
+}
+
+// Trace a ray per pixel, keeping the shadow cache from one frame to the next
+// as the renderer does.
+static void trace_frame(Scene *scene, Ray *rays, HitOption *hits, ShadowCache *cache)
+{
+    for (u32 i = 0; i < WIDTH * HEIGHT; i++) {
+        hits[i] = trace_ray(scene, &rays[i], cache);
+    }
+}
+
+static u32 count_mismatches(HitOption *a, HitOption *b)
+{
+    u32 mismatches = 0;
+    for (u32 i = 0; i < WIDTH * HEIGHT; i++) {
+        if (is_some(a[i]) != is_some(b[i])) {
+            mismatches++;
+        } else if (is_some(a[i]) && (a[i].value.distance != b[i].value.distance ||
+                                        a[i].value.color.x != b[i].value.color.x ||
+                                        a[i].value.color.y != b[i].value.color.y ||
+                                        a[i].value.color.z != b[i].value.color.z)) {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+// Refit the scene after its spheres have moved, and check that it renders the
+// same as a structure built from scratch, and that it was rebuilt or not as
+// expected.
+static bool check_refit(Scene *scene, Accelerator accelerator, const char *name, const char *move, bool expect_rebuild,
+    Ray *rays, ShadowCache *cache)
+{
+    HitOption *refitted = malloc(sizeof(HitOption) * WIDTH * HEIGHT);
+    HitOption *fresh = malloc(sizeof(HitOption) * WIDTH * HEIGHT);
+    bool rebuilt = scene_refit(scene, THREADS);
+    trace_frame(scene, rays, refitted, cache);
+    scene_build_acceleration(scene, accelerator, BVH_DEFAULT_LEAF_SIZE, THREADS);
+    ShadowCache *fresh_cache = new_shadow_cache(scene);
+    trace_frame(scene, rays, fresh, fresh_cache);
+    destroy_shadow_cache(fresh_cache);
+    u32 mismatches = count_mismatches(refitted, fresh);
+    bool ok = mismatches == 0 && rebuilt == expect_rebuild;
+    printf("%-6s %-9s %s: %s, %u of %u pixels differ from a fresh build\n", name, move, ok ? "ok" : "FAILED",
+        rebuilt ? "rebuilt" : "refitted", mismatches, WIDTH * HEIGHT);
+    free(refitted);
+    free(fresh);
+    return ok;
+}
+
+int main()
+{
+    struct {
+        Accelerator accelerator;
+        const char *name;
+        // Whether nudging and scattering the spheres should rebuild.
+        bool rebuild_nudged;
+        bool rebuild_scattered;
+    } cases[] = {
+        {ACCEL_BVH, "bvh", false, true},
+        {ACCEL_LBVH, "lbvh", false, true},
+        {ACCEL_NONE, "none", false, false},
+        {ACCEL_GRID, "grid", true, true},
+    };
+    // Builds and refits borrow their helpers from a pool, as in the renderer.
+    ThreadPool *pool = new_thread_pool(THREADS - 1, false);
+    parallel_use_pool(pool);
+    bool ok = true;
+    for (u32 c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        srand(1234);
+        Scene *scene = new_scene();
+        scene_set_camera(scene, new_camera(vec3(0.0f, 0.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f)));
+        scene_add_light(scene, (Light){.position = vec3(0.0f, 3.0f, 0.0f), .color = vec3(1.0f, 1.0f, 1.0f)});
+        Sphere **spheres = malloc(sizeof(Sphere *) * SPHERES);
+        for (u32 i = 0; i < SPHERES; i++) {
+            Color color = vec3(random_f32(0.0f, 1.0f), random_f32(0.0f, 1.0f), random_f32(0.0f, 1.0f));
+            spheres[i] = new_sphere(random_position(), 0.1f, color);
+            scene_add_sphere(scene, spheres[i]);
+        }
+        scene_build_acceleration(scene, cases[c].accelerator, BVH_DEFAULT_LEAF_SIZE, THREADS);
+        Ray *rays = setup_perspective_rays(scene_get_camera(scene), WIDTH, HEIGHT);
+        HitOption *hits = malloc(sizeof(HitOption) * WIDTH * HEIGHT);
+        ShadowCache *cache = new_shadow_cache(scene);
+        trace_frame(scene, rays, hits, cache);
+
+        // Small moves keep a BVH close to what a build would make of them.
+        for (u32 i = 0; i < SPHERES; i++) {
+            spheres[i]->center = vadd(spheres[i]->center,
+                vec3(random_f32(-0.01f, 0.01f), random_f32(-0.01f, 0.01f), random_f32(-0.01f, 0.01f)));
+            spheres[i]->radius = random_f32(0.09f, 0.11f);
+        }
+        ok &= check_refit(scene, cases[c].accelerator, cases[c].name, "nudged", cases[c].rebuild_nudged, rays, cache);
+
+        // Sending every sphere somewhere else stretches every box of a BVH
+        // across the scene, well past what a refit may cost.
+        for (u32 i = 0; i < SPHERES; i++) {
+            spheres[i]->center = random_position();
+        }
+        ok &= check_refit(scene, cases[c].accelerator, cases[c].name, "scattered", cases[c].rebuild_scattered, rays,
+            cache);
+
+        destroy_shadow_cache(cache);
+        free(hits);
+        free(rays);
+        free(scene_get_camera(scene));
+        scene_free(scene);
+        for (u32 i = 0; i < SPHERES; i++) {
+            free(spheres[i]);
+        }
+        free(spheres);
+    }
+    parallel_use_pool(NULL);
+    destroy_thread_pool(pool);
+    printf(ok ? "All refits match a fresh build.\n" : "Some refits do not match a fresh build!\n");
+    return ok ? 0 : 1;
+}
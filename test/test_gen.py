@@ -23,8 +23,8 @@ def random_position(min_x, max_x, min_y, max_y, min_z, max_z):
     }
 
 # Check if the number of balls argument is provided
-if len(sys.argv) != 2:
-    print("Usage: python generate_scene.py <num_balls>")
+if len(sys.argv) not in (2, 3):
+    print("Usage: python generate_scene.py <num_balls> [seed]")
     sys.exit(1)
 
 try:
@@ -33,6 +33,14 @@ except ValueError:
     print("Error: Please provide a valid integer for the number of balls.")
     sys.exit(1)
 
+# The same seed makes the same scene, for tests to compare renders of.
+if len(sys.argv) == 3:
+    try:
+        random.seed(int(sys.argv[2]))
+    except ValueError:
+        print("Error: Please provide a valid integer for the seed.")
+        sys.exit(1)
+
 # Initialize the scene dictionary
 scene = {
     "camera": {